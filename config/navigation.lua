@@ -0,0 +1,8 @@
+-- Path options of the "arcs" local planner. Changes take effect while
+-- running, once the path options and their swept volume lookup tables are
+-- rebuilt in the background.
+
+-- Curvature samples on each side of zero curvature.
+curvature_sample_count = 10
+-- Footprints drawn along each arc.
+arc_samples = 5
@@ -2,3 +2,31 @@ map = "maps/GDC3.txt"
 init_x = 14.7
 init_y = 14.24
 init_r = 0
+
+-- Measurement model: "ray_cast" casts a ray per beam, "likelihood_field"
+-- looks up the distance from each beam endpoint to the closest wall.
+observation_model = "likelihood_field"
+
+-- Beams used by the measurement model: "uniform" takes every n-th beam,
+-- "informative" also skips max range readings and readings that end away
+-- from any wall at the estimated pose.
+beam_selection = "informative"
+num_beams = 50
+-- CPU time budget for one measurement update, in seconds, summed over all
+-- threads of the process. When positive, the number of beams is adapted every
+-- scan to fit it, up to num_beams.
+beam_time_budget = 0.0
+-- Time after a scan is taken by which its update has to finish, in seconds.
+-- When positive, particles are evaluated from the most likely down until the
+-- deadline, and the rest get interpolated likelihoods. 0 evaluates them all.
+laser_update_deadline = 0.0
+
+-- Translation process noise variance, per meter traveled.
+Q_tt = 0.5
+-- Correlation between laser beams, applied as an exponent on the likelihood of
+-- a scan. Values below 1 make the filter less overconfident.
+gamma = 1.0
+
+-- Pose estimate: "mean" is the weighted mean of all particles, "cluster" the
+-- weighted mean of the particles around the densest cell of a pose grid.
+pose_estimate = "mean"
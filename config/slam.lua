@@ -0,0 +1,13 @@
+-- Scan registration. Changes take effect while running: the voxel cube is
+-- rebuilt in the background, and the raster takes the new resolution the next
+-- time it is generated.
+
+-- Translation since the last registered scan before a new scan is registered,
+-- in meters.
+min_trans = 1.25
+-- Raster resolution, in meters.
+resolution = 0.075
+-- Voxel cube samples on each side of the odometry estimate, in location and
+-- angle. The cube has (2*loc_samples+1)^2*(2*angle_samples+1) voxels.
+loc_samples = 10
+angle_samples = 15
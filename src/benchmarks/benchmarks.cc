@@ -0,0 +1,412 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    benchmarks.cc
+\brief   Microbenchmarks of the geometry, map, localization, SLAM and
+         navigation kernels, on scans simulated in the GDC maps. Does not need ROS, and has to
+         be run from the repository root, where the maps and config are.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "shared/math/line2d.h"
+#include "shared/util/random.h"
+#include "shared/util/timer.h"
+#include "navigation/navigation.h"
+#include "particle_filter/particle_filter.h"
+#include "slam/slam.h"
+#include "vector_map/vector_map.h"
+
+using Eigen::MatrixXf;
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using geometry::line2f;
+using navigation::Navigation;
+using navigation::PathOption;
+using particle_filter::Particle;
+using particle_filter::ParticleFilter;
+using std::string;
+using std::vector;
+
+DEFINE_string(maps, "GDC1,GDC2,GDC3",
+              "Comma-separated list of maps in maps/ to use as fixtures");
+DEFINE_string(filter, "",
+              "Only run benchmarks whose name contains this string");
+DEFINE_double(min_time, 0.2, "Minimum time to run each sample for, in s");
+DEFINE_int32(samples, 5, "Number of timed samples per benchmark");
+DEFINE_int32(poses, 32, "Number of simulated scans per map");
+DEFINE_int32(seed, 1, "Random seed for the simulated poses and noise");
+
+namespace {
+// Simulated laser, matching the real one.
+const int kNumRays = 1081;
+const float kAngleMin = -2.35;
+const float kAngleMax = 2.35;
+const float kRangeMin = 0.02;
+const float kRangeMax = 10.0;
+const float kRangeNoise = 0.02;
+// Rays tested against every map line in the intersection benchmark.
+const int kNumIntersectionRays = 64;
+// Raster parameters, matching the SLAM defaults.
+const float kRasterResolution = 0.075;
+const float kRasterSensorNoise = 0.2;
+const int kRasterRows = 2 * 8.5 / kRasterResolution;
+const int kRasterCols = 2 * 5.5 / kRasterResolution;
+
+// A kernel to time. Every call of run processes items_per_run items, and
+// the time is reported per item.
+struct Benchmark {
+  string name;
+  string item;
+  int items_per_run;
+  std::function<void()> run;
+};
+
+// Poses and scans simulated in one map.
+struct MapFixture {
+  string name;
+  vector_map::VectorMap map;
+  vector<Vector2f> locs;
+  vector<float> angles;
+  vector<vector<float>> scans;
+  // Scans as points in the laser frame.
+  vector<vector<Vector2f>> clouds;
+};
+
+// Keeps the compiler from optimizing away results of the kernels.
+volatile float sink_;
+// Drops the drive commands and visualizations of Navigation.
+navigation::NullNavigationSink navigation_sink_;
+
+double TimeRuns(const Benchmark& benchmark, int64_t runs) {
+  const double t_start = GetMonotonicTime();
+  for (int64_t i = 0; i < runs; ++i) benchmark.run();
+  return GetMonotonicTime() - t_start;
+}
+
+void RunBenchmark(const Benchmark& benchmark) {
+  // Grow the number of runs per sample until a sample takes long enough to
+  // time accurately. This also warms up caches and lazily built state.
+  int64_t runs = 1;
+  double t = TimeRuns(benchmark, runs);
+  while (t < FLAGS_min_time && runs < (int64_t(1) << 40)) {
+    const double scale = (t > 0) ? 1.5 * FLAGS_min_time / t : 100.0;
+    runs = std::max(runs + 1,
+                    static_cast<int64_t>(runs * std::min(100.0, scale)));
+    t = TimeRuns(benchmark, runs);
+  }
+  vector<double> ns_per_item;
+  for (int i = 0; i < FLAGS_samples; ++i) {
+    ns_per_item.push_back(1e9 * TimeRuns(benchmark, runs) /
+                          (runs * benchmark.items_per_run));
+  }
+  std::sort(ns_per_item.begin(), ns_per_item.end());
+  printf("%-44s %12.1f %12.1f %12.1f  ns/%s\n",
+         benchmark.name.c_str(),
+         ns_per_item[ns_per_item.size() / 2],
+         ns_per_item.front(),
+         ns_per_item.back(),
+         benchmark.item.c_str());
+  fflush(stdout);
+}
+
+vector<Vector2f> ScanToPoints(const vector<float>& ranges) {
+  vector<Vector2f> points;
+  const float da = (kAngleMax - kAngleMin) / (ranges.size() - 1);
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i] >= kRangeMax) continue;
+    const float a = kAngleMin + i * da;
+    points.push_back(ranges[i] * Vector2f(cos(a), sin(a)));
+  }
+  return points;
+}
+
+// Simulate scans from random poses in the open inside the map, with range
+// noise.
+void LoadFixture(const string& name,
+                 util_random::Random* rng,
+                 MapFixture* fixture) {
+  fixture->name = name;
+  fixture->map.Load("maps/" + name + ".txt");
+  const vector_map::VectorMap& map = fixture->map;
+  Vector2f min_corner = map.lines[0].p0;
+  Vector2f max_corner = map.lines[0].p0;
+  for (const line2f& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  vector<float> ranges;
+  for (int attempt = 0;
+       static_cast<int>(fixture->locs.size()) < FLAGS_poses &&
+       attempt < 1000 * FLAGS_poses;
+       ++attempt) {
+    const Vector2f loc(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                       rng->UniformRandom(min_corner.y(), max_corner.y()));
+    const float angle = rng->UniformRandom(-M_PI, M_PI);
+    fixture->map.GetPredictedScan(loc, kRangeMin, kRangeMax,
+                                  angle + kAngleMin, angle + kAngleMax,
+                                  kNumRays, &ranges);
+    // Keep poses inside the building, clear of walls.
+    int num_hits = 0;
+    float closest = kRangeMax;
+    for (const float r : ranges) {
+      if (r < kRangeMax) ++num_hits;
+      closest = std::min(closest, r);
+    }
+    if (num_hits < 3 * kNumRays / 4 || closest < 0.3) continue;
+    for (float& r : ranges) {
+      if (r < kRangeMax) {
+        r = std::max<float>(kRangeMin, r + rng->Gaussian(0, kRangeNoise));
+      }
+    }
+    fixture->locs.push_back(loc);
+    fixture->angles.push_back(angle);
+    fixture->scans.push_back(ranges);
+    fixture->clouds.push_back(ScanToPoints(ranges));
+  }
+  printf("%s: %lu lines, %lu poses\n",
+         name.c_str(),
+         static_cast<unsigned long>(map.lines.size()),
+         static_cast<unsigned long>(fixture->locs.size()));
+}
+
+void AddMapBenchmarks(MapFixture* fixture,
+                      util_random::Random* rng,
+                      vector<Benchmark>* benchmarks) {
+  const size_t num_poses = fixture->locs.size();
+  if (num_poses == 0) return;
+
+  // Rays from the simulated poses, in random directions.
+  vector<line2f> rays;
+  for (int i = 0; i < kNumIntersectionRays; ++i) {
+    const Vector2f& loc = fixture->locs[i % num_poses];
+    const float angle = rng->UniformRandom(-M_PI, M_PI);
+    rays.push_back(line2f(loc, loc + kRangeMax * Vector2f(cos(angle),
+                                                          sin(angle))));
+  }
+  benchmarks->push_back(Benchmark{
+      "line2f::Intersection/" + fixture->name,
+      "call",
+      static_cast<int>(rays.size() * fixture->map.lines.size()),
+      [fixture, rays]() {
+        float sum = 0;
+        Vector2f p;
+        for (const line2f& ray : rays) {
+          for (const line2f& l : fixture->map.lines) {
+            if (l.Intersection(ray, &p)) sum += p.x();
+          }
+        }
+        sink_ = sum;
+      }});
+
+  size_t scan_index = 0;
+  benchmarks->push_back(Benchmark{
+      "VectorMap::GetPredictedScan/" + fixture->name,
+      "scan",
+      1,
+      [fixture, scan_index]() mutable {
+        const size_t i = scan_index++ % fixture->locs.size();
+        vector<float> scan;
+        fixture->map.GetPredictedScan(fixture->locs[i], kRangeMin, kRangeMax,
+                                      fixture->angles[i] + kAngleMin,
+                                      fixture->angles[i] + kAngleMax,
+                                      kNumRays, &scan);
+        sink_ = scan[0];
+      }});
+
+  benchmarks->push_back(Benchmark{
+      "VectorMap::SceneRender/" + fixture->name,
+      "scene",
+      1,
+      [fixture, scan_index]() mutable {
+        const size_t i = scan_index++ % fixture->locs.size();
+        vector<line2f> render;
+        fixture->map.SceneRender(fixture->locs[i], kRangeMax,
+                                 fixture->angles[i] + kAngleMin,
+                                 fixture->angles[i] + kAngleMax,
+                                 &render);
+        sink_ = render.size();
+      }});
+
+  // The filter is initialized at the first simulated pose, and every update
+  // observes the scan from that pose, as in steady state tracking.
+  std::shared_ptr<ParticleFilter> filter(new ParticleFilter());
+  filter->Initialize(fixture->name, fixture->locs[0], fixture->angles[0]);
+  std::shared_ptr<vector<Particle>> particles(new vector<Particle>());
+  filter->GetParticles(particles.get());
+  benchmarks->push_back(Benchmark{
+      "ParticleFilter::Update/" + fixture->name,
+      "scan",
+      1,
+      [fixture, filter, particles]() {
+        filter->Update(fixture->scans[0], kRangeMin, kRangeMax, kAngleMin,
+                       kAngleMax, particles.get());
+      }});
+  benchmarks->push_back(Benchmark{
+      "ParticleFilter::Resample/" + fixture->name,
+      "resample",
+      1,
+      [filter]() { filter->Resample(); }});
+  // Every odometry message moves the robot 5cm forward, and turns it slightly.
+  int odometry_index = 0;
+  benchmarks->push_back(Benchmark{
+      "ParticleFilter::ObserveOdometry/" + fixture->name,
+      "odometry",
+      1,
+      [filter, odometry_index]() mutable {
+        const float angle = 0.01 * odometry_index;
+        const float distance = 0.05 * odometry_index++;
+        filter->ObserveOdometry(distance * Vector2f(cos(angle), sin(angle)),
+                                angle);
+      }});
+
+  MatrixXf generated_raster(kRasterRows, kRasterCols);
+  benchmarks->push_back(Benchmark{
+      "slam::GenerateRaster/" + fixture->name,
+      "raster",
+      1,
+      [fixture, scan_index, generated_raster]() mutable {
+        const size_t i = scan_index++ % fixture->clouds.size();
+        slam::GenerateRaster(fixture->clouds[i], kRasterResolution,
+                             kRasterSensorNoise, &generated_raster);
+        sink_ = generated_raster(0, 0);
+      }});
+
+  // Every call scores one candidate of the correlative scan matcher: a scan
+  // transformed by a small offset, against the raster of the first scan.
+  std::shared_ptr<MatrixXf> raster(new MatrixXf(kRasterRows, kRasterCols));
+  slam::GenerateRaster(fixture->clouds[0], kRasterResolution,
+                       kRasterSensorNoise, raster.get());
+  const vector<Vector2f> candidate = slam::TransformPointCloud(
+      fixture->clouds[0], Vector2f(0.1, -0.05), 0.02);
+  benchmarks->push_back(Benchmark{
+      "slam::RasterWeighting/" + fixture->name,
+      "candidate",
+      1,
+      [raster, candidate]() {
+        sink_ = slam::RasterWeighting(*raster, kRasterResolution, candidate);
+      }});
+
+  // The laser is taken to be at base_link.
+  std::shared_ptr<Navigation> navigation(new Navigation(
+      "maps/" + fixture->name + ".txt", &navigation_sink_, GetMonotonicTime));
+  std::shared_ptr<vector<PathOption>> path_options(new vector<PathOption>());
+  benchmarks->push_back(Benchmark{
+      "Navigation::EvaluatePathOptions/" + fixture->name,
+      "scan",
+      1,
+      [fixture, scan_index, navigation, path_options]() mutable {
+        const size_t i = scan_index++ % fixture->clouds.size();
+        navigation->EvaluatePathOptions(fixture->clouds[i],
+                                        path_options.get());
+        sink_ = path_options->front().free_path_length;
+      }});
+  benchmarks->push_back(Benchmark{
+      "Navigation::EvaluateDynamicWindow/" + fixture->name,
+      "scan",
+      1,
+      [fixture, scan_index, navigation, path_options]() mutable {
+        const size_t i = scan_index++ % fixture->clouds.size();
+        navigation->EvaluateDynamicWindow(fixture->clouds[i],
+                                          path_options.get());
+        sink_ = path_options->front().free_path_length;
+      }});
+}
+
+// Random number generation, per number drawn, in batches of the size of
+// a particle set's motion noise.
+void AddRandomBenchmarks(vector<Benchmark>* benchmarks) {
+  const int kBatchSize = 1024;
+  std::shared_ptr<util_random::Random> random(
+      new util_random::Random(FLAGS_seed));
+  std::shared_ptr<util_random::CounterRandom> counter_random(
+      new util_random::CounterRandom(FLAGS_seed));
+  std::shared_ptr<vector<float>> values(new vector<float>(kBatchSize));
+  benchmarks->push_back(Benchmark{
+      "Random::Gaussian",
+      "number",
+      kBatchSize,
+      [random, values]() {
+        for (float& value : *values) value = random->Gaussian(0, 1);
+        sink_ = values->back();
+      }});
+  benchmarks->push_back(Benchmark{
+      "CounterRandom::Gaussian",
+      "number",
+      kBatchSize,
+      [counter_random, values]() {
+        for (float& value : *values) value = counter_random->Gaussian(0, 1);
+        sink_ = values->back();
+      }});
+  benchmarks->push_back(Benchmark{
+      "CounterRandom::FillGaussian",
+      "number",
+      kBatchSize,
+      [counter_random, values]() {
+        counter_random->FillGaussian(values->data(), values->size(), 0, 1);
+        sink_ = values->back();
+      }});
+  benchmarks->push_back(Benchmark{
+      "Random::UniformRandom",
+      "number",
+      kBatchSize,
+      [random, values]() {
+        for (float& value : *values) value = random->UniformRandom();
+        sink_ = values->back();
+      }});
+  benchmarks->push_back(Benchmark{
+      "CounterRandom::FillUniform",
+      "number",
+      kBatchSize,
+      [counter_random, values]() {
+        counter_random->FillUniform(values->data(), values->size(), 0, 1);
+        sink_ = values->back();
+      }});
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  util_random::Random rng(FLAGS_seed);
+  // Fixtures are referenced by the benchmarks, so they must not move.
+  vector<std::unique_ptr<MapFixture>> fixtures;
+  vector<Benchmark> benchmarks;
+  AddRandomBenchmarks(&benchmarks);
+  std::stringstream maps(FLAGS_maps);
+  string map_name;
+  while (std::getline(maps, map_name, ',')) {
+    fixtures.emplace_back(new MapFixture());
+    LoadFixture(map_name, &rng, fixtures.back().get());
+    AddMapBenchmarks(fixtures.back().get(), &rng, &benchmarks);
+  }
+  printf("%-44s %12s %12s %12s\n", "Benchmark", "median", "min", "max");
+  for (const Benchmark& benchmark : benchmarks) {
+    if (benchmark.name.find(FLAGS_filter) == string::npos) continue;
+    RunBenchmark(benchmark);
+  }
+  return 0;
+}
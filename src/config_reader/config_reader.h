@@ -30,9 +30,13 @@ extern "C" {
 }
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <thread>
@@ -47,9 +51,14 @@ extern "C" {
 
 namespace config_reader {
 
+// Reads every registered key from the files into its staged value, for the
+// next Update() to commit.
 inline void LuaRead(const std::vector<std::string>& files) {
   // Create the LuaScript object
   LuaScript script(files);
+  std::lock_guard<std::mutex> lock(*MapSingleton::Mutex());
+  // Keys registered after this read raise it again.
+  *MapSingleton::NewKeyAdded() = false;
   // Loop through the unordered map
   for (const auto& pair : MapSingleton::Singleton()) {
     config_types::TypeInterface* t = pair.second.get();
@@ -59,14 +68,37 @@ inline void LuaRead(const std::vector<std::string>& files) {
     }
     t->SetValue(&script);
   }
-  *MapSingleton::NewKeyAdded() = false;
+  MapSingleton::PublishedVersion()->fetch_add(1, std::memory_order_release);
 }
 
-class ConfigReader {
-  std::atomic_bool is_running_;
-  std::thread daemon_;
+// One inotify thread for all ConfigReaders of the process, watching the union
+// of their files. It runs while at least one ConfigReader exists.
+class ConfigDaemon {
+  std::mutex mutex_;
+  // Readers of each file.
+  std::map<std::string, int> files_;
+  // Incremented whenever files_ changes, so that the thread updates its
+  // watches.
+  uint64_t files_version_;
+  int num_readers_;
+  // Cleared to stop the thread. Each thread has its own, so that one that is
+  // stopping cannot be kept running by the start of the next.
+  std::shared_ptr<std::atomic_bool> is_running_;
+  std::thread thread_;
+
+  ConfigDaemon() : files_version_(0), num_readers_(0) {}
+
+  // Gets the files to watch if they changed since *version.
+  bool UpdateFiles(uint64_t* version, std::vector<std::string>* files) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (*version == files_version_) return false;
+    files->clear();
+    for (const auto& file : files_) files->push_back(file.first);
+    *version = files_version_;
+    return true;
+  }
 
-  void InitDaemon(const std::vector<std::string> files) {
+  void Run(std::shared_ptr<std::atomic_bool> is_running) {
     static constexpr int kEventSize = sizeof(inotify_event);
     static constexpr int kEventBufferLength = (1024 * (kEventSize + 16));
     static constexpr int kInotifySleep = 50;
@@ -79,19 +111,6 @@ class ConfigReader {
       exit(-1);
     }
 
-    // Add a listener on each parent directory
-    for (const std::string& file : files) {
-      int wd = inotify_add_watch(fd, file.c_str(), IN_MODIFY);
-
-      if (wd < 0) {
-        std::cerr << "ERROR: Couldn't add watch to the file: "
-                  << file
-                  << std::endl;
-        perror("Reason");
-        return;
-      }
-    }
-
     int epfd = epoll_create(1);
     if (epfd < 0) {
       std::cerr << "ERROR: Call to epoll_create failed." << std::endl;
@@ -108,9 +127,38 @@ class ConfigReader {
 
     auto last_notify = std::chrono::system_clock::now();
     bool needs_update = false;
+    std::map<std::string, int> watches;
+    uint64_t watched_version = 0;
+    std::vector<std::string> files;
 
     // Loop forever, checking for changes to the files above
-    while (is_running_) {
+    while (*is_running) {
+      if (UpdateFiles(&watched_version, &files)) {
+        // Add a listener on each new file, and remove those of files no
+        // reader needs any more.
+        for (auto it = watches.begin(); it != watches.end();) {
+          if (std::find(files.begin(), files.end(), it->first) ==
+              files.end()) {
+            inotify_rm_watch(fd, it->second);
+            it = watches.erase(it);
+          } else {
+            ++it;
+          }
+        }
+        for (const std::string& file : files) {
+          if (watches.count(file) > 0) continue;
+          int wd = inotify_add_watch(fd, file.c_str(), IN_MODIFY);
+          if (wd < 0) {
+            std::cerr << "ERROR: Couldn't add watch to the file: "
+                      << file
+                      << std::endl;
+            perror("Reason");
+            continue;
+          }
+          watches[file] = wd;
+        }
+      }
+
       // Wait for 50 ms for there to be an available inotify event
       int nr_events = epoll_wait(epfd, &epoll_events, 1, kInotifySleep);
 
@@ -149,23 +197,57 @@ class ConfigReader {
     close(epfd);
     close(fd);
   }
-  void CreateDaemon(const std::vector<std::string> files) {
-    LuaRead(files);
-    is_running_ = true;
-    daemon_ = std::thread(&ConfigReader::InitDaemon, this, files);
+
+ public:
+  static ConfigDaemon& Instance() {
+    static ConfigDaemon daemon;
+    return daemon;
+  }
+
+  // Adds the files to the watched ones, reads all of them, and commits the
+  // values, so that they are set once the first reader is constructed.
+  void AddReader(const std::vector<std::string>& files) {
+    std::vector<std::string> all_files;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const std::string& file : files) ++files_[file];
+      ++files_version_;
+      for (const auto& file : files_) all_files.push_back(file.first);
+      if (num_readers_++ == 0) {
+        is_running_ = std::make_shared<std::atomic_bool>(true);
+        thread_ = std::thread(&ConfigDaemon::Run, this, is_running_);
+      }
+    }
+    LuaRead(all_files);
+    Update();
   }
 
-  void Stop() {
-    is_running_ = false;
-    if (daemon_.joinable()) {
-      daemon_.join();
+  void RemoveReader(const std::vector<std::string>& files) {
+    std::thread thread;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const std::string& file : files) {
+        if (--files_[file] == 0) files_.erase(file);
+      }
+      ++files_version_;
+      if (--num_readers_ == 0) {
+        *is_running_ = false;
+        thread.swap(thread_);
+      }
     }
+    if (thread.joinable()) thread.join();
   }
+};
+
+class ConfigReader {
+  const std::vector<std::string> files_;
 
  public:
   ConfigReader() = delete;
-  ConfigReader(const std::vector<std::string>& files) { CreateDaemon(files); }
-  ~ConfigReader() { Stop(); }
+  ConfigReader(const std::vector<std::string>& files) : files_(files) {
+    ConfigDaemon::Instance().AddReader(files_);
+  }
+  ~ConfigReader() { ConfigDaemon::Instance().RemoveReader(files_); }
 };
 
 }  // namespace config_reader
@@ -22,8 +22,11 @@
 #ifndef CONFIGREADER_MACROS_H_
 #define CONFIGREADER_MACROS_H_
 
+#include <stdint.h>
+
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -57,27 +60,48 @@ namespace config_reader {
       ::config_reader::InitVar<bool, \
                                ::config_reader::config_types::ConfigBool>(key)
 
+// Registry of all config variables. Holds a few dozen keys, so the map keeps
+// its default bucket count. Values read by CONFIG_* variables only change in
+// Update(), so that loops may read them without synchronization; reloads
+// write staged copies under Mutex() and count themselves in
+// PublishedVersion().
 class MapSingleton {
-  static constexpr int kNumMapBuckets = 1000000;
-
  public:
   using KeyLookupMap =
       std::unordered_map<std::string,
                          std::unique_ptr<config_types::TypeInterface>>;
 
   static KeyLookupMap& Singleton() {
-    static KeyLookupMap config(kNumMapBuckets);
+    static KeyLookupMap config;
     return config;
   }
 
+  // Guards the map and the staged values.
+  static std::mutex* Mutex() {
+    static std::mutex mutex;
+    return &mutex;
+  }
+
   static std::atomic_bool* NewKeyAdded() {
     static std::atomic_bool new_key_added(false);
     return &new_key_added;
   }
+
+  // Number of reloads staged so far, and the number committed by Update().
+  static std::atomic<uint64_t>* PublishedVersion() {
+    static std::atomic<uint64_t> version(0);
+    return &version;
+  }
+
+  static std::atomic<uint64_t>* CommittedVersion() {
+    static std::atomic<uint64_t> version(0);
+    return &version;
+  }
 };
 
 template <typename CPPType, typename ConfigType>
 const CPPType& InitVar(const std::string& key) {
+  std::lock_guard<std::mutex> lock(*MapSingleton::Mutex());
   auto& map = MapSingleton::Singleton();
   auto find_res = map.find(key);
   if (find_res != map.end()) {
@@ -101,6 +125,28 @@ const CPPType& InitVar(const std::string& key) {
   config_types::TypeInterface* ti = insert_res.first->second.get();
   return static_cast<ConfigType*>(ti)->GetValue();
 }
+
+// Makes the values of the latest reload visible through the CONFIG_*
+// variables, and returns whether any of them changed. Call it between
+// cycles, from the thread that runs them, while no other thread reads config
+// values. Costs one atomic load if nothing was reloaded.
+inline bool Update() {
+  const uint64_t published =
+      MapSingleton::PublishedVersion()->load(std::memory_order_acquire);
+  if (published ==
+      MapSingleton::CommittedVersion()->load(std::memory_order_relaxed)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(*MapSingleton::Mutex());
+  bool changed = false;
+  for (const auto& pair : MapSingleton::Singleton()) {
+    if (pair.second->Commit()) changed = true;
+  }
+  MapSingleton::CommittedVersion()->store(
+      MapSingleton::PublishedVersion()->load(std::memory_order_relaxed),
+      std::memory_order_relaxed);
+  return changed;
+}
 }  // namespace config_reader
 
 #endif  // CONFIGREADER_MACROS_H_
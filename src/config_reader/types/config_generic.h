@@ -31,13 +31,21 @@ namespace config_types {
   class ClassName : public TypeInterface {                          \
    public:                                                          \
     ClassName(const std::string& key)                               \
-        : TypeInterface(key, Type::EnumName), val_(DefaultValue) {} \
+        : TypeInterface(key, Type::EnumName),                       \
+          staged_(DefaultValue),                                    \
+          val_(DefaultValue) {}                                     \
                                                                     \
     ClassName() = delete;                                           \
     ~ClassName() = default;                                         \
                                                                     \
     void SetValue(LuaScript* lua_script) override {                 \
-      val_ = lua_script->GetVariable<CPPType>(key_);                \
+      staged_ = lua_script->GetVariable<CPPType>(key_);             \
+    }                                                               \
+                                                                    \
+    bool Commit() override {                                        \
+      if (val_ == staged_) return false;                            \
+      val_ = staged_;                                               \
+      return true;                                                  \
     }                                                               \
                                                                     \
     const CPPType& GetValue() { return this->val_; }                \
@@ -45,6 +53,7 @@ namespace config_types {
     static Type GetEnumType() { return Type::EnumName; }            \
                                                                     \
    private:                                                         \
+    CPPType staged_;                                                \
     CPPType val_;                                                   \
   };
 
@@ -34,6 +34,7 @@ namespace config_types {
         : TypeInterface(key, Type::EnumName),                           \
           upper_bound_(std::numeric_limits<CPPType>::max()),            \
           lower_bound_(std::numeric_limits<CPPType>::lowest()),         \
+          staged_(0),                                                   \
           val_(0) {}                                                    \
                                                                         \
     ClassName(const std::string& key, const int& upper_bound,           \
@@ -41,6 +42,7 @@ namespace config_types {
         : TypeInterface(key, Type::EnumName),                           \
           upper_bound_(upper_bound),                                    \
           lower_bound_(lower_bound),                                    \
+          staged_(0),                                                   \
           val_(0) {                                                     \
       if (upper_bound_ < lower_bound_) {                                \
         std::cerr << #ClassName << " upperbound " << upper_bound_       \
@@ -59,7 +61,13 @@ namespace config_types {
                   << " below lowerbound " << lower_bound_ << std::endl; \
         return;                                                         \
       }                                                                 \
-      val_ = value;                                                     \
+      staged_ = value;                                                  \
+    }                                                                   \
+                                                                        \
+    bool Commit() override {                                            \
+      if (val_ == staged_) return false;                                \
+      val_ = staged_;                                                   \
+      return true;                                                      \
     }                                                                   \
                                                                         \
     const CPPType& GetValue() { return this->val_; }                    \
@@ -69,6 +77,7 @@ namespace config_types {
    private:                                                             \
     CPPType upper_bound_;                                               \
     CPPType lower_bound_;                                               \
+    CPPType staged_;                                                    \
     CPPType val_;                                                       \
   };
 
@@ -48,7 +48,11 @@ class TypeInterface {
   virtual ~TypeInterface() {}
   std::string GetKey() const { return key_; };
   Type GetType() const { return type_; };
+  // Reads the value from the script into a staging copy, which readers do not
+  // see until Commit().
   virtual void SetValue(LuaScript* lua_script) = 0;
+  // Makes the staged value the one readers see. Returns whether it changed.
+  virtual bool Commit() = 0;
 
  protected:
   std::string key_;
@@ -0,0 +1,338 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    dstar_lite.cc
+\brief   Incremental D* Lite replanner over the global planner lattice.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "shared/util/profiler.h"
+#include "vector_map/vector_map.h"
+
+#include "dstar_lite.h"
+
+using Eigen::Vector2f;
+using Eigen::Vector2i;
+using std::max;
+using std::min;
+using std::vector;
+
+namespace {
+const float kInfinity = std::numeric_limits<float>::infinity();
+// How far to look for a free cell if the robot is inside an inflated obstacle.
+const int kMaxStartSearchRadius = 5;
+}  // namespace
+
+namespace navigation {
+
+DStarLite::DStarLite(const vector_map::VectorMap& map,
+                     float resolution,
+                     float inflation_radius) :
+    GlobalPlanner(map, resolution, inflation_radius),
+    km_(0),
+    start_(-1),
+    last_start_(-1),
+    goal_(-1),
+    goal_loc_(0, 0),
+    observation_id_(0) {
+  const size_t num_cells = static_cast<size_t>(width_) * height_;
+  g_.assign(num_cells, kInfinity);
+  rhs_.assign(num_cells, kInfinity);
+  open_.Resize(num_cells);
+  observed_.assign(num_cells, 0);
+  observation_stamp_.assign(num_cells, 0);
+}
+
+float DStarLite::EdgeCost(int index, int i) const {
+  const int x = index % width_;
+  const int y = index / width_;
+  const int nx = x + kNeighbourDx[i];
+  const int ny = y + kNeighbourDy[i];
+  if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) return kInfinity;
+  if (Blocked(index) || Blocked(ny * width_ + nx)) return kInfinity;
+  // Do not cut corners: diagonal moves need both adjacent cells free.
+  if (i >= 4 && (Blocked(y * width_ + nx) || Blocked(ny * width_ + x))) {
+    return kInfinity;
+  }
+  return step_cost_[i];
+}
+
+float DStarLite::Distance(int a, int b) const {
+  const int dx = abs(a % width_ - b % width_);
+  const int dy = abs(a / width_ - b / width_);
+  return resolution_ *
+      (max(dx, dy) + static_cast<float>(M_SQRT2 - 1.0) * min(dx, dy));
+}
+
+DStarLite::Key DStarLite::CalculateKey(int index) const {
+  const float m = min(g_[index], rhs_[index]);
+  Key key;
+  key.k1 = m + Distance(start_, index) + km_;
+  key.k2 = m;
+  return key;
+}
+
+float DStarLite::LookaheadCost(int index) const {
+  float cost = kInfinity;
+  for (int i = 0; i < 8; ++i) {
+    const float c = EdgeCost(index, i);
+    if (c == kInfinity) continue;
+    const int next = index + kNeighbourDy[i] * width_ + kNeighbourDx[i];
+    cost = min(cost, c + g_[next]);
+  }
+  return cost;
+}
+
+void DStarLite::UpdateVertex(int index) {
+  if (g_[index] != rhs_[index]) {
+    open_.Push(index, CalculateKey(index));
+  } else {
+    open_.Remove(index);
+  }
+}
+
+void DStarLite::CellChanged(int index) {
+  const int x = index % width_;
+  const int y = index / width_;
+  // Every edge whose cost depends on this cell has both of its endpoints in
+  // the 3x3 block around it.
+  for (int dy = -1; dy <= 1; ++dy) {
+    for (int dx = -1; dx <= 1; ++dx) {
+      const int nx = x + dx;
+      const int ny = y + dy;
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+      const int u = ny * width_ + nx;
+      if (u == goal_) continue;
+      rhs_[u] = LookaheadCost(u);
+      UpdateVertex(u);
+    }
+  }
+}
+
+void DStarLite::ExpandTop() {
+  const int u = open_.Top();
+  const Key k_old = open_.TopKey();
+  const Key k_new = CalculateKey(u);
+  ++num_expanded_;
+  if (k_old < k_new) {
+    open_.Push(u, k_new);
+  } else if (g_[u] > rhs_[u]) {
+    // Overconsistent: settle u and relax its neighbours.
+    g_[u] = rhs_[u];
+    open_.Remove(u);
+    for (int i = 0; i < 8; ++i) {
+      const float c = EdgeCost(u, i);
+      if (c == kInfinity) continue;
+      const int s = u + kNeighbourDy[i] * width_ + kNeighbourDx[i];
+      if (s == goal_) continue;
+      if (c + g_[u] < rhs_[s]) {
+        rhs_[s] = c + g_[u];
+        UpdateVertex(s);
+      }
+    }
+  } else {
+    // Underconsistent: invalidate u, and recompute the lookahead of every
+    // neighbour whose best successor was u.
+    const float g_old = g_[u];
+    g_[u] = kInfinity;
+    if (u != goal_) rhs_[u] = LookaheadCost(u);
+    UpdateVertex(u);
+    for (int i = 0; i < 8; ++i) {
+      const float c = EdgeCost(u, i);
+      if (c == kInfinity) continue;
+      const int s = u + kNeighbourDy[i] * width_ + kNeighbourDx[i];
+      if (s == goal_ || rhs_[s] != c + g_old) continue;
+      rhs_[s] = LookaheadCost(s);
+      UpdateVertex(s);
+    }
+  }
+}
+
+void DStarLite::ComputeShortestPath() {
+  PROFILE_FUNCTION();
+  while (!open_.Empty() &&
+         (open_.TopKey() < CalculateKey(start_) ||
+          rhs_[start_] > g_[start_])) {
+    ExpandTop();
+  }
+}
+
+int DStarLite::DescendCostToGoal() {
+  path_cells_.clear();
+  int current = start_;
+  path_cells_.push_back(current);
+  while (current != goal_) {
+    int best = -1;
+    float best_cost = kInfinity;
+    for (int i = 0; i < 8; ++i) {
+      const float c = EdgeCost(current, i);
+      if (c == kInfinity) continue;
+      const int next = current + kNeighbourDy[i] * width_ + kNeighbourDx[i];
+      if (c + g_[next] < best_cost) {
+        best_cost = c + g_[next];
+        best = next;
+      }
+    }
+    if (best < 0) return current;
+    if (g_[best] != rhs_[best]) return best;
+    current = best;
+    path_cells_.push_back(current);
+  }
+  return -1;
+}
+
+int DStarLite::NearestFreeCell(int index) const {
+  if (!Blocked(index)) return index;
+  const int x = index % width_;
+  const int y = index / width_;
+  int best = -1;
+  int best_sq_distance = 0;
+  for (int dy = -kMaxStartSearchRadius; dy <= kMaxStartSearchRadius; ++dy) {
+    for (int dx = -kMaxStartSearchRadius; dx <= kMaxStartSearchRadius; ++dx) {
+      const int nx = x + dx;
+      const int ny = y + dy;
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+      const int n = ny * width_ + nx;
+      const int sq_distance = dx * dx + dy * dy;
+      if (Blocked(n) || (best >= 0 && sq_distance >= best_sq_distance)) {
+        continue;
+      }
+      best = n;
+      best_sq_distance = sq_distance;
+    }
+  }
+  return best;
+}
+
+bool DStarLite::SetGoal(const Vector2f& start, const Vector2f& goal) {
+  goal_ = -1;
+  start_ = -1;
+  last_start_ = -1;
+  const int goal_index = CellIndex(goal);
+  if (goal_index < 0 || Blocked(goal_index)) return false;
+  std::fill(g_.begin(), g_.end(), kInfinity);
+  std::fill(rhs_.begin(), rhs_.end(), kInfinity);
+  open_.Clear();
+  km_ = 0;
+  goal_ = goal_index;
+  goal_loc_ = goal;
+  const int start_index = CellIndex(start);
+  start_ = (start_index < 0) ? goal_ : NearestFreeCell(start_index);
+  if (start_ < 0) start_ = goal_;
+  last_start_ = start_;
+  rhs_[goal_] = 0;
+  open_.Push(goal_, CalculateKey(goal_));
+  return true;
+}
+
+void DStarLite::SetObstacles(const vector<Vector2f>& points) {
+  PROFILE_FUNCTION();
+  ++observation_id_;
+  // Both lists keep their capacity between calls, so that steady-state
+  // updates do not allocate.
+  vector<int>& cells = new_observed_cells_;
+  vector<int>& changed = changed_cells_;
+  cells.clear();
+  changed.clear();
+  for (const Vector2f& p : points) {
+    const int index = CellIndex(p);
+    if (index < 0) continue;
+    const int x = index % width_;
+    const int y = index / width_;
+    for (const Vector2i& d : inflation_disk_) {
+      const int nx = x + d.x();
+      const int ny = y + d.y();
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+      const int n = ny * width_ + nx;
+      if (observation_stamp_[n] == observation_id_) continue;
+      observation_stamp_[n] = observation_id_;
+      cells.push_back(n);
+    }
+  }
+  // Cells that are no longer observed.
+  for (const int n : observed_cells_) {
+    if (observation_stamp_[n] == observation_id_) continue;
+    observed_[n] = 0;
+    if (!occupied_[n]) changed.push_back(n);
+  }
+  // Newly observed cells.
+  for (const int n : cells) {
+    if (observed_[n]) continue;
+    observed_[n] = 1;
+    if (!occupied_[n]) changed.push_back(n);
+  }
+  observed_cells_.swap(cells);
+  if (goal_ < 0) return;
+  for (const int n : changed) {
+    CellChanged(n);
+  }
+}
+
+float DStarLite::PathCost() const {
+  return (goal_ >= 0 && start_ >= 0) ? rhs_[start_] : kInfinity;
+}
+
+bool DStarLite::Replan(const Vector2f& start, vector<Vector2f>* path_ptr) {
+  PROFILE_FUNCTION();
+  num_expanded_ = 0;
+  if (!path_ptr || goal_ < 0) return false;
+  vector<Vector2f>& path = *path_ptr;
+  path.clear();
+  const int start_index = CellIndex(start);
+  if (start_index < 0) return false;
+  const int free_start = NearestFreeCell(start_index);
+  if (free_start < 0) return false;
+  start_ = free_start;
+  if (start_ != last_start_) {
+    // Keys already on the queue were computed relative to the old start, and
+    // remain lower bounds if offset by the distance moved since.
+    km_ += Distance(last_start_, start_);
+    last_start_ = start_;
+  }
+  // The search stops once the start is consistent, but cells further along
+  // the descent can still be inconsistent where keys tie with the start's, and
+  // their cost-to-goal is then wrong in either direction. Keep repairing until
+  // every cell on the path is consistent: the cost-to-goal then strictly
+  // decreases along it, and sums to the cost at the start.
+  while (true) {
+    ComputeShortestPath();
+    // The search may stop with the start itself still overconsistent, so its
+    // lookahead cost is the one to test for reachability.
+    if (rhs_[start_] == kInfinity) return false;
+    const int stop = DescendCostToGoal();
+    if (stop < 0) break;
+    if (g_[stop] == rhs_[stop]) return false;
+    // Inconsistent cells are always on the queue, so this terminates.
+    while (g_[stop] != rhs_[stop]) {
+      ExpandTop();
+    }
+  }
+  path.push_back(start);
+  for (size_t i = 1; i < path_cells_.size(); ++i) {
+    path.push_back(CellCenter(path_cells_[i]));
+  }
+  path.back() = goal_loc_;
+  return true;
+}
+
+}  // namespace navigation
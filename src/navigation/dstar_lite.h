@@ -0,0 +1,132 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    dstar_lite.h
+\brief   Incremental D* Lite replanner over the global planner lattice.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "vector_map/vector_map.h"
+#include "global_planner.h"
+#include "indexed_heap.h"
+
+#ifndef DSTAR_LITE_H
+#define DSTAR_LITE_H
+
+namespace navigation {
+
+// D* Lite (Koenig & Likhachev, 2002) on the same 8-connected lattice as
+// GlobalPlanner. The search runs backwards from the goal, so that when the
+// robot moves or observed obstacles change the occupancy of a few cells, only
+// the affected part of the previous solution is repaired instead of
+// replanning from scratch.
+class DStarLite : public GlobalPlanner {
+ public:
+  DStarLite() :
+      km_(0), start_(-1), last_start_(-1), goal_(-1), observation_id_(0) {}
+
+  DStarLite(const vector_map::VectorMap& map,
+            float resolution,
+            float inflation_radius);
+
+  // Start a new search from start towards goal, discarding the previous
+  // solution. Currently observed obstacles are kept. Returns false if the goal
+  // is not on a free cell. The search itself runs on the next Replan.
+  bool SetGoal(const Eigen::Vector2f& start, const Eigen::Vector2f& goal);
+
+  // Replace the set of observed obstacle points, in the map frame. Cells whose
+  // inflated occupancy changed since the previous call are queued for repair
+  // by the next call to Replan.
+  void SetObstacles(const std::vector<Eigen::Vector2f>& points);
+
+  // Repair the solution for the robot at start, and extract the path to the
+  // goal. Returns false if there is no goal or it is unreachable.
+  bool Replan(const Eigen::Vector2f& start,
+              std::vector<Eigen::Vector2f>* path);
+
+  bool HasGoal() const { return goal_ >= 0; }
+
+  // Path cost in meters from the start of the latest Replan to the goal, or
+  // infinity if there is none.
+  float PathCost() const;
+
+ private:
+  // Lexicographically ordered D* Lite priority.
+  struct Key {
+    float k1;
+    float k2;
+    bool operator<(const Key& other) const {
+      return k1 < other.k1 || (k1 == other.k1 && k2 < other.k2);
+    }
+  };
+
+  bool Blocked(int index) const {
+    return occupied_[index] != 0 || observed_[index] != 0;
+  }
+  // Cost of the edge from index to its neighbour in direction i, or infinity
+  // if that edge is blocked or leaves the lattice.
+  float EdgeCost(int index, int i) const;
+  // Consistent octile distance between two cells, in meters.
+  float Distance(int a, int b) const;
+  Key CalculateKey(int index) const;
+  // One-step lookahead cost of index through its cheapest neighbour.
+  float LookaheadCost(int index) const;
+  void UpdateVertex(int index);
+  // Recompute the lookahead costs of index and all its neighbours, after the
+  // occupancy of index changed.
+  void CellChanged(int index);
+  // Process the vertex at the top of the queue. The queue must not be empty.
+  void ExpandTop();
+  void ComputeShortestPath();
+  // Greedily descend the cost-to-goal from the start into path_cells_. Returns
+  // -1 if it reached the goal, or else the cell it stopped at: either the first
+  // inconsistent cell along the way, or a dead end.
+  int DescendCostToGoal();
+  // Closest free cell to index within a few cells, or -1 if there is none.
+  int NearestFreeCell(int index) const;
+
+  // Cost-to-goal estimates and their one-step lookahead values.
+  std::vector<float> g_;
+  std::vector<float> rhs_;
+  IndexedHeap<Key> open_;
+  // Key modifier accumulated as the robot moves.
+  float km_;
+  int start_;
+  int last_start_;
+  int goal_;
+  Eigen::Vector2f goal_loc_;
+
+  // Inflated occupancy from the most recently observed obstacle points.
+  std::vector<uint8_t> observed_;
+  // Cells set in observed_.
+  std::vector<int> observed_cells_;
+  // Scratch lists for SetObstacles.
+  std::vector<int> new_observed_cells_;
+  std::vector<int> changed_cells_;
+  // Per-cell stamp used to de-duplicate cells within one SetObstacles call.
+  std::vector<uint32_t> observation_stamp_;
+  uint32_t observation_id_;
+  // Cells on the path extracted by the latest Replan, from the start.
+  std::vector<int> path_cells_;
+};
+
+}  // namespace navigation
+
+#endif  // DSTAR_LITE_H
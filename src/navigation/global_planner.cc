@@ -0,0 +1,217 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    global_planner.cc
+\brief   A* global planner over an 8-connected occupancy lattice built
+         from a vector map.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "shared/math/line2d.h"
+#include "shared/util/profiler.h"
+#include "vector_map/vector_map.h"
+
+#include "global_planner.h"
+
+using Eigen::Vector2f;
+using Eigen::Vector2i;
+using geometry::line2f;
+using std::max;
+using std::min;
+using std::vector;
+
+namespace {
+// Lattice padding around the map bounding box, in meters.
+const float kBorder = 1.0;
+// Slightly over-weight the heuristic so that, among the many cells with equal
+// f-values on an open lattice, the ones closest to the goal are expanded first.
+const float kTieBreak = 1.001;
+}  // namespace
+
+namespace navigation {
+
+const int GlobalPlanner::kNeighbourDx[8] = {1, -1, 0, 0, 1, 1, -1, -1};
+const int GlobalPlanner::kNeighbourDy[8] = {0, 0, 1, -1, 1, -1, 1, -1};
+
+GlobalPlanner::GlobalPlanner(const vector_map::VectorMap& map,
+                             float resolution,
+                             float inflation_radius) :
+    width_(0),
+    height_(0),
+    resolution_(resolution),
+    origin_(0, 0),
+    num_expanded_(0),
+    search_id_(0) {
+  for (int i = 0; i < 8; ++i) {
+    step_cost_[i] = (i < 4) ? resolution_ : M_SQRT2 * resolution_;
+  }
+  if (map.lines.empty()) return;
+  Vector2f min_corner = map.lines[0].p0;
+  Vector2f max_corner = map.lines[0].p0;
+  for (const line2f& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  origin_ = min_corner - Vector2f(kBorder, kBorder);
+  const Vector2f extent = max_corner - min_corner;
+  width_ = static_cast<int>(ceil((extent.x() + 2.0 * kBorder) / resolution_));
+  height_ = static_cast<int>(ceil((extent.y() + 2.0 * kBorder) / resolution_));
+  const size_t num_cells = static_cast<size_t>(width_) * height_;
+  occupied_.assign(num_cells, 0);
+
+  // Rasterize every map line by sampling it at half the cell size.
+  vector<int> wall_cells;
+  for (const line2f& l : map.lines) {
+    const int num_steps =
+        max(1, static_cast<int>(ceil(2.0 * l.Length() / resolution_)));
+    for (int i = 0; i <= num_steps; ++i) {
+      const float t = static_cast<float>(i) / static_cast<float>(num_steps);
+      const int index = CellIndex(l.p0 + t * (l.p1 - l.p0));
+      if (index >= 0 && occupied_[index] == 0) {
+        occupied_[index] = 1;
+        wall_cells.push_back(index);
+      }
+    }
+  }
+
+  // Inflate the walls by stamping a precomputed disk of cell offsets around
+  // every wall cell.
+  const int r = static_cast<int>(ceil(inflation_radius / resolution_));
+  for (int dy = -r; dy <= r; ++dy) {
+    for (int dx = -r; dx <= r; ++dx) {
+      if (resolution_ * resolution_ * (dx * dx + dy * dy) <=
+          inflation_radius * inflation_radius) {
+        inflation_disk_.push_back(Vector2i(dx, dy));
+      }
+    }
+  }
+  for (const int index : wall_cells) {
+    const int x = index % width_;
+    const int y = index / width_;
+    for (const Vector2i& d : inflation_disk_) {
+      const int nx = x + d.x();
+      const int ny = y + d.y();
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+      occupied_[ny * width_ + nx] = 1;
+    }
+  }
+
+  g_.resize(num_cells);
+  parent_.resize(num_cells);
+  visited_.assign(num_cells, 0);
+  closed_.assign(num_cells, 0);
+  open_.Resize(num_cells);
+}
+
+int GlobalPlanner::CellIndex(const Vector2f& loc) const {
+  const int x = static_cast<int>(floor((loc.x() - origin_.x()) / resolution_));
+  const int y = static_cast<int>(floor((loc.y() - origin_.y()) / resolution_));
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return -1;
+  return y * width_ + x;
+}
+
+Vector2f GlobalPlanner::CellCenter(int index) const {
+  const int x = index % width_;
+  const int y = index / width_;
+  return origin_ + resolution_ * Vector2f(x + 0.5, y + 0.5);
+}
+
+float GlobalPlanner::Heuristic(int x0, int y0, int x1, int y1) const {
+  const int dx = abs(x0 - x1);
+  const int dy = abs(y0 - y1);
+  return kTieBreak * resolution_ *
+      (max(dx, dy) + static_cast<float>(M_SQRT2 - 1.0) * min(dx, dy));
+}
+
+bool GlobalPlanner::IsFree(const Vector2f& loc) const {
+  const int index = CellIndex(loc);
+  return index >= 0 && occupied_[index] == 0;
+}
+
+bool GlobalPlanner::Plan(const Vector2f& start,
+                         const Vector2f& goal,
+                         vector<Vector2f>* path_ptr) {
+  PROFILE_FUNCTION();
+  num_expanded_ = 0;
+  if (!path_ptr) return false;
+  vector<Vector2f>& path = *path_ptr;
+  path.clear();
+  const int start_index = CellIndex(start);
+  const int goal_index = CellIndex(goal);
+  // The start cell may lie inside the inflated walls if the robot is close to
+  // an obstacle, but the goal must be reachable.
+  if (start_index < 0 || goal_index < 0 || occupied_[goal_index]) {
+    return false;
+  }
+
+  ++search_id_;
+  open_.Clear();
+  g_[start_index] = 0;
+  parent_[start_index] = -1;
+  visited_[start_index] = search_id_;
+  const int goal_x = goal_index % width_;
+  const int goal_y = goal_index / width_;
+  open_.Push(start_index, Heuristic(start_index % width_,
+                                    start_index / width_,
+                                    goal_x,
+                                    goal_y));
+
+  bool found = false;
+  while (!open_.Empty()) {
+    const int current = open_.Pop();
+    if (current == goal_index) {
+      found = true;
+      break;
+    }
+    closed_[current] = search_id_;
+    ++num_expanded_;
+    const int x = current % width_;
+    const int y = current / width_;
+    for (int i = 0; i < 8; ++i) {
+      const int nx = x + kNeighbourDx[i];
+      const int ny = y + kNeighbourDy[i];
+      if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+      const int next = ny * width_ + nx;
+      if (occupied_[next] || closed_[next] == search_id_) continue;
+      // Do not cut corners: diagonal moves need both adjacent cells free.
+      if (i >= 4 && (occupied_[y * width_ + nx] || occupied_[ny * width_ + x])) {
+        continue;
+      }
+      const float g_next = g_[current] + step_cost_[i];
+      if (visited_[next] == search_id_ && g_[next] <= g_next) continue;
+      visited_[next] = search_id_;
+      g_[next] = g_next;
+      parent_[next] = current;
+      open_.Push(next, g_next + Heuristic(nx, ny, goal_x, goal_y));
+    }
+  }
+  if (!found) return false;
+
+  for (int i = goal_index; i >= 0; i = parent_[i]) {
+    path.push_back(CellCenter(i));
+  }
+  std::reverse(path.begin(), path.end());
+  path.front() = start;
+  path.back() = goal;
+  return true;
+}
+
+}  // namespace navigation
@@ -0,0 +1,105 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    global_planner.h
+\brief   A* global planner over an 8-connected occupancy lattice built
+         from a vector map.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "vector_map/vector_map.h"
+#include "indexed_heap.h"
+
+#ifndef GLOBAL_PLANNER_H
+#define GLOBAL_PLANNER_H
+
+namespace navigation {
+
+class GlobalPlanner {
+ public:
+  GlobalPlanner() :
+      width_(0), height_(0), resolution_(0), num_expanded_(0), search_id_(0) {}
+
+  // Rasterize the map lines into an occupancy lattice of the specified
+  // resolution, inflating obstacles by inflation_radius.
+  GlobalPlanner(const vector_map::VectorMap& map,
+                float resolution,
+                float inflation_radius);
+
+  // Plan a path from start to goal. On success, returns true and fills path
+  // with waypoints in the map frame, starting at start and ending at goal.
+  bool Plan(const Eigen::Vector2f& start,
+            const Eigen::Vector2f& goal,
+            std::vector<Eigen::Vector2f>* path);
+
+  // Returns true iff loc lies on the lattice and is not occupied.
+  bool IsFree(const Eigen::Vector2f& loc) const;
+
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+  float Resolution() const { return resolution_; }
+
+  // Number of lattice cells expanded by the most recent search.
+  size_t NumExpanded() const { return num_expanded_; }
+
+ protected:
+  // The 8-connected neighbourhood, as (dx, dy) cell offsets. The first four
+  // are the axis-aligned neighbours.
+  static const int kNeighbourDx[8];
+  static const int kNeighbourDy[8];
+
+  // Cell index of a map-frame location, or -1 if it is off the lattice.
+  int CellIndex(const Eigen::Vector2f& loc) const;
+  // Map-frame location of the center of a cell.
+  Eigen::Vector2f CellCenter(int index) const;
+  // Octile distance between cells (x0, y0) and (x1, y1), in meters.
+  float Heuristic(int x0, int y0, int x1, int y1) const;
+
+  // Lattice dimensions, in cells.
+  int width_;
+  int height_;
+  // Size of each cell, in meters.
+  float resolution_;
+  // Map-frame location of the corner of cell 0.
+  Eigen::Vector2f origin_;
+  // Inflated occupancy of each cell, stored row-major.
+  std::vector<uint8_t> occupied_;
+  // Cell offsets within the inflation radius of an obstacle cell.
+  std::vector<Eigen::Vector2i> inflation_disk_;
+  // Cost of a step to each of the 8 neighbours, in meters.
+  float step_cost_[8];
+  // Number of cells expanded by the most recent search.
+  size_t num_expanded_;
+
+ private:
+  // Per-search state. A cell's g_ and parent_ are only valid if its
+  // visited_ stamp matches the current search_id_, which avoids clearing
+  // the whole lattice before every search.
+  std::vector<float> g_;
+  std::vector<int> parent_;
+  std::vector<uint32_t> visited_;
+  std::vector<uint32_t> closed_;
+  uint32_t search_id_;
+  IndexedHeap<float> open_;
+};
+
+}  // namespace navigation
+
+#endif  // GLOBAL_PLANNER_H
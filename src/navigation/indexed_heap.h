@@ -0,0 +1,151 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    indexed_heap.h
+\brief   Binary min-heap over dense integer ids with decrease-key.
+*/
+//========================================================================
+
+#include <utility>
+#include <vector>
+
+#ifndef INDEXED_HEAP_H
+#define INDEXED_HEAP_H
+
+namespace navigation {
+
+// Binary min-heap over dense integer ids in [0, num_ids), with a position map
+// from id to heap slot so that membership tests are O(1) and key updates
+// (decrease-key) and removals are O(log n). Key must be ordered by operator<.
+template <typename Key>
+class IndexedHeap {
+ public:
+  explicit IndexedHeap(size_t num_ids = 0) : position_(num_ids, -1) {}
+
+  // Resize the id space. Invalidates the current contents of the heap.
+  void Resize(size_t num_ids) {
+    heap_.clear();
+    position_.assign(num_ids, -1);
+  }
+
+  // Remove all elements from the heap, in time linear in its size.
+  void Clear() {
+    for (const Entry& entry : heap_) {
+      position_[entry.second] = -1;
+    }
+    heap_.clear();
+  }
+
+  bool Empty() const { return heap_.empty(); }
+
+  size_t Size() const { return heap_.size(); }
+
+  // Returns true iff id is currently on the heap.
+  bool Contains(int id) const { return position_[id] >= 0; }
+
+  // Id with the smallest key. The heap must not be empty.
+  int Top() const { return heap_.front().second; }
+
+  // Smallest key on the heap. The heap must not be empty.
+  const Key& TopKey() const { return heap_.front().first; }
+
+  // Insert id with the specified key, or update its key if already present.
+  void Push(int id, const Key& key) {
+    const int slot = position_[id];
+    if (slot < 0) {
+      heap_.push_back(Entry(key, id));
+      SiftUp(heap_.size() - 1);
+      return;
+    }
+    const bool decreased = key < heap_[slot].first;
+    heap_[slot].first = key;
+    if (decreased) {
+      SiftUp(slot);
+    } else {
+      SiftDown(slot);
+    }
+  }
+
+  // Remove and return the id with the smallest key.
+  int Pop() {
+    const int id = heap_.front().second;
+    RemoveSlot(0);
+    return id;
+  }
+
+  // Remove id from the heap, if present.
+  void Remove(int id) {
+    const int slot = position_[id];
+    if (slot >= 0) RemoveSlot(slot);
+  }
+
+ private:
+  typedef std::pair<Key, int> Entry;
+
+  void Place(size_t i, const Entry& entry) {
+    heap_[i] = entry;
+    position_[entry.second] = i;
+  }
+
+  void RemoveSlot(size_t i) {
+    position_[heap_[i].second] = -1;
+    const Entry last = heap_.back();
+    heap_.pop_back();
+    if (i == heap_.size()) return;
+    const bool decreased = last.first < heap_[i].first;
+    Place(i, last);
+    if (decreased) {
+      SiftUp(i);
+    } else {
+      SiftDown(i);
+    }
+  }
+
+  void SiftUp(size_t i) {
+    const Entry entry = heap_[i];
+    while (i > 0) {
+      const size_t parent = (i - 1) / 2;
+      if (!(entry.first < heap_[parent].first)) break;
+      Place(i, heap_[parent]);
+      i = parent;
+    }
+    Place(i, entry);
+  }
+
+  void SiftDown(size_t i) {
+    const Entry entry = heap_[i];
+    const size_t n = heap_.size();
+    while (true) {
+      size_t child = 2 * i + 1;
+      if (child >= n) break;
+      if (child + 1 < n && heap_[child + 1].first < heap_[child].first) {
+        ++child;
+      }
+      if (!(heap_[child].first < entry.first)) break;
+      Place(i, heap_[child]);
+      i = child;
+    }
+    Place(i, entry);
+  }
+
+  // (key, id) pairs in heap order.
+  std::vector<Entry> heap_;
+  // Heap slot of each id, or -1 if the id is not on the heap.
+  std::vector<int> position_;
+};
+
+}  // namespace navigation
+
+#endif  // INDEXED_HEAP_H
@@ -0,0 +1,290 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    mppi.cc
+\brief   Model-predictive path integral (MPPI) local controller for an
+         Ackermann car, and the local obstacle distance grid it scores
+         rollouts against.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "shared/util/profiler.h"
+#include "shared/util/random.h"
+
+#include "mppi.h"
+
+using Eigen::Vector2f;
+using Eigen::Vector2i;
+using std::max;
+using std::min;
+using std::vector;
+
+namespace {
+// Number of rollouts simulated together, as lanes of one loop.
+const int kBlockSize = 32;
+// Correlation between the control perturbations of consecutive time steps.
+const float kNoiseCorrelation = 0.8;
+
+// Parameters with the number of rollouts rounded up to whole blocks.
+navigation::MPPIParams WholeBlocks(navigation::MPPIParams params) {
+  params.num_rollouts =
+      kBlockSize * ((params.num_rollouts + kBlockSize - 1) / kBlockSize);
+  return params;
+}
+}  // namespace
+
+namespace navigation {
+
+LocalCostMap::LocalCostMap(float half_extent,
+                           float resolution,
+                           float max_distance) :
+    resolution_(resolution),
+    max_distance_(max_distance),
+    origin_(0),
+    size_(static_cast<int>(ceil(2.0 * half_extent / resolution))) {
+  origin_ = -0.5 * size_ * resolution_;
+  distance_.assign(static_cast<size_t>(size_) * size_, max_distance_);
+  const int r = static_cast<int>(ceil(max_distance_ / resolution_));
+  for (int dy = -r; dy <= r; ++dy) {
+    for (int dx = -r; dx <= r; ++dx) {
+      const float d = resolution_ * sqrt(static_cast<float>(dx * dx + dy * dy));
+      if (d > max_distance_) continue;
+      kernel_.push_back(Vector2i(dx, dy));
+      kernel_distance_.push_back(d);
+    }
+  }
+}
+
+void LocalCostMap::Build(const vector<Vector2f>& points) {
+  PROFILE_SCOPE("LocalCostMap::Build");
+  std::fill(distance_.begin(), distance_.end(), max_distance_);
+  for (const Vector2f& p : points) {
+    if (p.x() < origin_ - max_distance_ || p.y() < origin_ - max_distance_) {
+      continue;
+    }
+    const int x = static_cast<int>(floor((p.x() - origin_) / resolution_));
+    const int y = static_cast<int>(floor((p.y() - origin_) / resolution_));
+    // Points in a cell that was already stamped would stamp the same values.
+    if (x >= 0 && y >= 0 && x < size_ && y < size_ &&
+        distance_[y * size_ + x] == 0) {
+      continue;
+    }
+    for (size_t i = 0; i < kernel_.size(); ++i) {
+      const int nx = x + kernel_[i].x();
+      const int ny = y + kernel_[i].y();
+      if (nx < 0 || ny < 0 || nx >= size_ || ny >= size_) continue;
+      float& d = distance_[ny * size_ + nx];
+      d = min(d, kernel_distance_[i]);
+    }
+  }
+}
+
+MPPIParams::MPPIParams() :
+    num_rollouts(2048),
+    horizon(30),
+    time_step(0.05),
+    lambda(0.3),
+    acceleration_stddev(2.0),
+    curvature_stddev(0.4),
+    max_velocity(1.0),
+    max_acceleration(4.0),
+    min_acceleration(-4.0),
+    curvature_limit(1.0),
+    footprint_radius(0.25),
+    footprint_offsets(1, 0.0),
+    goal_weight(1.0),
+    terminal_goal_weight(5.0),
+    obstacle_weight(5.0),
+    collision_cost(1000.0) {}
+
+MPPIController::MPPIController(const MPPIParams& params) :
+    params_(WholeBlocks(params)),
+    iteration_(0),
+    min_cost_(0) {
+  const int num_rollouts = params_.num_rollouts;
+  acceleration_.assign(params_.horizon, 0);
+  curvature_.assign(params_.horizon, 0);
+  acceleration_noise_.assign(params_.horizon * num_rollouts, 0);
+  curvature_noise_.assign(params_.horizon * num_rollouts, 0);
+  cost_.assign(num_rollouts, 0);
+  weight_.assign(num_rollouts, 0);
+  nominal_trajectory_.assign(params_.horizon + 1, Vector2f(0, 0));
+}
+
+void MPPIController::Reset() {
+  std::fill(acceleration_.begin(), acceleration_.end(), 0);
+  std::fill(curvature_.begin(), curvature_.end(), 0);
+}
+
+void MPPIController::RolloutBlock(int begin,
+                                  const LocalCostMap& cost_map,
+                                  float velocity,
+                                  const Vector2f& goal) {
+  const int num_rollouts = params_.num_rollouts;
+  const float dt = params_.time_step;
+  const float clear_distance =
+      cost_map.max_distance() - params_.footprint_radius;
+
+  // Noise is drawn per block from a stream of its own, keyed by the
+  // iteration, so rollouts are identical for any number of threads.
+  // The noise is low-pass filtered over time, so that rollouts explore
+  // coherent manoeuvres instead of jittering around the nominal controls.
+  util_random::CounterRandom rng(iteration_, begin / kBlockSize);
+  const float innovation = sqrt(1.0 - kNoiseCorrelation * kNoiseCorrelation);
+  for (int t = 0; t < params_.horizon; ++t) {
+    float* const a_noise = &acceleration_noise_[t * num_rollouts + begin];
+    float* const c_noise = &curvature_noise_[t * num_rollouts + begin];
+    const float* const a_previous = a_noise - num_rollouts;
+    const float* const c_previous = c_noise - num_rollouts;
+    rng.FillGaussian(a_noise, kBlockSize, 0, params_.acceleration_stddev);
+    rng.FillGaussian(c_noise, kBlockSize, 0, params_.curvature_stddev);
+    if (t == 0) continue;
+    for (int b = 0; b < kBlockSize; ++b) {
+      a_noise[b] = kNoiseCorrelation * a_previous[b] + innovation * a_noise[b];
+      c_noise[b] = kNoiseCorrelation * c_previous[b] + innovation * c_noise[b];
+    }
+  }
+
+  float x[kBlockSize];
+  float y[kBlockSize];
+  float theta[kBlockSize];
+  float v[kBlockSize];
+  float cost[kBlockSize];
+  for (int b = 0; b < kBlockSize; ++b) {
+    x[b] = 0;
+    y[b] = 0;
+    theta[b] = 0;
+    v[b] = velocity;
+    cost[b] = 0;
+  }
+
+  for (int t = 0; t < params_.horizon; ++t) {
+    const float u_a = acceleration_[t];
+    const float u_c = curvature_[t];
+    float* const a_noise = &acceleration_noise_[t * num_rollouts + begin];
+    float* const c_noise = &curvature_noise_[t * num_rollouts + begin];
+    for (int b = 0; b < kBlockSize; ++b) {
+      // Clamp the perturbed controls to the limits, and keep the perturbation
+      // that was actually applied for the weighted update.
+      const float a = min(params_.max_acceleration,
+                          max(params_.min_acceleration, u_a + a_noise[b]));
+      const float c = min(params_.curvature_limit,
+                          max(-params_.curvature_limit, u_c + c_noise[b]));
+      a_noise[b] = a - u_a;
+      c_noise[b] = c - u_c;
+
+      v[b] = min(params_.max_velocity, max(0.0f, v[b] + a * dt));
+      const float ds = v[b] * dt;
+      theta[b] += c * ds;
+      const float cos_theta = cos(theta[b]);
+      const float sin_theta = sin(theta[b]);
+      x[b] += ds * cos_theta;
+      y[b] += ds * sin_theta;
+
+      float step_cost = params_.goal_weight * dt *
+          sqrt((goal.x() - x[b]) * (goal.x() - x[b]) +
+               (goal.y() - y[b]) * (goal.y() - y[b]));
+      for (const float offset : params_.footprint_offsets) {
+        const float d = cost_map.Distance(x[b] + offset * cos_theta,
+                                          y[b] + offset * sin_theta);
+        if (d < params_.footprint_radius) {
+          step_cost += params_.collision_cost;
+        } else if (clear_distance > 0) {
+          const float proximity =
+              1.0f - (d - params_.footprint_radius) / clear_distance;
+          step_cost += params_.obstacle_weight * dt * proximity * proximity;
+        }
+      }
+      cost[b] += step_cost;
+    }
+  }
+
+  for (int b = 0; b < kBlockSize; ++b) {
+    cost_[begin + b] = cost[b] + params_.terminal_goal_weight *
+        sqrt((goal.x() - x[b]) * (goal.x() - x[b]) +
+             (goal.y() - y[b]) * (goal.y() - y[b]));
+  }
+}
+
+void MPPIController::Optimize(const LocalCostMap& cost_map,
+                              float velocity,
+                              const Vector2f& goal,
+                              float* acceleration,
+                              float* curvature) {
+  PROFILE_FUNCTION();
+  ++iteration_;
+  const int num_rollouts = params_.num_rollouts;
+  const int num_blocks = num_rollouts / kBlockSize;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int block = 0; block < num_blocks; ++block) {
+    RolloutBlock(block * kBlockSize, cost_map, velocity, goal);
+  }
+
+  // Exponentially weighted average of the applied perturbations.
+  min_cost_ = *std::min_element(cost_.begin(), cost_.end());
+  float total_weight = 0;
+  for (int k = 0; k < num_rollouts; ++k) {
+    weight_[k] = exp(-(cost_[k] - min_cost_) / params_.lambda);
+    total_weight += weight_[k];
+  }
+  for (int t = 0; t < params_.horizon; ++t) {
+    const float* const a_noise = &acceleration_noise_[t * num_rollouts];
+    const float* const c_noise = &curvature_noise_[t * num_rollouts];
+    float a = 0;
+    float c = 0;
+    for (int k = 0; k < num_rollouts; ++k) {
+      a += weight_[k] * a_noise[k];
+      c += weight_[k] * c_noise[k];
+    }
+    acceleration_[t] += a / total_weight;
+    curvature_[t] += c / total_weight;
+  }
+
+  // Trajectory of the updated nominal controls, for visualization.
+  float x = 0;
+  float y = 0;
+  float theta = 0;
+  float v = velocity;
+  nominal_trajectory_[0] = Vector2f(0, 0);
+  for (int t = 0; t < params_.horizon; ++t) {
+    v = min(params_.max_velocity,
+            max(0.0f, v + acceleration_[t] * params_.time_step));
+    const float ds = v * params_.time_step;
+    theta += curvature_[t] * ds;
+    x += ds * cos(theta);
+    y += ds * sin(theta);
+    nominal_trajectory_[t + 1] = Vector2f(x, y);
+  }
+
+  *acceleration = acceleration_[0];
+  *curvature = curvature_[0];
+
+  // Warm start: shift the nominal controls by one step, repeating the last.
+  for (int t = 0; t + 1 < params_.horizon; ++t) {
+    acceleration_[t] = acceleration_[t + 1];
+    curvature_[t] = curvature_[t + 1];
+  }
+}
+
+}  // namespace navigation
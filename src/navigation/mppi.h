@@ -0,0 +1,168 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    mppi.h
+\brief   Model-predictive path integral (MPPI) local controller for an
+         Ackermann car, and the local obstacle distance grid it scores
+         rollouts against.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef MPPI_H
+#define MPPI_H
+
+namespace navigation {
+
+// Square grid centred on base_link holding, for every cell, the distance to
+// the closest observed point, clipped at a maximum distance.
+class LocalCostMap {
+ public:
+  // Empty map: every query returns zero distance.
+  LocalCostMap() : resolution_(1), max_distance_(0), origin_(0), size_(0) {}
+
+  LocalCostMap(float half_extent, float resolution, float max_distance);
+
+  bool Empty() const { return size_ == 0; }
+
+  // Rebuild the distances from a point cloud in base_link, without
+  // allocating.
+  void Build(const std::vector<Eigen::Vector2f>& points);
+
+  // Clipped distance from (x, y) in base_link to the closest point. Locations
+  // outside the grid are reported as max_distance() away.
+  float Distance(float x, float y) const {
+    if (x < origin_ || y < origin_) return max_distance_;
+    const int ix = static_cast<int>((x - origin_) / resolution_);
+    const int iy = static_cast<int>((y - origin_) / resolution_);
+    if (ix >= size_ || iy >= size_) return max_distance_;
+    return distance_[iy * size_ + ix];
+  }
+
+  float max_distance() const { return max_distance_; }
+
+ private:
+  float resolution_;
+  float max_distance_;
+  // Lower-left corner of the grid, in base_link. The grid is square.
+  float origin_;
+  int size_;
+  std::vector<float> distance_;
+  // Cell offsets within max_distance of a point, and their distances.
+  std::vector<Eigen::Vector2i> kernel_;
+  std::vector<float> kernel_distance_;
+};
+
+struct MPPIParams {
+  MPPIParams();
+
+  int num_rollouts;
+  // Number of control steps in each rollout.
+  int horizon;
+  float time_step;
+  // Temperature of the exponential rollout weights.
+  float lambda;
+  // Standard deviations of the control perturbations.
+  float acceleration_stddev;
+  float curvature_stddev;
+
+  // Control and speed limits.
+  float max_velocity;
+  float max_acceleration;
+  float min_acceleration;
+  float curvature_limit;
+
+  // The car footprint is covered by circles of this radius, centred on
+  // base_link's x axis at these offsets.
+  float footprint_radius;
+  std::vector<float> footprint_offsets;
+
+  // Cost weights.
+  float goal_weight;
+  float terminal_goal_weight;
+  float obstacle_weight;
+  float collision_cost;
+};
+
+// MPPI (Williams et al., 2017) over a nominal sequence of (acceleration,
+// curvature) controls. Every cycle, num_rollouts noisy copies of the nominal
+// sequence are simulated through the kinematic car model and scored against
+// a LocalCostMap, and the nominal sequence is replaced by their
+// exponentially weighted average. Rollouts are simulated in blocks, stored
+// as structures of arrays, so that each time step of a block is a loop over
+// independent lanes; blocks are distributed over cores with OpenMP when it
+// is enabled. All buffers are allocated at construction.
+class MPPIController {
+ public:
+  explicit MPPIController(const MPPIParams& params);
+
+  // Forget the nominal control sequence, e.g. when the goal changes.
+  void Reset();
+
+  // Run one MPPI iteration from the origin of base_link at the specified
+  // velocity, towards goal in base_link. Returns the acceleration
+  // and curvature to command now, and shifts the nominal sequence by one step
+  // to warm-start the next call.
+  void Optimize(const LocalCostMap& cost_map,
+                float velocity,
+                const Eigen::Vector2f& goal,
+                float* acceleration,
+                float* curvature);
+
+  // Trajectory of the nominal controls after the latest Optimize, in the
+  // base_link frame Optimize was called in.
+  const std::vector<Eigen::Vector2f>& NominalTrajectory() const {
+    return nominal_trajectory_;
+  }
+
+  // Lowest rollout cost of the latest Optimize.
+  float MinCost() const { return min_cost_; }
+
+  const MPPIParams& params() const { return params_; }
+
+ private:
+  // Simulate and score one block of rollouts, starting with rollout begin.
+  void RolloutBlock(int begin,
+                    const LocalCostMap& cost_map,
+                    float velocity,
+                    const Eigen::Vector2f& goal);
+
+  // Parameters, with num_rollouts rounded up to a whole number of blocks.
+  const MPPIParams params_;
+  // Incremented every call, and mixed into the noise seed of every block so
+  // that results do not depend on the number of threads.
+  uint64_t iteration_;
+
+  // Nominal controls, one per time step.
+  std::vector<float> acceleration_;
+  std::vector<float> curvature_;
+  // Perturbations, horizon x num_rollouts, so that at every time step the
+  // lanes of a block are contiguous.
+  std::vector<float> acceleration_noise_;
+  std::vector<float> curvature_noise_;
+  std::vector<float> cost_;
+  std::vector<float> weight_;
+  std::vector<Eigen::Vector2f> nominal_trajectory_;
+  float min_cost_;
+};
+
+}  // namespace navigation
+
+#endif  // MPPI_H
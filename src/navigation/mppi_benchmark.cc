@@ -0,0 +1,203 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    mppi_benchmark.cc
+\brief   Measures the per-cycle cost of the MPPI local controller on scans
+         simulated in the GDC maps, against the 20 Hz control budget. Does
+         not need ROS.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "shared/util/random.h"
+#include "shared/util/timer.h"
+#include "vector_map/vector_map.h"
+
+#include "mppi.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using navigation::LocalCostMap;
+using navigation::MPPIController;
+using navigation::MPPIParams;
+using std::string;
+using std::vector;
+
+DEFINE_string(maps,
+              "maps/GDC1.txt,maps/GDC2.txt,maps/GDC3.txt",
+              "Comma-separated list of vector map files to benchmark on");
+DEFINE_string(rollouts,
+              "1024,2048,4096",
+              "Comma-separated list of rollout counts to benchmark");
+DEFINE_int32(poses, 20, "Number of robot poses per map");
+DEFINE_int32(cycles, 10, "Number of warm-started control cycles per pose");
+
+namespace {
+// Control loop period, matching Navigation::Run.
+const double kCycleBudget = 1.0 / 20.0;
+// Simulated laser, matching the real one.
+const int kNumRays = 1081;
+const float kAngleRange = 2.35;
+const float kMaxRange = 10.0;
+// The goal is placed this far ahead of the robot.
+const float kGoalDistance = 4.0;
+
+struct Stats {
+  Stats() : total(0), max(0), count(0) {}
+  void Add(double t) {
+    total += t;
+    max = std::max(max, t);
+    ++count;
+  }
+  double Mean() const { return (count > 0) ? total / count : 0; }
+  double total;
+  double max;
+  int count;
+};
+
+vector<int> ParseList(const string& list) {
+  vector<int> values;
+  std::stringstream stream(list);
+  string value;
+  while (std::getline(stream, value, ',')) {
+    values.push_back(atoi(value.c_str()));
+  }
+  return values;
+}
+
+// Simulated scan from the specified pose, as points in base_link.
+void SimulateScan(vector_map::VectorMap* map,
+                  const Vector2f& loc,
+                  float angle,
+                  vector<Vector2f>* points) {
+  vector<float> ranges;
+  map->GetPredictedScan(loc, 0.02, kMaxRange, angle - kAngleRange,
+                        angle + kAngleRange, kNumRays, &ranges);
+  points->clear();
+  const float da = 2.0 * kAngleRange / kNumRays;
+  for (int i = 0; i < kNumRays; ++i) {
+    if (ranges[i] >= kMaxRange) continue;
+    const float a = -kAngleRange + i * da;
+    points->push_back(ranges[i] * Vector2f(cos(a), sin(a)));
+  }
+}
+
+void BenchmarkMap(const string& map_file,
+                  const vector<int>& rollouts,
+                  util_random::Random* rng) {
+  vector_map::VectorMap map(map_file);
+  Vector2f min_corner = map.lines[0].p0;
+  Vector2f max_corner = map.lines[0].p0;
+  for (const auto& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+
+  const MPPIParams defaults;
+  LocalCostMap cost_map(4.0, 0.05, 1.0);
+  Stats cost_map_stats;
+  vector<Stats> mppi_stats(rollouts.size());
+  vector<MPPIController*> controllers;
+  for (const int n : rollouts) {
+    MPPIParams params = defaults;
+    params.num_rollouts = n;
+    controllers.push_back(new MPPIController(params));
+  }
+
+  vector<Vector2f> points;
+  int poses = 0;
+  for (int attempt = 0; poses < FLAGS_poses && attempt < 100 * FLAGS_poses;
+       ++attempt) {
+    const Vector2f loc(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                       rng->UniformRandom(min_corner.y(), max_corner.y()));
+    const float angle = rng->UniformRandom(-M_PI, M_PI);
+    // Only keep poses in the open, with a clear view ahead.
+    const Vector2f ahead = loc + Rotation2Df(angle) * Vector2f(1.0, 0);
+    if (map.Intersects(loc, ahead)) continue;
+    SimulateScan(&map, loc, angle, &points);
+    if (points.size() < kNumRays / 2) continue;
+    const float closest = (*std::min_element(
+        points.begin(), points.end(),
+        [](const Vector2f& a, const Vector2f& b) {
+          return a.squaredNorm() < b.squaredNorm();
+        })).norm();
+    if (closest < 0.5) continue;
+    ++poses;
+
+    double t_start = GetMonotonicTime();
+    cost_map.Build(points);
+    cost_map_stats.Add(GetMonotonicTime() - t_start);
+
+    const Vector2f goal(kGoalDistance, 0);
+    for (size_t i = 0; i < controllers.size(); ++i) {
+      controllers[i]->Reset();
+      for (int cycle = 0; cycle < FLAGS_cycles; ++cycle) {
+        float acceleration = 0;
+        float curvature = 0;
+        t_start = GetMonotonicTime();
+        controllers[i]->Optimize(cost_map, 0.5, goal, &acceleration,
+                                 &curvature);
+        mppi_stats[i].Add(GetMonotonicTime() - t_start);
+      }
+    }
+  }
+
+  printf("%s: %d poses, %d cycles each\n", map_file.c_str(), poses,
+         FLAGS_cycles);
+  printf("  %-28s mean %8.3f ms  max %8.3f ms\n", "Cost map build",
+         1e3 * cost_map_stats.Mean(), 1e3 * cost_map_stats.max);
+  for (size_t i = 0; i < controllers.size(); ++i) {
+    const string label =
+        "MPPI " + std::to_string(controllers[i]->params().num_rollouts) +
+        " rollouts";
+    const double worst = cost_map_stats.max + mppi_stats[i].max;
+    printf("  %-28s mean %8.3f ms  max %8.3f ms  %s\n", label.c_str(),
+           1e3 * mppi_stats[i].Mean(), 1e3 * mppi_stats[i].max,
+           (worst < kCycleBudget) ? "fits 20 Hz" : "over 20 Hz budget");
+    delete controllers[i];
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+#ifdef _OPENMP
+  printf("OpenMP threads: %d\n", omp_get_max_threads());
+#else
+  printf("OpenMP disabled, single thread\n");
+#endif
+  const vector<int> rollouts = ParseList(FLAGS_rollouts);
+  util_random::Random rng(1);
+  std::stringstream maps(FLAGS_maps);
+  string map_file;
+  while (std::getline(maps, map_file, ',')) {
+    BenchmarkMap(map_file, rollouts, &rng);
+  }
+  return 0;
+}
@@ -19,58 +19,61 @@
 */
 //========================================================================
 
+#include <algorithm>
+#include <limits>
+
+#include "config_reader/config_reader.h"
 #include "gflags/gflags.h"
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
-#include "amrl_msgs/AckermannCurvatureDriveMsg.h"
-#include "amrl_msgs/Pose2Df.h"
-#include "amrl_msgs/VisualizationMsg.h"
 #include "glog/logging.h"
-#include "ros/ros.h"
 #include "shared/math/math_util.h"
+#include "shared/util/profiler.h"
+#include "shared/util/thread_pool.h"
 #include "shared/util/timer.h"
-#include "shared/ros/ros_helpers.h"
 #include "navigation.h"
-#include "visualization/visualization.h"
 
 using Eigen::Vector2f;
-using amrl_msgs::AckermannCurvatureDriveMsg;
-using amrl_msgs::VisualizationMsg;
 using std::string;
 using std::vector;
 
 using namespace math_util;
-using namespace ros_helpers;
+
+DEFINE_string(local_planner, "arcs",
+              "Local planner: 'arcs' picks a curvature and then a speed with "
+              "TOC, 'dynamic_window' samples (velocity, curvature) jointly, "
+              "'mppi' runs the MPPI controller");
 
 namespace {
-ros::Publisher drive_pub_;
-ros::Publisher viz_pub_;
-VisualizationMsg local_viz_msg_;
-VisualizationMsg global_viz_msg_;
-AckermannCurvatureDriveMsg drive_msg_;  
 // Epsilon value for handling limited numerical precision.
 const float kEpsilon = 1e-5;
 } //namespace
 
 namespace navigation {
 
-Navigation::Navigation(const string& map_file, ros::NodeHandle* n) :
+// Path option sampling, rebuilt in the background when changed at run time
+CONFIG_INT(curvature_sample_count_, "curvature_sample_count");
+CONFIG_INT(arc_samples_, "arc_samples");
+config_reader::ConfigReader config_reader_({"config/navigation.lua"});
+
+Navigation::Navigation(const string& map_file,
+                       NavigationSink* sink,
+                       const NavigationClock& clock,
+                       bool threaded_scan_evaluation) :
+    sink_(sink),
+    clock_(clock),
     robot_loc_(0, 0),
     robot_angle_(0),
     robot_vel_(0, 0),
     robot_omega_(0),
     nav_complete_(true),
     nav_goal_loc_(0, 0),
-    nav_goal_angle_(0) {
-  drive_pub_ = n->advertise<AckermannCurvatureDriveMsg>(
-      "ackermann_curvature_drive", 1);
-  viz_pub_ = n->advertise<VisualizationMsg>("visualization", 1);
-  local_viz_msg_ = visualization::NewVisualizationMessage(
-      "base_link", "navigation_local");
-  global_viz_msg_ = visualization::NewVisualizationMessage(
-      "map", "navigation_global");
-  InitRosHeader("base_link", &drive_msg_.header);
-
+    nav_goal_angle_(0),
+    path_option_geometry_([this]( const PathOptionParams& params ) { return BuildPathOptionGeometry( params ); }),
+    map_(map_file),
+    global_planner_(map_, planner_resolution_, width_/2 + margin_),
+    mppi_(MPPIParamsFromVehicle()),
+    scan_worker_running_(threaded_scan_evaluation) {
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
@@ -80,22 +83,143 @@ Navigation::Navigation(const string& map_file, ros::NodeHandle* n) :
   bl_ = { -(length_-wheel_base_)/2, width_/2 }; // back left
 
 
-  GenerateCurvatureSamples();
+  path_option_geometry_.Build( PathOptionParamsFromConfig() );
+  path_options_ = path_option_geometry_.Get()->path_options;
 
+  // Started last, once the state it reads is complete
+  if( threaded_scan_evaluation )
+  {
+    scan_worker_ = std::thread( &Navigation::ScanWorker, this );
+  }
   
   //TODO check that car dimensions are logical
 }
 
+Navigation::~Navigation() {
+  scan_worker_running_ = false;
+  if( scan_worker_.joinable() ) scan_worker_.join();
+}
+
 void Navigation::SetNavGoal(const Vector2f& loc, float angle) {
+  // A new goal replaces the whole route
+  route_path_.clear();
+  route_distance_.clear();
+  route_waypoints_.clear();
+  route_start_ = 0;
+  route_carrot_index_ = 0;
+  mppi_.Reset();
+  StartLeg( loc, angle );
+  return;
+}
+
+bool Navigation::AddWaypoint(const Vector2f& loc, float angle) {
+  if( nav_complete_ )
+  {
+    SetNavGoal( loc, angle );
+    return true;
+  }
+
+  // Plan the new leg on the static map from the end of the route, so that it is ready when the robot gets there
+  if( route_path_.empty() )
+  {
+    route_path_.push_back( nav_goal_loc_ );
+    route_distance_.push_back( 0 );
+    route_start_ = 0;
+    route_carrot_index_ = 0;
+  }
+  if( !global_planner_.Plan( route_path_.back(), loc, &route_leg_ ) )
+  {
+    printf("No route leg found from (%f,%f) to (%f,%f)\n",
+           route_path_.back().x(), route_path_.back().y(), loc.x(), loc.y());
+    return false;
+  }
+  for( size_t i = 1; i < route_leg_.size(); ++i )
+  {
+    route_distance_.push_back( route_distance_.back() + (route_leg_[i] - route_path_.back()).norm() );
+    route_path_.push_back( route_leg_[i] );
+  }
+  route_waypoints_.push_back( std::make_pair( route_path_.size() - 1, angle ) );
+  return true;
+}
+
+void Navigation::StartLeg(const Vector2f& loc, float angle) {
   nav_goal_loc_ = loc;
   nav_goal_angle_ = angle;
 
   nav_complete_ = 0;
+
+  const double t_start = GetMonotonicTime();
+  if( global_planner_.SetGoal( robot_loc_, nav_goal_loc_ ) &&
+      global_planner_.Replan( robot_loc_, &global_path_ ) )
+  {
+    printf("Global plan: %lu waypoints, %lu cells expanded, %.2f ms\n",
+           global_path_.size(),
+           global_planner_.NumExpanded(),
+           1e3*(GetMonotonicTime() - t_start));
+  }else{
+    // Fall back to driving towards the fixed carrot
+    printf("No global plan found from (%f,%f) to (%f,%f)\n",
+           robot_loc_.x(), robot_loc_.y(), loc.x(), loc.y());
+  }
+
+  for( size_t i = 0; i + 1 < global_path_.size(); ++i )
+  {
+    sink_->DrawLine( global_path_[i], global_path_[i+1], 0x009000, VisualizationFrame::kGlobal );
+  }
+  for( size_t i = route_start_; i + 1 < route_path_.size(); ++i )
+  {
+    sink_->DrawLine( route_path_[i], route_path_[i+1], 0x909000, VisualizationFrame::kGlobal );
+  }
+  sink_->PublishVisualization( VisualizationFrame::kGlobal );
   
   return;
 }
 
+void Navigation::UpdateRouteProgress() {
+  const bool final_goal = route_waypoints_.empty();
+  const float tolerance = final_goal ? nav_goal_loc_tol_ : waypoint_switch_distance_;
+  if( (robot_loc_ - nav_goal_loc_).norm() > tolerance ) return;
+  if( final_goal )
+  {
+    nav_complete_ = 1;
+    return;
+  }
+
+  // Switch to the next leg without stopping
+  const size_t next = route_waypoints_.front().first;
+  const float angle = route_waypoints_.front().second;
+  route_waypoints_.pop_front();
+  route_start_ = next;
+  route_carrot_index_ = std::max( route_carrot_index_, next );
+  // Drop the legs behind the robot once they make up most of the route
+  if( route_start_ > route_path_.size()/2 )
+  {
+    route_path_.erase( route_path_.begin(), route_path_.begin() + route_start_ );
+    route_distance_.erase( route_distance_.begin(), route_distance_.begin() + route_start_ );
+    for( auto& waypoint: route_waypoints_ ) waypoint.first -= route_start_;
+    route_carrot_index_ -= route_start_;
+    route_start_ = 0;
+  }
+  StartLeg( route_path_[route_start_], angle );
+  return;
+}
+
+float Navigation::RemainingRouteDistance() const {
+  float distance = global_planner_.PathCost();
+  if( distance == std::numeric_limits<float>::infinity() )
+  {
+    distance = (nav_goal_loc_ - robot_loc_).norm();
+  }
+  if( !route_distance_.empty() )
+  {
+    distance += route_distance_.back() - route_distance_[route_start_];
+  }
+  return distance;
+}
+
 void Navigation::UpdateLocation(const Eigen::Vector2f& loc, float angle) { 
+  robot_loc_ = loc;
+  robot_angle_ = angle;
   return;
 }
 
@@ -108,150 +232,380 @@ void Navigation::UpdateOdometry(const Vector2f& loc,
   robot_vel_ = vel;
   robot_omega_ = ang_vel;
 
-  if( nav_goal_loc_[0]-loc[0] < nav_goal_loc_tol_ &&
-      nav_complete_ == 0)
+  return;
+}
+
+void Navigation::ObservePointCloud( const vector<Vector2f>& point_cloud,double time ) {
+  PROFILE_FUNCTION();
+  // Path options are evaluated from where the car will be once the lagged commands are executed
+  const PredictedState predicted_state = PredictState();
+  Scan& scan = scans_.WriteBuffer();
+  scan.point_cloud = point_cloud;
+  scan.time = time;
+  scan.predicted_loc = predicted_state.loc;
+  scan.predicted_angle = predicted_state.angle;
+  scan.path_option_geometry = path_option_geometry_.Get();
+  if( scan_worker_.joinable() )
   {
-    nav_complete_ = 1;
+    scans_.Publish();
+  }else{
+    EvaluateScan( scan, &scan_evaluations_.WriteBuffer() );
+    scan_evaluations_.Publish();
   }
   return;
 }
 
-void Navigation::ObservePointCloud( const vector<Vector2f>& point_cloud,double time ) {
-  for(auto& path_option: path_options_)
-  {
-    const Vector2f pole( 0, 1/path_option.first.curvature ); 
-
-    float corner_curvatures[4] = { 1/(pole - fr_).norm(),
-                                 1/(pole - br_).norm(), 
-                                 1/(pole - fl_).norm(), 
-                                 1/(pole - bl_).norm() };
-    // Sorts the curvatures from fastest (smallest curvature) to slowest (largest curvature) corners
-    std::sort(corner_curvatures, corner_curvatures+4);
-    // How far in radians we are looking down the arc
-    float const lookahead_theta = fabs(path_option.first.curvature * lookahead_distance_);  //todo move these inside the non zero curvature option
-    //Find all the points we could collide with for a given curvature
-    vector<Vector2f> collision_set;
-    vector<Vector2f> clearance_set;
-    for(const auto& point: point_cloud)
+void Navigation::ScanWorker() {
+  PROFILE_THREAD( "scan worker" );
+  while( scan_worker_running_ )
+  {
+    if( !scans_.Update() )
     {
-      if( path_option.first.curvature != 0){
-        const bool point_in_lookahead_arc = PointInAreaOfInterestCurved(point, lookahead_theta, pole);
-        const float curvature = 1/(pole - point).norm();
-        if( point_in_lookahead_arc && 
-            curvature < corner_curvatures[3] &&
-            curvature > corner_curvatures[0] ) 
-        {
-          collision_set.push_back( point );
-        }
-        else if( point_in_lookahead_arc ){
-          clearance_set.push_back(point);
-        }
-      }else{
-        const bool point_in_lookahead_distance = PointInAreaOfInterestStraight(point, lookahead_distance_);
-        //TODO change width_ to account for margin
-        if( point_in_lookahead_distance &&
-            fabs(point[1]) < width_ )
-        {
-          collision_set.push_back( point );
-        }
-        else if( point_in_lookahead_distance )
-        {
-          clearance_set.push_back(point);
-        }
-      }
+      Sleep( scan_worker_poll_period_ );
+      continue;
     }
+    PROFILE_SCOPE( "ScanWorker evaluation" );
+    EvaluateScan( scans_.ReadBuffer(), &scan_evaluations_.WriteBuffer() );
+    scan_evaluations_.Publish();
+  }
+  return;
+}
 
-    //Find free path length by evaluating the collisions of the arc samples
-    path_option.first.free_path_length = lookahead_distance_;
-    int index = 0;
-    for(const VehicleCorners& corners: path_option.second)
+void Navigation::EvaluateScan( const Scan& scan, ScanEvaluation* evaluation ) {
+  const Eigen::Rotation2Df rotation( -scan.predicted_angle );
+  predicted_point_cloud_.resize( scan.point_cloud.size() );
+  for( size_t i = 0; i < scan.point_cloud.size(); ++i )
+  {
+    predicted_point_cloud_[i] = rotation*( scan.point_cloud[i] - scan.predicted_loc );
+  }
+  if( FLAGS_local_planner == "mppi" )
+  {
+    // Allocated once per buffer, and rebuilt in place after that
+    if( evaluation->cost_map.Empty() )
     {
-      if( Collision(collision_set, corners ) )
+      evaluation->cost_map = LocalCostMap( mppi_cost_map_half_extent_, mppi_cost_map_resolution_, mppi_cost_map_max_distance_ );
+    }
+    evaluation->cost_map.Build( predicted_point_cloud_ );
+  }else if( FLAGS_local_planner == "dynamic_window" )
+  {
+    EvaluateDynamicWindow( predicted_point_cloud_, &evaluation->dynamic_window_options );
+  }else{
+    EvaluatePathOptions( *scan.path_option_geometry, predicted_point_cloud_, &evaluation->path_options );
+  }
+  evaluation->path_option_geometry = scan.path_option_geometry;
+  evaluation->point_cloud = scan.point_cloud;
+  evaluation->time = scan.time;
+  return;
+}
+
+void Navigation::EvaluatePathOptions( const vector<Vector2f>& point_cloud, vector<PathOption>* path_options ) {
+  EvaluatePathOptions( *path_option_geometry_.Get(), point_cloud, path_options );
+  return;
+}
+
+void Navigation::EvaluatePathOptions( const PathOptionGeometry& geometry,
+                                      const vector<Vector2f>& point_cloud,
+                                      vector<PathOption>* path_options ) {
+  PROFILE_FUNCTION();
+  // Each point maps to one cell of the swept volume grid, shared by all path options
+  point_cells_.clear();
+  for( const auto& point: point_cloud )
+  {
+    const int cell = SweptVolumeCell( geometry, point );
+    if( cell >= 0 ) point_cells_.push_back( cell );
+  }
+  const vector<int>& cells = point_cells_;
+
+  path_options->resize( geometry.path_options.size() );
+  // The path options are independent, and share the cells read only
+  ThreadPool::Default().ParallelFor( 0, geometry.path_options.size(), 1, [&]( size_t i )
+  {
+    PathOption& path_option = (*path_options)[i];
+    path_option.curvature = geometry.path_options[i].first.curvature;
+    const vector<SweptCell>& swept_volume = geometry.swept_volumes[i];
+
+    //Free path length is the first contact of any point with the swept footprint
+    path_option.free_path_length = lookahead_distance_;
+    for( const int cell: cells )
+    {
+      path_option.free_path_length = std::min( path_option.free_path_length, swept_volume[cell].contact );
+    }
+
+    //Clearance is the closest approach to the path of any point which the car never touches
+    path_option.clearance = swept_volume_clearance_;
+    for( const int cell: cells )
+    {
+      const SweptCell& swept_cell = swept_volume[cell];
+      if( swept_cell.contact == std::numeric_limits<float>::infinity() &&
+          0 < swept_cell.along &&
+          swept_cell.along < path_option.free_path_length &&
+          swept_cell.lateral < path_option.clearance )
       {
-        visualization::DrawLine(corners.fr, corners.fl, 255, local_viz_msg_ );
-        visualization::DrawLine(corners.fr, corners.br, 255, local_viz_msg_ );
-        visualization::DrawLine(corners.fl, corners.bl, 255, local_viz_msg_ );
-        path_option.first.free_path_length = (index-1) * lookahead_distance_/arc_samples_;
-        break;  // If there is a collision then break, because we dont need to look any further
-      }else{
-        visualization::DrawLine(corners.fr, corners.fl, 0, local_viz_msg_ );
-        visualization::DrawLine(corners.fr, corners.br, 0, local_viz_msg_ );
-        visualization::DrawLine(corners.fl, corners.bl, 0, local_viz_msg_ );
+        path_option.clearance = swept_cell.lateral;
       }
-      ++index;
     }
 
-    //Calculate closest point- i.e. the base link location at the end of the arc
-    const float theta = (index-1)*lookahead_theta/arc_samples_;
-    path_option.first.clearance = 10;
-    for( const auto& point: clearance_set )
+    //Calculate closest point- i.e. the base link location at the end of the free path
+    if( path_option.curvature != 0 )
+    {
+      const float theta = fabs(path_option.curvature) * path_option.free_path_length;
+      path_option.closest_point = BaseLinkPropagationCurve( theta, path_option.curvature );
+    }else{
+      path_option.closest_point = BaseLinkPropagationStraight( path_option.free_path_length );
+    }
+  });
+  return;
+}
+
+void Navigation::EvaluateDynamicWindow( const vector<Vector2f>& point_cloud, vector<PathOption>* path_options ) const {
+  PROFILE_FUNCTION();
+  const float kInfinity = std::numeric_limits<float>::infinity();
+  // The footprint is grown by margin_ on every side
+  const float front = fr_[0] + margin_;
+  const float back = br_[0] - margin_;
+  const float half_width = width_/2 + margin_;
+
+  path_options->resize( dynamic_window_curvature_samples_ );
+  for( int i = 0; i < dynamic_window_curvature_samples_; ++i )
+  {
+    PathOption& path_option = (*path_options)[i];
+    const float curvature = -curvature_limit_ + i*2*curvature_limit_/(dynamic_window_curvature_samples_ - 1);
+    path_option.curvature = curvature;
+    path_option.free_path_length = lookahead_distance_;
+    path_option.clearance = swept_volume_clearance_;
+
+    // First contact of any point with the footprint swept along this arc
+    const float radius = fabs(curvature) > kEpsilon ? 1/fabs(curvature) : kInfinity;
+    const float inner_radius = radius - half_width;
+    const float max_radius = Vector2f( radius + half_width, front ).norm();
+    for( const auto& point: point_cloud )
     {
-      if( path_option.first.curvature != 0 )
+      const bool inside = back <= point[0] && point[0] <= front && fabs(point[1]) <= half_width;
+      float contact = inside ? 0 : kInfinity;
+      if( radius == kInfinity )
       {
-        const bool point_in_lookahead_arc = PointInAreaOfInterestCurved(point, theta, pole);
-        if( point_in_lookahead_arc )
+        if( point[0] > front && fabs(point[1]) <= half_width ) contact = point[0] - front;
+      }else{
+        // Mirror right turns onto left turns, with the pole at (0, radius)
+        const float y = curvature > 0 ? point[1] : -point[1];
+        const float point_radius = Vector2f( point[0], radius - y ).norm();
+        const float point_theta = atan2( point[0], radius - y );
+        if( !inside && inner_radius <= point_radius && point_radius <= max_radius )
         {
-          const float clearance = fabs( 1/fabs(path_option.first.curvature) - (pole - point).norm() );
-          if( clearance < path_option.first.clearance ) path_option.first.clearance = clearance;
+          // Angle by which the part of the car that sweeps this radius leads base_link: the inner side
+          // for radii up to the front inner corner, and the front edge beyond it. The rear outer corner,
+          // which swings out backwards, is not considered.
+          const float offset = point_radius*point_radius <= inner_radius*inner_radius + front*front ?
+              atan2( sqrt( point_radius*point_radius - inner_radius*inner_radius ), inner_radius ) :
+              atan2( front, sqrt( point_radius*point_radius - front*front ) );
+          if( point_theta >= offset ) contact = (point_theta - offset)*radius;
         }
       }
-      else
+      if( contact < path_option.free_path_length )
       {
-        const bool point_in_lookahead_distance = PointInAreaOfInterestStraight(point, path_option.first.free_path_length);
-        if ( point_in_lookahead_distance )
-        {
-          const float clearance = fabs(point[1]);
-          if (clearance < path_option.first.clearance ) path_option.first.clearance = clearance;
-        }
+        path_option.free_path_length = contact;
       }
     }
-  
-    if( path_option.first.curvature != 0 )
+    // Closest approach to the path of any point the car passes before the first contact
+    for( const auto& point: point_cloud )
     {
-      path_option.first.closest_point = BaseLinkPropagationCurve( theta, path_option.first.curvature );
+      float along = point[0];
+      float lateral = fabs(point[1]);
+      if( radius != kInfinity )
+      {
+        const float y = curvature > 0 ? point[1] : -point[1];
+        along = atan2( point[0], radius - y )*radius;
+        lateral = fabs( Vector2f( point[0], radius - y ).norm() - radius );
+      }
+      if( lateral > half_width &&
+          0 < along && along < path_option.free_path_length &&
+          lateral < path_option.clearance )
+      {
+        path_option.clearance = lateral;
+      }
+    }
+
+    if( radius != kInfinity )
+    {
+      path_option.closest_point = BaseLinkPropagationCurve( fabs(curvature)*path_option.free_path_length, curvature );
     }else{
-      path_option.first.closest_point = BaseLinkPropagationStraight( path_option.first.free_path_length );
-    }    
+      path_option.closest_point = BaseLinkPropagationStraight( path_option.free_path_length );
+    }
   }
   return;
 }
 
-double Navigation::PredictedRobotVelocity(){
-  auto commandIsOld = [ this ]
-                      ( const AccelerationCommand& command ) 
-                      { return ros::Time::now() - command.stamp > actuation_lag_time_; }; 
+void Navigation::DynamicWindow() {
+  PROFILE_FUNCTION();
+  const PredictedState state = PredictState();
+  // Velocities reachable within one control cycle
+  const float min_velocity = std::max( 0.0f, state.velocity + min_acceleration_*time_step_ );
+  const float max_velocity = std::max( min_velocity, std::min( max_velocity_, state.velocity + max_acceleration_*time_step_ ) );
+
+  // The carrot and goal, in the predicted frame the options were evaluated in
+  const Eigen::Rotation2Df to_predicted( -state.angle );
+  const Vector2f carrot = to_predicted*( GetCarrot() - state.loc );
+  const float distance_to_goal = RemainingRouteDistance();
+
+  float best_score = -std::numeric_limits<float>::infinity();
+  float best_velocity = min_velocity;
+  const PathOption* best_option = nullptr;
+  for( const auto& path_option: dynamic_window_options_ )
+  {
+    for( int j = 0; j < dynamic_window_velocity_samples_; ++j )
+    {
+      const float velocity = min_velocity + j*(max_velocity - min_velocity)/(dynamic_window_velocity_samples_ - 1);
+      // Admissible only if the car can still stop before the obstacle, and before the goal
+      const float stopping_distance = velocity*velocity/(2*-min_acceleration_);
+      if( stopping_distance > path_option.free_path_length || stopping_distance > distance_to_goal ) continue;
+
+      const float distance = std::min( velocity*dynamic_window_horizon_, path_option.free_path_length );
+      const Vector2f end = path_option.curvature != 0 ?
+          BaseLinkPropagationCurve( fabs(path_option.curvature)*distance, path_option.curvature ) :
+          BaseLinkPropagationStraight( distance );
+      const float progress = carrot.norm() - (carrot - end).norm();
+      const float score = dynamic_window_progress_weight_*progress +
+                          dynamic_window_clearance_weight_*path_option.clearance +
+                          dynamic_window_velocity_weight_*velocity;
+      if( score > best_score )
+      {
+        best_score = score;
+        best_velocity = velocity;
+        best_option = &path_option;
+      }
+    }
+  }
+
+  // With no admissible command, brake as hard as possible along the longest free arc
+  float curvature = 0;
+  if( best_option )
+  {
+    curvature = best_option->curvature;
+    sink_->DrawPathOption( curvature, best_option->free_path_length, best_option->clearance );
+  }else{
+    float longest = -1;
+    for( const auto& path_option: dynamic_window_options_ )
+    {
+      if( path_option.free_path_length > longest )
+      {
+        longest = path_option.free_path_length;
+        curvature = path_option.curvature;
+      }
+    }
+  }
+
+  PublishDriveCommand( AccelerationCommand{ (best_velocity - state.velocity)/time_step_, curvature, clock_() }, best_velocity );
+  return;
+}
 
-  command_history_.remove_if( commandIsOld );
+void Navigation::MPPI() {
+  PROFILE_FUNCTION();
+  const PredictedState state = PredictState();
+  const Eigen::Rotation2Df to_predicted( -state.angle );
+  const Vector2f carrot = to_predicted*( GetCarrot() - state.loc );
 
-  float predicted_velocity = robot_vel_[0];
-  // Integrate acceleration to get the velocity we can expect after the actuation lag
-  for( const auto& command: command_history_)
+  // Until the scan worker publishes a cost map, every rollout would look like a collision, so brake
+  const LocalCostMap& cost_map = scan_evaluations_.ReadBuffer().cost_map;
+  if( cost_map.Empty() )
   {
-    predicted_velocity += command.acceleration * time_step_;
+    const float velocity = std::max( 0.0f, state.velocity + min_acceleration_*time_step_ );
+    PublishDriveCommand( AccelerationCommand{ (velocity - state.velocity)/time_step_, 0, clock_() }, velocity );
+    return;
   }
 
-  return predicted_velocity;
+  float acceleration = 0;
+  float curvature = 0;
+  mppi_.Optimize( cost_map, state.velocity, carrot, &acceleration, &curvature );
+  const float velocity = std::max( 0.0f, std::min( max_velocity_, state.velocity + acceleration*time_step_ ) );
+
+  // Nominal trajectory, from the predicted frame back into base_link
+  const vector<Vector2f>& trajectory = mppi_.NominalTrajectory();
+  const Eigen::Rotation2Df to_base_link( state.angle );
+  for( size_t i = 0; i + 1 < trajectory.size(); ++i )
+  {
+    sink_->DrawLine( state.loc + to_base_link*trajectory[i], state.loc + to_base_link*trajectory[i+1], 0x0000FF, VisualizationFrame::kLocal );
+  }
+
+  PublishDriveCommand( AccelerationCommand{ acceleration, curvature, clock_() }, velocity );
+  return;
+}
+
+MPPIParams Navigation::MPPIParamsFromVehicle() const {
+  MPPIParams params;
+  params.time_step = time_step_;
+  params.max_velocity = max_velocity_;
+  params.max_acceleration = max_acceleration_;
+  params.min_acceleration = min_acceleration_;
+  params.curvature_limit = curvature_limit_;
+  // Two circles, over the front and back halves of the car, plus the margin. Called from the
+  // initializer list, so this cannot use the corners set in the constructor body.
+  const float back = -(length_-wheel_base_)/2;
+  params.footprint_radius = Vector2f( length_/4, width_/2 ).norm() + margin_;
+  params.footprint_offsets = { back + length_/4, back + 3*length_/4 };
+  return params;
 }
 
-void Navigation::GenerateCurvatureSamples(){
-  path_options_.resize( 2*curvature_sample_count_ + 1 );
+PredictedState Navigation::PredictState(){
+  const double now = clock_();
+  while( !command_history_.Empty() &&
+         now - command_history_.Front().stamp > actuation_lag_time_ )
+  {
+    command_history_.PopFront();
+  }
+
+  PredictedState state{ Vector2f( 0, 0 ), 0, robot_vel_[0] };
+  // Integrate the commands still in flight, each executed for one time step along its arc
+  for( size_t i = 0; i < command_history_.Size(); ++i )
+  {
+    const AccelerationCommand& command = command_history_[i];
+    state.velocity += command.acceleration * time_step_;
+    const float distance = state.velocity * time_step_;
+    Vector2f displacement( distance, 0 );
+    if( fabs(command.curvature) > kEpsilon )
+    {
+      const float theta = command.curvature * distance;
+      displacement = Vector2f( sin(theta), 1 - cos(theta) ) / command.curvature;
+    }
+    state.loc += Eigen::Rotation2Df( state.angle ) * displacement;
+    state.angle += command.curvature * distance;
+  }
+
+  return state;
+}
+
+PathOptionParams Navigation::PathOptionParamsFromConfig() const {
+  return PathOptionParams{ std::max( 1, CONFIG_curvature_sample_count_ ), std::max( 1, CONFIG_arc_samples_ ) };
+}
+
+std::shared_ptr<const PathOptionGeometry> Navigation::BuildPathOptionGeometry( const PathOptionParams& params ) const {
+  std::shared_ptr<PathOptionGeometry> geometry = std::make_shared<PathOptionGeometry>();
+  GenerateCurvatureSamples( params, geometry.get() );
+  GenerateSweptVolumes( geometry.get() );
+  return geometry;
+}
+
+void Navigation::GenerateCurvatureSamples( const PathOptionParams& params, PathOptionGeometry* geometry ) const {
+  const int curvature_sample_count = params.curvature_sample_count;
+  const int arc_samples = params.arc_samples;
+  auto& path_options = geometry->path_options;
+  path_options.resize( 2*curvature_sample_count + 1 );
   Vector2f base_link;
 
   // For each arc
-  for(size_t i=0; i<path_options_.size(); ++i)  
+  for(size_t i=0; i<path_options.size(); ++i)  
   {
-    path_options_[i].first.curvature = -curvature_limit_ + i*(curvature_limit_/curvature_sample_count_);  //Set the curvature, this is essentially the "thing" which defines an arc
+    path_options[i].first.curvature = -curvature_limit_ + i*(curvature_limit_/curvature_sample_count);  //Set the curvature, this is essentially the "thing" which defines an arc
 
     // If the arc is curved (i.e. curvature != 0)
-    if(path_options_[i].first.curvature != 0){
-      float const lookahead_theta = fabs(path_options_[i].first.curvature )* lookahead_distance_;
+    if(path_options[i].first.curvature != 0){
+      float const lookahead_theta = fabs(path_options[i].first.curvature )* lookahead_distance_;
 
       // For each position along curved the arc
-      for(int j=0; j<arc_samples_ + 1; ++j)
+      for(int j=0; j<arc_samples + 1; ++j)
       {
-        const float theta = j*lookahead_theta/arc_samples_;
+        const float theta = j*lookahead_theta/arc_samples;
      
-        base_link = BaseLinkPropagationCurve( theta, path_options_[i].first.curvature );
+        base_link = BaseLinkPropagationCurve( theta, path_options[i].first.curvature );
 
         Eigen::Rotation2D<float> rot(fabs(theta));
 
@@ -260,7 +614,7 @@ void Navigation::GenerateCurvatureSamples(){
         temp.fl = rot*fl_;
         temp.bl = rot*bl_;
         temp.br = rot*br_;
-        if(path_options_[i].first.curvature < 0)
+        if(path_options[i].first.curvature < 0)
         {
           temp.fr[1] *= -1.0;
           temp.fl[1] *= -1.0;
@@ -272,14 +626,14 @@ void Navigation::GenerateCurvatureSamples(){
         temp.bl += base_link;
         temp.br += base_link;
 
-        path_options_[i].second.push_back( temp );  
+        path_options[i].second.push_back( temp );  
       }
     }else{
 
       // For each position along the zero curvature arc
-      for(int j=0; j<arc_samples_ + 1; ++j)
+      for(int j=0; j<arc_samples + 1; ++j)
       {
-        const float lookahead = j*lookahead_distance_/arc_samples_;
+        const float lookahead = j*lookahead_distance_/arc_samples;
 
         base_link = BaseLinkPropagationStraight( lookahead );
 
@@ -289,7 +643,7 @@ void Navigation::GenerateCurvatureSamples(){
         temp.bl = base_link + bl_;
         temp.br = base_link + br_;
 
-        path_options_[i].second.push_back( temp );  
+        path_options[i].second.push_back( temp );  
       }
     }
   }
@@ -297,6 +651,123 @@ void Navigation::GenerateCurvatureSamples(){
   return;
 }
 
+void Navigation::GenerateSweptVolumes( PathOptionGeometry* geometry ) const {
+  const auto& path_options = geometry->path_options;
+  const float kInfinity = std::numeric_limits<float>::infinity();
+  // Grow the footprint by half a cell diagonal, so that a point collides whenever any part of its cell would
+  const float inflation = swept_volume_resolution_ * M_SQRT1_2;
+  VehicleCorners inflated;
+  inflated.fr = fr_ + Vector2f( inflation, -inflation );
+  inflated.fl = fl_ + Vector2f( inflation, inflation );
+  inflated.bl = bl_ + Vector2f( -inflation, inflation );
+  inflated.br = br_ + Vector2f( -inflation, -inflation );
+
+  // Sample each arc at half the cell size
+  const int num_steps = static_cast<int>( ceil( 2*lookahead_distance_/swept_volume_resolution_ ) );
+  const float step = lookahead_distance_/num_steps;
+  vector< vector<VehicleCorners> > footprints( path_options.size() );
+  Vector2f min_corner = inflated.fr;
+  Vector2f max_corner = inflated.fr;
+  for( size_t i = 0; i < path_options.size(); ++i )
+  {
+    const float curvature = path_options[i].first.curvature;
+    for( int j = 0; j <= num_steps; ++j )
+    {
+      const float arc_length = j*step;
+      const Vector2f base_link = curvature != 0 ?
+          BaseLinkPropagationCurve( fabs(curvature)*arc_length, curvature ) :
+          BaseLinkPropagationStraight( arc_length );
+      const Eigen::Rotation2Df rot( curvature*arc_length );
+      VehicleCorners footprint;
+      footprint.fr = base_link + rot*inflated.fr;
+      footprint.fl = base_link + rot*inflated.fl;
+      footprint.bl = base_link + rot*inflated.bl;
+      footprint.br = base_link + rot*inflated.br;
+      for( const Vector2f& corner: { footprint.fr, footprint.fl, footprint.bl, footprint.br } )
+      {
+        min_corner = min_corner.cwiseMin( corner );
+        max_corner = max_corner.cwiseMax( corner );
+      }
+      footprints[i].push_back( footprint );
+    }
+  }
+
+  const Vector2f band( swept_volume_clearance_, swept_volume_clearance_ );
+  geometry->swept_volume_origin = min_corner - band;
+  const Vector2f extent = max_corner - min_corner + 2*band;
+  geometry->swept_volume_width = static_cast<int>( ceil( extent.x()/swept_volume_resolution_ ) );
+  geometry->swept_volume_height = static_cast<int>( ceil( extent.y()/swept_volume_resolution_ ) );
+  const size_t num_cells = static_cast<size_t>( geometry->swept_volume_width )*geometry->swept_volume_height;
+
+  geometry->swept_volumes.assign( path_options.size(), vector<SweptCell>( num_cells ) );
+  vector<Vector2f> cell_center( 1 );
+  for( size_t i = 0; i < path_options.size(); ++i )
+  {
+    const float curvature = path_options[i].first.curvature;
+    vector<SweptCell>& swept_volume = geometry->swept_volumes[i];
+
+    // Projection of every cell onto the path of base_link
+    for( size_t cell = 0; cell < num_cells; ++cell )
+    {
+      const Vector2f point = geometry->swept_volume_origin + swept_volume_resolution_ *
+          Vector2f( cell % geometry->swept_volume_width + 0.5, cell / geometry->swept_volume_width + 0.5 );
+      SweptCell& swept_cell = swept_volume[cell];
+      swept_cell.contact = kInfinity;
+      if( curvature != 0 )
+      {
+        const float radius = 1/fabs(curvature);
+        const Vector2f pole( 0, 1/curvature );
+        const Vector2f pole_local_point = pole - point;
+        const float point_theta = curvature > 0 ?
+            atan2( pole_local_point[1], pole_local_point[0] ) - M_PI/2 :
+            atan2( -pole_local_point[1], pole_local_point[0] ) - M_PI/2;
+        swept_cell.along = point_theta*radius;
+        swept_cell.lateral = fabs( radius - pole_local_point.norm() );
+      }else{
+        swept_cell.along = point[0];
+        swept_cell.lateral = fabs( point[1] );
+      }
+    }
+
+    // Walk the footprint along the arc, marking cells the first time it covers them
+    for( size_t j = 0; j < footprints[i].size(); ++j )
+    {
+      const VehicleCorners& footprint = footprints[i][j];
+      Vector2f lo = footprint.fr;
+      Vector2f hi = footprint.fr;
+      for( const Vector2f& corner: { footprint.fl, footprint.bl, footprint.br } )
+      {
+        lo = lo.cwiseMin( corner );
+        hi = hi.cwiseMax( corner );
+      }
+      const int x0 = std::max( 0, static_cast<int>( floor( (lo.x() - geometry->swept_volume_origin.x())/swept_volume_resolution_ ) ) );
+      const int y0 = std::max( 0, static_cast<int>( floor( (lo.y() - geometry->swept_volume_origin.y())/swept_volume_resolution_ ) ) );
+      const int x1 = std::min( geometry->swept_volume_width - 1, static_cast<int>( floor( (hi.x() - geometry->swept_volume_origin.x())/swept_volume_resolution_ ) ) );
+      const int y1 = std::min( geometry->swept_volume_height - 1, static_cast<int>( floor( (hi.y() - geometry->swept_volume_origin.y())/swept_volume_resolution_ ) ) );
+      // Like the arc samples, report the last pose before the collision
+      const float contact = j == 0 ? 0 : (j - 1)*step;
+      for( int y = y0; y <= y1; ++y )
+      {
+        for( int x = x0; x <= x1; ++x )
+        {
+          SweptCell& swept_cell = swept_volume[y*geometry->swept_volume_width + x];
+          if( swept_cell.contact != kInfinity ) continue;
+          cell_center[0] = geometry->swept_volume_origin + swept_volume_resolution_*Vector2f( x + 0.5, y + 0.5 );
+          if( Collision( cell_center, footprint ) ) swept_cell.contact = contact;
+        }
+      }
+    }
+  }
+  return;
+}
+
+int Navigation::SweptVolumeCell( const PathOptionGeometry& geometry, const Vector2f& point ) const {
+  const int x = static_cast<int>( floor( (point.x() - geometry.swept_volume_origin.x())/swept_volume_resolution_ ) );
+  const int y = static_cast<int>( floor( (point.y() - geometry.swept_volume_origin.y())/swept_volume_resolution_ ) );
+  if( x < 0 || y < 0 || x >= geometry.swept_volume_width || y >= geometry.swept_volume_height ) return -1;
+  return y*geometry.swept_volume_width + x;
+}
+
 Vector2f Navigation::BaseLinkPropagationStraight(const float& lookahead_distance ) const {
   Vector2f base_link_location( 0, 0 );
   base_link_location[0] += lookahead_distance;
@@ -340,8 +811,48 @@ bool Navigation::PointInAreaOfInterestCurved(const Vector2f& point, const float&
   
 }
 
+Vector2f Navigation::GetCarrot() {
+  PROFILE_FUNCTION();
+  if( global_path_.empty() ) return carrot_stick_;
+
+  // Walk the carrot distance along the path. The global path starts at the robot, so this only visits
+  // the waypoints within the carrot distance, however long the path is.
+  const float carrot_distance = carrot_stick_.norm();
+  float remaining = carrot_distance;
+  Vector2f carrot = global_path_.back();
+  bool found = false;
+  for( size_t i = 0; i + 1 < global_path_.size(); ++i )
+  {
+    const float length = (global_path_[i+1] - global_path_[i]).norm();
+    if( length >= remaining )
+    {
+      carrot = global_path_[i] + (remaining/length)*(global_path_[i+1] - global_path_[i]);
+      found = true;
+      break;
+    }
+    remaining -= length;
+  }
+
+  // Past the current goal, continue along the precomputed route. The carrot index only moves as far
+  // as the lookahead changes between cycles, so it advances in amortized constant time.
+  if( !found && route_start_ + 1 < route_path_.size() )
+  {
+    const float target = route_distance_[route_start_] + remaining;
+    size_t& i = route_carrot_index_;
+    i = std::max( i, route_start_ + 1 );
+    while( i > route_start_ + 1 && route_distance_[i-1] >= target ) --i;
+    while( i + 1 < route_path_.size() && route_distance_[i] < target ) ++i;
+    // A route that doubles back would pull the carrot in behind the robot, so head for the goal first
+    if( (route_path_[i] - carrot).dot( carrot - robot_loc_ ) >= 0 )
+    {
+      carrot = route_path_[i];
+    }
+  }
+  return Eigen::Rotation2Df( -robot_angle_ )*( carrot - robot_loc_ );
+}
+
 void Navigation::TOC( const float& curvature, const float& robot_velocity, const float& distance_to_local_goal, const float& distance_needed_to_stop ){
-  AccelerationCommand commanded_acceleration{0.0, ros::Time::now()}; //Defaults to "Cruise"- means acceleration = 0.0
+  AccelerationCommand commanded_acceleration{0.0, curvature, clock_()}; //Defaults to "Cruise"- means acceleration = 0.0
 
   if( distance_to_local_goal > distance_needed_to_stop &&
       robot_velocity < max_velocity_ )
@@ -353,36 +864,110 @@ void Navigation::TOC( const float& curvature, const float& robot_velocity, const
     commanded_acceleration.acceleration = predicted_velocity<0.0 ? 0.0 : min_acceleration_;    // Decelerate
   }
 
-  drive_msg_.header.frame_id = "base_link";
-  drive_msg_.header.stamp = commanded_acceleration.stamp;
-  drive_msg_.velocity = robot_velocity + commanded_acceleration.acceleration*time_step_;
-  drive_msg_.curvature = curvature;
+  PublishDriveCommand( commanded_acceleration, robot_velocity + commanded_acceleration.acceleration*time_step_ );
+}
 
-  command_history_.push_back(commanded_acceleration);  
+void Navigation::PublishDriveCommand( const AccelerationCommand& command, const float& velocity ){
+  command_history_.PushBack(command);
 
-  drive_pub_.publish(drive_msg_);
+  sink_->DriveCommand( command.stamp, velocity, command.curvature );
 }
 
 void Navigation::Run() {
+  PROFILE_FUNCTION();
+  // Path options for changed sampling parameters are built in the background, and swapped in between cycles
+  path_option_geometry_.Request( PathOptionParamsFromConfig() );
+  if( path_option_geometry_.Update() )
+  {
+    path_options_ = path_option_geometry_.Get()->path_options;
+  }
+
+  // Take the latest evaluation from the scan worker
+  if( scan_evaluations_.Update() )
+  {
+    const ScanEvaluation& evaluation = scan_evaluations_.ReadBuffer();
+    // Path options are only evaluated for the arcs planner, and evaluations of the previous path options
+    // are dropped
+    const bool current_path_options = evaluation.path_option_geometry == path_option_geometry_.Get();
+    for( size_t i = 0; current_path_options && i < evaluation.path_options.size(); ++i )
+    {
+      PathOption& path_option = path_options_[i].first;
+      path_option.free_path_length = evaluation.path_options[i].free_path_length;
+      path_option.clearance = evaluation.path_options[i].clearance;
+      path_option.closest_point = evaluation.path_options[i].closest_point;
+    }
+    dynamic_window_options_ = evaluation.dynamic_window_options;
+
+    // Nearby points, in the map frame, become temporary obstacles for the global planner
+    const Eigen::Rotation2Df robot_rotation( robot_angle_ );
+    planner_obstacles_.clear();
+    for( const auto& point: evaluation.point_cloud )
+    {
+      if( point.squaredNorm() < planner_obstacle_range_*planner_obstacle_range_ )
+      {
+        planner_obstacles_.push_back( robot_loc_ + robot_rotation*point );
+      }
+    }
+    global_planner_.SetObstacles( planner_obstacles_ );
+  }
+
+  if(!nav_complete_)
+  {
+    UpdateRouteProgress();
+  }
+
   if(!nav_complete_)
   {
-    PathOption selected_path{path_options_[0].first};
-    for(auto& path_option: path_options_)
+    // Repair the global plan for the robot's new location and any new obstacles
+    if( global_planner_.HasGoal() )
     {
-      path_option.first.cost = -3*path_option.first.free_path_length+0.5*(path_option.first.closest_point-carrot_stick_).norm()-0.5*path_option.first.clearance;
-      if(path_option.first.cost < selected_path.cost)
+      global_planner_.Replan( robot_loc_, &global_path_ );
+    }
+
+    if( FLAGS_local_planner == "mppi" )
+    {
+      MPPI();
+    }else if( FLAGS_local_planner == "dynamic_window" )
+    {
+      DynamicWindow();
+    }else{
+      //Draw the sampled footprints of every option up to the first one in collision
+      for( const auto& path_option: path_options_ )
       {
-        selected_path = path_option.first;
+        int index = 0;
+        for( const VehicleCorners& corners: path_option.second )
+        {
+          const bool collision = index*lookahead_distance_/path_option_geometry_.GetParams().arc_samples > path_option.first.free_path_length;
+          const uint32_t color = collision ? 255 : 0;
+          sink_->DrawLine( corners.fr, corners.fl, color, VisualizationFrame::kLocal );
+          sink_->DrawLine( corners.fr, corners.br, color, VisualizationFrame::kLocal );
+          sink_->DrawLine( corners.fl, corners.bl, color, VisualizationFrame::kLocal );
+          if( collision ) break;
+          ++index;
+        }
       }
+
+      // The path options were evaluated in the predicted frame, so the carrot is scored there too
+      const PredictedState state = PredictState();
+      const Eigen::Rotation2Df to_predicted( -state.angle );
+      const Vector2f carrot = to_predicted*( GetCarrot() - state.loc );
+      PathOption selected_path{path_options_[0].first};
+      for(auto& path_option: path_options_)
+      {
+        path_option.first.cost = -3*path_option.first.free_path_length+0.5*(path_option.first.closest_point-carrot).norm()-0.5*path_option.first.clearance;
+        if(path_option.first.cost < selected_path.cost)
+        {
+          selected_path = path_option.first;
+        }
+      }
+      float const predicted_robot_vel = state.velocity;
+      float const distance_to_local_goal = RemainingRouteDistance();
+      float const distance_needed_to_stop = 
+        (predicted_robot_vel*predicted_robot_vel)/(2*-min_acceleration_) + predicted_robot_vel*actuation_lag_time_; //dnts = dynamic distance + lag time distance
+      
+      TOC(selected_path.curvature, predicted_robot_vel, distance_to_local_goal, distance_needed_to_stop );   
     }
-    float const predicted_robot_vel = PredictedRobotVelocity();
-    float const distance_to_local_goal = fabs(odom_loc_[0]-nav_goal_loc_[0]);
-    float const distance_needed_to_stop = 
-      (predicted_robot_vel*predicted_robot_vel)/(2*-min_acceleration_) + predicted_robot_vel*actuation_lag_time_.nsec/1e9; //dnts = dynamic distance + lag time distance
-    
-    TOC(selected_path.curvature, predicted_robot_vel, distance_to_local_goal, distance_needed_to_stop );   
-    viz_pub_.publish( local_viz_msg_ );
-    visualization::ClearVisualizationMsg( local_viz_msg_ );
+    sink_->PublishVisualization( VisualizationFrame::kLocal );
     
   }
   
@@ -19,8 +19,13 @@
 */
 //========================================================================
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
 #include <vector>
-#include <list> 
+#include <thread>
   
 #include "eigen3/Eigen/Dense"
 
@@ -28,7 +33,12 @@
 ////HELMS DEEP ADDITIONS////
 ////HELMS DEEP ADDITIONS////
 
-#include "amrl_msgs/VisualizationMsg.h"
+#include "vector_map/vector_map.h"
+#include "shared/util/background_builder.h"
+#include "shared/util/ring_buffer.h"
+#include "shared/util/triple_buffer.h"
+#include "dstar_lite.h"
+#include "mppi.h"
 
 ////HELMS DEEP ADDITIONS////
 ////HELMS DEEP ADDITIONS////
@@ -37,10 +47,6 @@
 #ifndef NAVIGATION_H
 #define NAVIGATION_H
 
-namespace ros {
-  class NodeHandle;
-}  // namespace ros
-
 namespace navigation {
 
 struct PathOption {
@@ -58,7 +64,16 @@ struct PathOption {
 ////HELMS DEEP ADDITIONS////
 struct AccelerationCommand {
   float acceleration;
-  ros::Time stamp;
+  float curvature;
+  double stamp; // s
+};
+
+// State the car is predicted to reach once the lagged commands are executed
+struct PredictedState {
+  // Pose relative to the current base_link
+  Eigen::Vector2f loc;
+  float angle;
+  float velocity;
 };
 
 struct VehicleCorners{
@@ -69,14 +84,121 @@ struct VehicleCorners{
   Eigen::Vector2f br;  
 };
 
+// Swept volume lookup table entry, for one path option and one cell in base_link
+struct SweptCell {
+  // Arc length the car can travel before its footprint reaches the cell, infinite if it never does within the lookahead
+  float contact;
+  // Arc length of the cell's projection onto the path of base_link
+  float along;
+  // Distance from the cell to the path of base_link
+  float lateral;
+};
+
+// Sampling parameters of the path options, tunable at run time
+struct PathOptionParams {
+  // Samples on each side of zero curvature
+  int curvature_sample_count;
+  // Collision checking samples along each arc
+  int arc_samples;
+
+  bool operator==( const PathOptionParams& other ) const {
+    return curvature_sample_count == other.curvature_sample_count &&
+           arc_samples == other.arc_samples;
+  }
+};
+
+// Path options and their swept volume lookup tables for one PathOptionParams. Never modified once built, so
+// that the scan worker can evaluate scans against one while the next is built and swapped in.
+struct PathOptionGeometry {
+  // Curvature of each path option, and its footprint at each arc sample
+  std::vector< std::pair< PathOption, std::vector<VehicleCorners> > > path_options;
+  // Swept volume lookup tables, one per path option, over a common grid in base_link
+  std::vector< std::vector<SweptCell> > swept_volumes;
+  // Swept volume grid geometry
+  Eigen::Vector2f swept_volume_origin;
+  int swept_volume_width;
+  int swept_volume_height;
+};
+
+// Laser scan handed to the scan worker thread
+struct Scan {
+  // Points in base_link
+  std::vector<Eigen::Vector2f> point_cloud;
+  double time;
+  // Predicted pose the path options are evaluated from, relative to base_link
+  Eigen::Vector2f predicted_loc;
+  float predicted_angle;
+  // Path options to evaluate
+  std::shared_ptr<const PathOptionGeometry> path_option_geometry;
+};
+
+// Path options evaluated by the scan worker thread against one scan
+struct ScanEvaluation {
+  std::vector<PathOption> path_options;
+  // Path options that path_options were evaluated for
+  std::shared_ptr<const PathOptionGeometry> path_option_geometry;
+  // Densely sampled curvatures, for the dynamic window planner
+  std::vector<PathOption> dynamic_window_options;
+  // Obstacle distances in the predicted frame, for the MPPI controller
+  LocalCostMap cost_map;
+  // The evaluated scan, in base_link
+  std::vector<Eigen::Vector2f> point_cloud;
+  double time;
+};
+
+// Frame a visualization is drawn in
+enum class VisualizationFrame {
+  // base_link, redrawn every Run()
+  kLocal,
+  // map, redrawn whenever a new leg is planned
+  kGlobal,
+};
+
+// Outputs of Navigation: drive commands and visualizations. The ROS node
+// publishes them as messages, while simulators and benchmarks record or drop
+// them. Visualizations are dropped unless overridden.
+class NavigationSink {
+ public:
+  virtual ~NavigationSink() {}
+
+  // Drive command issued at time (s) by Run()
+  virtual void DriveCommand( double time, float velocity, float curvature ) = 0;
+
+  virtual void DrawLine( const Eigen::Vector2f& p0, const Eigen::Vector2f& p1, uint32_t color, VisualizationFrame frame ) {}
+  // Arc of a path option in base_link
+  virtual void DrawPathOption( float curvature, float distance, float clearance ) {}
+  // Everything drawn in frame since the last call is complete, and replaces what was drawn before
+  virtual void PublishVisualization( VisualizationFrame frame ) {}
+};
+
+// Sink that drops every output
+class NullNavigationSink : public NavigationSink {
+ public:
+  void DriveCommand( double time, float velocity, float curvature ) override {}
+};
+
+// Source of the current time in seconds, for stamping commands and compensating for actuation lag
+typedef std::function<double()> NavigationClock;
+
 ////HELMS DEEP ADDITIONS////
 ////HELMS DEEP ADDITIONS////
 ////HELMS DEEP ADDITIONS////
 class Navigation {
  public:
 
-   // Constructor
-  explicit Navigation(const std::string& map_file, ros::NodeHandle* n);
+  // Constructor. Outputs go to sink, which must outlive the Navigation. Times
+  // are taken from clock, which must agree with the scan times passed to
+  // ObservePointCloud. Scans are evaluated on a worker thread, unless
+  // threaded_scan_evaluation is false, in which case ObservePointCloud
+  // evaluates them before returning, so that every Run() sees the latest scan
+  // and results are deterministic.
+  Navigation(const std::string& map_file,
+             NavigationSink* sink,
+             const NavigationClock& clock,
+             bool threaded_scan_evaluation = true);
+
+  // Stops the scan worker thread
+  ~Navigation();
 
   // Used in callback from localization to update position.
   void UpdateLocation(const Eigen::Vector2f& loc, float angle);
@@ -87,28 +209,111 @@ class Navigation {
                       const Eigen::Vector2f& vel,
                       float ang_vel);
 
-  // Updates based on an observed laser scan
+  // Updates based on an observed laser scan. Only hands the scan to the scan
+  // worker thread, and returns without waiting for it to be evaluated.
   void ObservePointCloud(const std::vector<Eigen::Vector2f>& cloud,
                          double time);
 
   // Main function called continously from main
   void Run();
-  // Used to set the next target pose.
+  // Used to set the next target pose, replacing any route being followed.
   void SetNavGoal(const Eigen::Vector2f& loc, float angle);
+  // Append a waypoint to the route. The robot drives through intermediate waypoints without stopping.
+  // Returns false if the waypoint is unreachable from the end of the route.
+  bool AddWaypoint(const Eigen::Vector2f& loc, float angle);
+  // Whether the final goal of the route has been reached, or there is none.
+  bool NavigationComplete() const { return nav_complete_; }
 
   ////HELMS DEEP ADDITIONS//// //TODO make additional functions private
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
-  // Predict the velocity the car will have after the lagged commands are executed
-  double PredictedRobotVelocity();
+  /**
+  * @note Commands older than actuation_lag_time_ are assumed to have been executed already
+  *
+  * @brief Predict the pose and velocity the car will have after the lagged commands are executed
+  * @see Mutates command_history_, by dropping executed commands
+  **/
+  PredictedState PredictState();
+  // Sampling parameters of the path options, from the config
+  PathOptionParams PathOptionParamsFromConfig() const;
+
+  /**
+  * @note Only reads state which is fixed after construction, so it is safe to call from the path option builder thread
+  *
+  * @brief Build the path options and their swept volumes for a set of sampling parameters
+  **/
+  std::shared_ptr<const PathOptionGeometry> BuildPathOptionGeometry( const PathOptionParams& params ) const;
+
   // Generate curvature samples
   /**
   * @note Should always produce one sample at -curvature_limit_, 0, and curvature_limit_
   *
   * @brief Calculate the discrete curvature samples which represent potential path direction options
-  * @see Mutates curvature_samples_
+  * @see Mutates geometry->path_options
   **/
-  void GenerateCurvatureSamples();
+  void GenerateCurvatureSamples( const PathOptionParams& params, PathOptionGeometry* geometry ) const;
+
+  /**
+  * @note Must be called after GenerateCurvatureSamples()
+  *
+  * @brief Rasterize the footprint swept along each path option into a lookup table, so that evaluating an observed point is a single lookup per option
+  * @see Mutates the swept volumes and swept volume grid geometry of geometry
+  **/
+  void GenerateSweptVolumes( PathOptionGeometry* geometry ) const;
+
+  // Index of the swept volume grid cell containing a base_link point, or -1 if it is outside the grid
+  int SweptVolumeCell( const PathOptionGeometry& geometry, const Eigen::Vector2f& point ) const;
+
+  /**
+  * @note Only reads state which is fixed after construction, and writes point_cells_, so it is safe to call from
+  * the scan worker thread, but not from two threads at once
+  *
+  * @brief Evaluate free path length, clearance and closest point of every path option against a point cloud
+  * @param geometry Path options to evaluate
+  * @param point_cloud Observed points in base_link
+  * @param path_options Evaluated options, in the same order as geometry.path_options
+  **/
+  void EvaluatePathOptions( const PathOptionGeometry& geometry,
+                            const std::vector<Eigen::Vector2f>& point_cloud,
+                            std::vector<PathOption>* path_options );
+
+  // Evaluate the current path options, in the same order as path_options_
+  void EvaluatePathOptions( const std::vector<Eigen::Vector2f>& point_cloud, std::vector<PathOption>* path_options );
+
+  /**
+  * @note Only reads state which is fixed after construction, so it is safe to call from the scan worker thread
+  *
+  * @brief Evaluate dynamic_window_curvature_samples_ evenly spaced curvatures against a point cloud, with the contact of
+  *        each point with the swept footprint computed analytically instead of from a lookup table
+  * @param point_cloud Observed points in base_link
+  * @param path_options Evaluated options, ordered by curvature
+  **/
+  void EvaluateDynamicWindow( const std::vector<Eigen::Vector2f>& point_cloud, std::vector<PathOption>* path_options ) const;
+
+  /**
+  * @note Velocity and curvature are scored jointly, every (velocity, curvature) sample in the window is considered
+  *
+  * @brief Dynamic window local planner: pick the reachable command with the best progress, clearance and speed
+  * @see Mutates command_history_
+  **/
+  void DynamicWindow();
+
+  /**
+  * @note Scores rollouts against the cost map of the latest evaluated scan
+  *
+  * @brief MPPI local controller: optimize acceleration and curvature over noisy rollouts towards the carrot
+  * @see Mutates mppi_ and command_history_
+  **/
+  void MPPI();
+
+  // MPPI parameters matching the car's dimensions and limits
+  MPPIParams MPPIParamsFromVehicle() const;
+
+  // Scan worker thread loop: evaluates the latest scan whenever there is a new one
+  void ScanWorker();
+
+  // Evaluate the path options of the active local planner against a scan
+  void EvaluateScan( const Scan& scan, ScanEvaluation* evaluation );
  
   /**
   * @note 
@@ -118,22 +323,40 @@ class Navigation {
   * @param robot_velocity The current robot velocity- should be lag compensated
   * @param distance_to_local_goal The distance along the arc to the end of the arc
   * @param distance_needed_to_stop The distancce needed to stop given kinematic limits 
-  * @see Mutates drive_msg_ and command_history_
+  * @see Mutates command_history_
   **/
   void TOC( const float& curvature, const float& robot_velocity, const float& distance_to_local_goal, const float& distance_needed_to_stop  );
 
+  // Send a drive command with the specified velocity to the sink, and record it for latency compensation
+  void PublishDriveCommand( const AccelerationCommand& command, const float& velocity );
+
   Eigen::Vector2f BaseLinkPropagationStraight( const float& lookahead_distance ) const;
   Eigen::Vector2f BaseLinkPropagationCurve( const float& theta, const float& curvature ) const; 
 
   bool PointInAreaOfInterestStraight(const Eigen::Vector2f point, const float& lookahead_distance ) const;
   bool PointInAreaOfInterestCurved(const Eigen::Vector2f& point, const float& theta, const Eigen::Vector2f& pole) const; 
 
+  // Local carrot in base_link, taken from the global path and then the route if there is one
+  Eigen::Vector2f GetCarrot();
+
+  // Plan from the robot to the next goal on the route
+  void StartLeg(const Eigen::Vector2f& loc, float angle);
+  // Complete navigation at the final goal, or switch to the next leg at an intermediate one
+  void UpdateRouteProgress();
+  // Path distance from the robot to the final goal of the route
+  float RemainingRouteDistance() const;
+
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
 
  private:
 
+  // Destination of drive commands and visualizations
+  NavigationSink* const sink_;
+  // Current time
+  NavigationClock const clock_;
+
   // Current robot location.
   Eigen::Vector2f robot_loc_;
   // Current robot orientation.
@@ -166,16 +389,15 @@ class Navigation {
   float const max_acceleration_ = 4.0; // m/s2
   // Max deceleration
   float const min_acceleration_ = -4.0; // m/s2
-   // Command history
-  std::list<AccelerationCommand> command_history_;
+  // Command history, oldest first. Holds well over actuation_lag_time_/time_step_ commands.
+  RingBuffer<AccelerationCommand, 16> command_history_;
   // Controller+actuation lag time
-  ros::Duration const actuation_lag_time_ = ros::Duration(0.15); // s
+  double const actuation_lag_time_ = 0.15; // s
 
   // Curvature - assume symmetry (i.e. max=-min)
   float const curvature_limit_ = 1.0;
-  // How many samples you want on each side of zero (i.e. min to 0 and then 0 to max)
-  int const curvature_sample_count_= 10; // 
-  // Path options
+  // Path options of the current geometry, with the latest evaluation. The number of samples on each side of
+  // zero (i.e. min to 0 and then 0 to max) is configured by curvature_sample_count.
   std::vector< std::pair< PathOption, std::vector<VehicleCorners> > > path_options_;
   // Vehicle dimensions
   float const length_ = 0.535;  // m
@@ -189,15 +411,80 @@ class Navigation {
   Eigen::Vector2f fl_; // front left 
   Eigen::Vector2f bl_; // back left
 
-  // Collision checking arc samples
-  int const arc_samples_ = 5;
+  // The number of collision checking arc samples is configured by arc_samples
   float const lookahead_distance_ = 2.0;
 
+  // Swept volume grid resolution
+  float const swept_volume_resolution_ = 0.05; // m
+  // Band around the swept footprints in which obstacles count towards clearance, which also caps the clearance
+  float const swept_volume_clearance_ = 1.0; // m
+
+  // Path options and swept volumes, rebuilt in the background when their parameters change and swapped in by
+  // Run. Declared after everything BuildPathOptionGeometry reads, so that a running build is waited for first.
+  BackgroundBuilder<PathOptionParams, PathOptionGeometry> path_option_geometry_;
+
   // carrot
   Eigen::Vector2f const carrot_stick_{4,0}; //m
+
+  // Map of the environment
+  vector_map::VectorMap map_;
+  // Global planner lattice resolution
+  float const planner_resolution_ = 0.1; // m
+  // Incremental planner over the map, obstacles inflated by half the car width plus margin
+  DStarLite global_planner_;
+  // Observed points further than this from the robot are not added to the global planner
+  float const planner_obstacle_range_ = 5.0; // m
+  // Current global plan in the map frame, from the robot to nav_goal_loc_
+  std::vector<Eigen::Vector2f> global_path_;
+
+  // Dense route from nav_goal_loc_ through the remaining waypoints, planned on the static map.
+  // Legs before route_start_, the index of nav_goal_loc_, have already been driven.
+  std::vector<Eigen::Vector2f> route_path_;
+  // Cumulative path length along route_path_
+  std::vector<float> route_distance_;
+  size_t route_start_ = 0;
+  // Index of the route_path_ point used as the carrot, advanced incrementally
+  size_t route_carrot_index_ = 0;
+  // Remaining waypoints after nav_goal_loc_, as route_path_ indices and goal angles
+  std::deque< std::pair<size_t, float> > route_waypoints_;
+  // Scratch buffer for planning a new leg
+  std::vector<Eigen::Vector2f> route_leg_;
+  // Distance at which intermediate waypoints count as reached
+  float const waypoint_switch_distance_ = 0.5; // m
   
   // Run function call rate
   float const time_step_ = 1.0/20; // s
+
+  // MPPI controller, and the local cost map it is scored against
+  MPPIController mppi_;
+  float const mppi_cost_map_half_extent_ = 4.0; // m
+  float const mppi_cost_map_resolution_ = 0.05; // m
+  float const mppi_cost_map_max_distance_ = 1.0; // m
+
+  // Dynamic window planner samples, weights and horizon over which progress is measured
+  int const dynamic_window_curvature_samples_ = 101;
+  int const dynamic_window_velocity_samples_ = 31;
+  float const dynamic_window_horizon_ = 1.0; // s
+  float const dynamic_window_progress_weight_ = 1.0;
+  float const dynamic_window_clearance_weight_ = 0.5;
+  float const dynamic_window_velocity_weight_ = 0.2;
+  // Latest curvatures evaluated for the dynamic window planner
+  std::vector<PathOption> dynamic_window_options_;
+
+  // Copy of the latest scan being evaluated, in the predicted frame
+  std::vector<Eigen::Vector2f> predicted_point_cloud_;
+  // Swept volume grid cells of the points of the scan being evaluated
+  std::vector<int> point_cells_;
+  // Global planner obstacles in the map frame, reused every cycle
+  std::vector<Eigen::Vector2f> planner_obstacles_;
+  // Latest scan, from ObservePointCloud to the scan worker
+  TripleBuffer<Scan> scans_;
+  // Latest evaluated path options, from the scan worker to Run
+  TripleBuffer<ScanEvaluation> scan_evaluations_;
+  // How long the scan worker sleeps when there is no new scan
+  double const scan_worker_poll_period_ = 1e-3; // s
+  std::atomic<bool> scan_worker_running_;
+  std::thread scan_worker_;
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
   ////HELMS DEEP ADDITIONS////
@@ -42,18 +42,25 @@
 #include "visualization_msgs/MarkerArray.h"
 #include "nav_msgs/Odometry.h"
 #include "ros/ros.h"
+#include "config_reader/config_reader.h"
 #include "shared/math/math_util.h"
+#include "shared/ros/profile_publisher.h"
+#include "shared/util/profiler.h"
 #include "shared/util/timer.h"
 #include "shared/ros/ros_helpers.h"
 
 #include "navigation.h"
+#include "amrl_msgs/AckermannCurvatureDriveMsg.h"
 #include "amrl_msgs/VisualizationMsg.h"
+#include "visualization/visualization.h"
 
 //Helms Deep Additions
 
 using math_util::DegToRad;
 using math_util::RadToDeg;
 using navigation::Navigation;
+using navigation::NavigationSink;
+using navigation::VisualizationFrame;
 using ros::Time;
 using ros_helpers::Eigen3DToRosPoint;
 using ros_helpers::Eigen2DToRosPoint;
@@ -62,6 +69,7 @@ using ros_helpers::SetRosVector;
 using std::string;
 using std::vector;
 using Eigen::Vector2f;
+using amrl_msgs::AckermannCurvatureDriveMsg;
 using amrl_msgs::VisualizationMsg;
 using amrl_msgs::Localization2DMsg;
 
@@ -73,6 +81,65 @@ DEFINE_string(init_topic,
               "initialpose",
               "Name of ROS topic for initialization");
 DEFINE_string(map, "maps/GDC1.txt", "Name of vector map file");
+DEFINE_string(profile_output, "",
+              "File to periodically write the scoped profile to, if not empty");
+DEFINE_string(profile_topic, "",
+              "ROS topic to periodically publish the scoped profile on, if "
+              "not empty");
+DEFINE_double(profile_period, 5.0, "Seconds between scoped profile dumps");
+
+// Publishes the outputs of Navigation as ROS messages.
+class RosNavigationSink : public NavigationSink {
+ public:
+  explicit RosNavigationSink(ros::NodeHandle* n) {
+    drive_pub_ = n->advertise<AckermannCurvatureDriveMsg>(
+        "ackermann_curvature_drive", 1);
+    viz_pub_ = n->advertise<VisualizationMsg>("visualization", 1);
+    local_viz_msg_ = visualization::NewVisualizationMessage(
+        "base_link", "navigation_local");
+    global_viz_msg_ = visualization::NewVisualizationMessage(
+        "map", "navigation_global");
+    ros_helpers::InitRosHeader("base_link", &drive_msg_.header);
+  }
+
+  void DriveCommand(double time, float velocity, float curvature) override {
+    drive_msg_.header.stamp = ros::Time(time);
+    drive_msg_.velocity = velocity;
+    drive_msg_.curvature = curvature;
+    drive_pub_.publish(drive_msg_);
+  }
+
+  void DrawLine(const Vector2f& p0,
+                const Vector2f& p1,
+                uint32_t color,
+                VisualizationFrame frame) override {
+    visualization::DrawLine(p0, p1, color, Msg(frame));
+  }
+
+  void DrawPathOption(float curvature,
+                      float distance,
+                      float clearance) override {
+    visualization::DrawPathOption(curvature, distance, clearance,
+                                  local_viz_msg_);
+  }
+
+  void PublishVisualization(VisualizationFrame frame) override {
+    viz_pub_.publish(Msg(frame));
+    visualization::ClearVisualizationMsg(Msg(frame));
+  }
+
+ private:
+  VisualizationMsg& Msg(VisualizationFrame frame) {
+    return (frame == VisualizationFrame::kGlobal) ?
+        global_viz_msg_ : local_viz_msg_;
+  }
+
+  ros::Publisher drive_pub_;
+  ros::Publisher viz_pub_;
+  VisualizationMsg local_viz_msg_;
+  VisualizationMsg global_viz_msg_;
+  AckermannCurvatureDriveMsg drive_msg_;
+};
 
 bool run_ = true;
 sensor_msgs::LaserScan last_laser_msg_;
@@ -131,6 +198,14 @@ void GoToCallback(const geometry_msgs::PoseStamped& msg) {
   navigation_->SetNavGoal(loc, angle);
 }
 
+void WaypointCallback(const geometry_msgs::PoseStamped& msg) {
+  const Vector2f loc(msg.pose.position.x, msg.pose.position.y);
+  const float angle =
+      2.0 * atan2(msg.pose.orientation.z, msg.pose.orientation.w);
+  printf("Waypoint: (%f,%f) %f\u00b0\n", loc.x(), loc.y(), angle);
+  navigation_->AddWaypoint(loc, angle);
+}
+
 void SignalHandler(int) {
   if (!run_) {
     printf("Force Exit.\n");
@@ -153,7 +228,15 @@ int main(int argc, char** argv) {
   // Initialize ROS.
   ros::init(argc, argv, "navigation", ros::init_options::NoSigintHandler);
   ros::NodeHandle n;
-  navigation_ = new Navigation(FLAGS_map, &n);
+  RosNavigationSink sink(&n);
+  navigation_ = new Navigation(FLAGS_map, &sink, []() {
+    return ros::Time::now().toSec();
+  });
+  if (!FLAGS_profile_output.empty()) {
+    profiler::StartPeriodicDump(FLAGS_profile_output, FLAGS_profile_period);
+  }
+  ros_helpers::ProfilePublisher profile_publisher(
+      &n, FLAGS_profile_topic, FLAGS_profile_period);
 
   ros::Subscriber velocity_sub =
       n.subscribe(FLAGS_odom_topic, 1, &OdometryCallback);
@@ -163,13 +246,18 @@ int main(int argc, char** argv) {
       n.subscribe(FLAGS_laser_topic, 1, &LaserCallback);
   ros::Subscriber goto_sub =
       n.subscribe("/move_base_simple/goal", 1, &GoToCallback);
+  ros::Subscriber waypoint_sub =
+      n.subscribe("/navigation/waypoint", 10, &WaypointCallback);
 
   RateLoop loop(20.0);
   while (run_ && ros::ok()) {
+    // Config changes take effect between cycles.
+    config_reader::Update();
     ros::spinOnce();
     navigation_->Run();
     loop.Sleep();
   }
+  profiler::StopPeriodicDump();
   delete navigation_;
   return 0;
 }
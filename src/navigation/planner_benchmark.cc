@@ -0,0 +1,182 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    planner_benchmark.cc
+\brief   Compares per-cycle replanning cost of D* Lite against planning from
+         scratch, on the GDC maps. Does not need ROS.
+*/
+//========================================================================
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+#include "shared/util/random.h"
+#include "shared/util/timer.h"
+#include "vector_map/vector_map.h"
+
+#include "dstar_lite.h"
+#include "global_planner.h"
+
+using Eigen::Vector2f;
+using navigation::DStarLite;
+using std::string;
+using std::vector;
+
+DEFINE_string(maps,
+              "maps/GDC1.txt,maps/GDC2.txt,maps/GDC3.txt",
+              "Comma-separated list of vector map files to benchmark on");
+DEFINE_int32(trials, 10, "Number of start/goal pairs per map");
+DEFINE_int32(cycles, 200, "Maximum number of control cycles per trial");
+DEFINE_double(speed, 1.0, "Robot speed along the path, in m/s");
+DEFINE_double(resolution, 0.1, "Planner lattice resolution, in meters");
+DEFINE_double(inflation, 0.25, "Obstacle inflation radius, in meters");
+
+namespace {
+// Control loop period, matching Navigation::Run.
+const float kTimeStep = 1.0 / 20.0;
+// An obstacle appears across the path this far ahead of the robot...
+const float kObstacleDistance = 3.0;
+// ...at this control cycle.
+const int kObstacleCycle = 20;
+
+struct Stats {
+  Stats() : total(0), max(0), count(0) {}
+  void Add(double t) {
+    total += t;
+    max = std::max(max, t);
+    ++count;
+  }
+  double Mean() const { return (count > 0) ? total / count : 0; }
+  double total;
+  double max;
+  int count;
+};
+
+// A short wall of points across the path, centred on loc.
+vector<Vector2f> MakeObstacle(const Vector2f& loc, const Vector2f& dir) {
+  const Vector2f normal(-dir.y(), dir.x());
+  vector<Vector2f> points;
+  for (float s = -0.4; s <= 0.4; s += 0.05) {
+    points.push_back(loc + s * normal);
+  }
+  return points;
+}
+
+// Point on the path at the specified arc length from its start.
+Vector2f PointAlongPath(const vector<Vector2f>& path, float distance) {
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    const float l = (path[i + 1] - path[i]).norm();
+    if (distance <= l) {
+      return path[i] + (distance / l) * (path[i + 1] - path[i]);
+    }
+    distance -= l;
+  }
+  return path.back();
+}
+
+void BenchmarkMap(const string& map_file, util_random::Random* rng) {
+  const vector_map::VectorMap map(map_file);
+  double t_start = GetMonotonicTime();
+  DStarLite incremental(map, FLAGS_resolution, FLAGS_inflation);
+  const double t_build = GetMonotonicTime() - t_start;
+  DStarLite scratch(map, FLAGS_resolution, FLAGS_inflation);
+
+  Stats astar, scratch_dstar, initial_dstar, repair_dstar;
+  vector<Vector2f> path, scratch_path;
+  const Vector2f lo = map.lines.empty() ? Vector2f(0, 0) : map.lines[0].p0;
+  Vector2f min_corner = lo, max_corner = lo;
+  for (const auto& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+
+  int trials = 0;
+  for (int attempt = 0; trials < FLAGS_trials && attempt < 100 * FLAGS_trials;
+       ++attempt) {
+    const Vector2f start(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                         rng->UniformRandom(min_corner.y(), max_corner.y()));
+    const Vector2f goal(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                        rng->UniformRandom(min_corner.y(), max_corner.y()));
+    if (!incremental.IsFree(start) || !incremental.IsFree(goal)) continue;
+    if ((start - goal).norm() < 10.0) continue;
+    if (!incremental.Plan(start, goal, &path)) continue;
+    ++trials;
+
+    incremental.SetObstacles(vector<Vector2f>());
+    incremental.SetGoal(start, goal);
+    t_start = GetMonotonicTime();
+    incremental.Replan(start, &path);
+    initial_dstar.Add(GetMonotonicTime() - t_start);
+
+    vector<Vector2f> obstacle;
+    Vector2f robot = start;
+    for (int cycle = 0; cycle < FLAGS_cycles && path.size() > 1; ++cycle) {
+      robot = PointAlongPath(path, FLAGS_speed * kTimeStep);
+      if (cycle == kObstacleCycle) {
+        const Vector2f ahead = PointAlongPath(path, kObstacleDistance);
+        const Vector2f dir = (ahead - robot).normalized();
+        obstacle = MakeObstacle(ahead, dir);
+      }
+
+      t_start = GetMonotonicTime();
+      incremental.SetObstacles(obstacle);
+      const bool found = incremental.Replan(robot, &path);
+      repair_dstar.Add(GetMonotonicTime() - t_start);
+
+      t_start = GetMonotonicTime();
+      scratch.SetObstacles(obstacle);
+      scratch.SetGoal(robot, goal);
+      scratch.Replan(robot, &scratch_path);
+      scratch_dstar.Add(GetMonotonicTime() - t_start);
+
+      t_start = GetMonotonicTime();
+      scratch.Plan(robot, goal, &scratch_path);
+      astar.Add(GetMonotonicTime() - t_start);
+
+      if (!found) break;
+    }
+  }
+
+  printf("%s: %dx%d lattice built in %.1f ms, %d trials, %d cycles\n",
+         map_file.c_str(), incremental.Width(), incremental.Height(),
+         1e3 * t_build, trials, repair_dstar.count);
+  printf("  %-28s mean %8.3f ms  max %8.3f ms\n", "A* from scratch",
+         1e3 * astar.Mean(), 1e3 * astar.max);
+  printf("  %-28s mean %8.3f ms  max %8.3f ms\n", "D* Lite from scratch",
+         1e3 * scratch_dstar.Mean(), 1e3 * scratch_dstar.max);
+  printf("  %-28s mean %8.3f ms  max %8.3f ms\n", "D* Lite initial search",
+         1e3 * initial_dstar.Mean(), 1e3 * initial_dstar.max);
+  printf("  %-28s mean %8.3f ms  max %8.3f ms\n", "D* Lite per-cycle repair",
+         1e3 * repair_dstar.Mean(), 1e3 * repair_dstar.max);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  util_random::Random rng(1);
+  std::stringstream maps(FLAGS_maps);
+  string map_file;
+  while (std::getline(maps, map_file, ',')) {
+    BenchmarkMap(map_file, &rng);
+  }
+  return 0;
+}
@@ -18,51 +18,55 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <algorithm>
-#include <deque>
+#include <functional>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #ifndef MUTABLE_QUEUE
 #define MUTABLE_QUEUE
 
-using std::deque;
 using std::pair;
 using std::make_pair;
 
-template<class Value, class Priority>
+// Priority queue with updatable priorities. Values are kept in an implicit
+// 4-ary max-heap, and a hash index maps each value to its slot in the heap, so
+// that Push (insert or priority update) and Pop are O(log n), and Exists is
+// O(1). Values must be hashable with Hash and comparable with ==.
+template<class Value, class Priority, class Hash = std::hash<Value> >
 class SimpleQueue {
  private:
+  // Arity of the heap. A wider heap is shallower, which makes sifting up
+  // cheaper and keeps the children of a node on the same cache lines.
+  static const size_t kArity = 4;
+
   public:
   // Insert a new value, with the specified priority. If the value
   // already exists, its priority is updated.
   void Push(const Value& v, const Priority& p) {
-    for (auto& x : values_) {
-      // If the value already exists, update its priority, re-sort the priority
-      // queue, and return.
-      if (x.first == v) {
-        x.second = p;
-        Sort();
-        return;
-      }
-    }
-    // Find where this value should go, and insert it there.
-    for (size_t i = 0; i < values_.size(); ++i) {
-      if (values_[i].second > p) {
-        values_.insert(values_.begin() + i, make_pair(v, p));
-        return;
+    const auto it = index_.find(v);
+    if (it != index_.end()) {
+      const size_t i = it->second;
+      const bool increased = values_[i].second < p;
+      values_[i].second = p;
+      if (increased) {
+        SiftUp(i);
+      } else {
+        SiftDown(i);
       }
+      return;
     }
-    values_.insert(values_.end(), make_pair(v, p));
+    values_.push_back(make_pair(v, p));
+    index_[v] = values_.size() - 1;
+    SiftUp(values_.size() - 1);
   }
 
-  // Sorts the priorities.
-  void Sort() {
-    static const auto comparator = 
-        [](const pair<Value, Priority>& v1, const pair<Value, Priority>& v2) {
-      return (v1.second < v2.second);
-    };
-    sort(values_.begin(), values_.end(), comparator);
-  }
+  // The heap is always ordered; retained for interface compatibility.
+  void Sort() {}
 
   // Retreive the value with the highest priority.
   Value Pop() {
@@ -70,9 +74,16 @@ class SimpleQueue {
       fprintf(stderr, "ERROR: Pop() called on an empty queue!\n");
       exit(1);
     }
-    Sort();
-    const Value v = values_.back().first;
-    values_.resize(values_.size() - 1);
+    const Value v = values_.front().first;
+    index_.erase(v);
+    if (values_.size() > 1) {
+      values_.front() = values_.back();
+      values_.pop_back();
+      index_[values_.front().first] = 0;
+      SiftDown(0);
+    } else {
+      values_.pop_back();
+    }
     return v;
   }
 
@@ -83,14 +94,46 @@ class SimpleQueue {
 
   // Returns true iff the provided value is already on the queue.
   bool Exists(const Value& v) {
-    for (const auto& x : values_) {
-      if (x.first == v) return true;
-    }
-    return false;
+    return index_.find(v) != index_.end();
   }
 
   private:
-  deque<pair<Value, Priority> > values_;
+  // Move the element at slot i towards the root until its parent has a
+  // priority at least as high.
+  void SiftUp(size_t i) {
+    while (i > 0) {
+      const size_t parent = (i - 1) / kArity;
+      if (!(values_[parent].second < values_[i].second)) break;
+      Swap(i, parent);
+      i = parent;
+    }
+  }
+
+  // Move the element at slot i towards the leaves until none of its children
+  // has a higher priority.
+  void SiftDown(size_t i) {
+    while (true) {
+      const size_t first_child = kArity * i + 1;
+      if (first_child >= values_.size()) return;
+      const size_t last_child = std::min(first_child + kArity, values_.size());
+      size_t best = i;
+      for (size_t c = first_child; c < last_child; ++c) {
+        if (values_[best].second < values_[c].second) best = c;
+      }
+      if (best == i) return;
+      Swap(i, best);
+      i = best;
+    }
+  }
+
+  void Swap(size_t i, size_t j) {
+    std::swap(values_[i], values_[j]);
+    index_[values_[i].first] = i;
+    index_[values_[j].first] = j;
+  }
+
+  std::vector<pair<Value, Priority> > values_;
+  std::unordered_map<Value, size_t, Hash> index_;
 };
 
 #endif  // MUTABLE_QUEUE
@@ -0,0 +1,176 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    dstar_lite_tests.cc
+\brief   Checks incremental D* Lite repairs against replanning from scratch.
+         Loads the GDC maps, so it must run from the repository root.
+*/
+//========================================================================
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "shared/util/random.h"
+#include "vector_map/vector_map.h"
+
+#include "navigation/dstar_lite.h"
+
+using Eigen::Vector2f;
+using navigation::DStarLite;
+using std::string;
+using std::vector;
+
+namespace {
+
+const float kResolution = 0.1;
+const float kInflation = 0.25;
+// Random obstacle points per control cycle, scattered within this distance of
+// the robot along each axis.
+const int kNumObstaclePoints = 40;
+const float kObstacleRange = 5.0;
+// Distance the robot advances along its path per control cycle.
+const float kStepDistance = 0.3;
+const int kTrials = 10;
+const int kCycles = 15;
+
+// Point on the path at the specified arc length from its start.
+Vector2f PointAlongPath(const vector<Vector2f>& path, float distance) {
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    const float l = (path[i + 1] - path[i]).norm();
+    if (distance <= l) {
+      return path[i] + (distance / l) * (path[i + 1] - path[i]);
+    }
+    distance -= l;
+  }
+  return path.back();
+}
+
+// Draws a start and goal at least 10 m apart that are connected on the map,
+// without observed obstacles. Returns false if none was found.
+bool RandomStartAndGoal(const vector_map::VectorMap& map,
+                        DStarLite* planner,
+                        util_random::Random* rng,
+                        Vector2f* start,
+                        Vector2f* goal) {
+  if (map.lines.empty()) return false;
+  Vector2f min_corner = map.lines[0].p0, max_corner = map.lines[0].p0;
+  for (const auto& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  vector<Vector2f> path;
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    *start = Vector2f(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                      rng->UniformRandom(min_corner.y(), max_corner.y()));
+    *goal = Vector2f(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                     rng->UniformRandom(min_corner.y(), max_corner.y()));
+    if (!planner->IsFree(*start) || !planner->IsFree(*goal)) continue;
+    if ((*start - *goal).norm() < 10.0) continue;
+    if (planner->Plan(*start, *goal, &path)) return true;
+  }
+  return false;
+}
+
+// Drives a robot along the incrementally repaired path through randomly
+// changing obstacles, and checks every repair against a search from scratch
+// with the same obstacles.
+void CompareWithScratch(const string& map_file, unsigned long seed) {
+  const vector_map::VectorMap map(map_file);
+  DStarLite incremental(map, kResolution, kInflation);
+  DStarLite scratch(map, kResolution, kInflation);
+  util_random::Random rng(seed);
+
+  int replans = 0;
+  vector<Vector2f> path, scratch_path, obstacles;
+  for (int trial = 0; trial < kTrials; ++trial) {
+    Vector2f start, goal;
+    ASSERT_TRUE(RandomStartAndGoal(map, &incremental, &rng, &start, &goal))
+        << map_file;
+    incremental.SetObstacles(vector<Vector2f>());
+    ASSERT_TRUE(incremental.SetGoal(start, goal));
+    Vector2f robot = start;
+    for (int cycle = 0; cycle < kCycles; ++cycle) {
+      obstacles.clear();
+      for (int i = 0; i < kNumObstaclePoints; ++i) {
+        obstacles.push_back(
+            robot +
+            Vector2f(rng.UniformRandom(-kObstacleRange, kObstacleRange),
+                     rng.UniformRandom(-kObstacleRange, kObstacleRange)));
+      }
+      incremental.SetObstacles(obstacles);
+      const bool found = incremental.Replan(robot, &path);
+      scratch.SetObstacles(obstacles);
+      scratch.SetGoal(robot, goal);
+      const bool scratch_found = scratch.Replan(robot, &scratch_path);
+      ++replans;
+
+      ASSERT_EQ(scratch_found, found)
+          << map_file << " trial " << trial << " cycle " << cycle;
+      if (!found) break;
+      EXPECT_NEAR(scratch.PathCost(), incremental.PathCost(), 1e-3)
+          << map_file << " trial " << trial << " cycle " << cycle;
+      EXPECT_EQ(goal, path.back());
+      robot = PointAlongPath(path, kStepDistance);
+    }
+  }
+  EXPECT_GT(replans, kTrials) << map_file;
+}
+
+TEST(DStarLiteTest, RepairMatchesScratchGDC1) {
+  CompareWithScratch("maps/GDC1.txt", 1);
+}
+
+TEST(DStarLiteTest, RepairMatchesScratchGDC3) {
+  CompareWithScratch("maps/GDC3.txt", 2);
+}
+
+// Walling the robot in makes the goal unreachable, and removing the wall must
+// restore the path found from scratch.
+TEST(DStarLiteTest, WalledInAndReleased) {
+  const vector_map::VectorMap map("maps/GDC1.txt");
+  DStarLite incremental(map, kResolution, kInflation);
+  DStarLite scratch(map, kResolution, kInflation);
+  util_random::Random rng(3);
+  Vector2f start, goal;
+  ASSERT_TRUE(RandomStartAndGoal(map, &incremental, &rng, &start, &goal));
+
+  vector<Vector2f> path;
+  ASSERT_TRUE(incremental.SetGoal(start, goal));
+  ASSERT_TRUE(incremental.Replan(start, &path));
+  const float cost = incremental.PathCost();
+
+  // A closed ring of obstacle points 1 m around the robot.
+  vector<Vector2f> wall;
+  for (float a = 0; a < 2.0 * M_PI; a += 0.05) {
+    wall.push_back(start + Vector2f(cos(a), sin(a)));
+  }
+  incremental.SetObstacles(wall);
+  EXPECT_FALSE(incremental.Replan(start, &path));
+  EXPECT_TRUE(isinf(incremental.PathCost()));
+
+  incremental.SetObstacles(vector<Vector2f>());
+  ASSERT_TRUE(incremental.Replan(start, &path));
+  EXPECT_NEAR(cost, incremental.PathCost(), 1e-3);
+  scratch.SetGoal(start, goal);
+  ASSERT_TRUE(scratch.Replan(start, &path));
+  EXPECT_NEAR(scratch.PathCost(), incremental.PathCost(), 1e-3);
+}
+
+}  // namespace
@@ -19,9 +19,12 @@
 */
 //========================================================================
 
+#include <string.h>
+
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 #include "gflags/gflags.h"
@@ -29,6 +32,8 @@
 #include "shared/math/geometry.h"
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
+#include "shared/util/profiler.h"
+#include "shared/util/thread_pool.h"
 #include "shared/util/timer.h"
 
 
@@ -51,8 +56,83 @@ DEFINE_double(num_particles, 50, "Number of particles");
 
 namespace particle_filter {
 
+// Measurement model: "ray_cast" or "likelihood_field"
+CONFIG_STRING(observation_model_, "observation_model");
+// Beam selection: "uniform" or "informative"
+CONFIG_STRING(beam_selection_, "beam_selection");
+CONFIG_INT(num_beams_, "num_beams");
+// CPU time for one measurement update, summed over all threads, or 0 to always use num_beams
+CONFIG_DOUBLE(beam_time_budget_, "beam_time_budget");
+// Time from when a scan was taken by which its update has to finish, or 0 to evaluate every particle
+CONFIG_DOUBLE(laser_update_deadline_, "laser_update_deadline");
+// Pose estimate: "mean" of all particles, or of the densest "cluster"
+CONFIG_STRING(pose_estimate_, "pose_estimate");
+// Translation process noise variance
+CONFIG_FLOAT(Q_tt_, "Q_tt");
+// Correlation between laser beams, applied as an exponent on p_z_x
+CONFIG_FLOAT(gamma_, "gamma");
 config_reader::ConfigReader config_reader_({"config/particle_filter.lua"});
 
+// Particles evaluated per thread between checks of the update deadline
+const size_t kDeadlineBatchPerThread = 2;
+
+namespace {
+
+// Grid cell of a pose, cell_size wide in position and one of angle_bins in angle
+void PoseCell( const Particle& p, float cell_size, int angle_bins, int* x, int* y, int* a )
+{
+  *x = static_cast<int>( floor( p.loc.x()/cell_size ) );
+  *y = static_cast<int>( floor( p.loc.y()/cell_size ) );
+  const float angle = math_util::AngleMod( p.angle ) + M_PI;
+  *a = std::min( angle_bins - 1, static_cast<int>( angle*angle_bins/(2.0*M_PI) ) );
+}
+
+// Integer coordinates of a grid cell packed into one key
+int64_t CellKey( int x, int y, int a )
+{
+  return ( static_cast<int64_t>( x & 0xFFFFFF ) << 32 ) | ( static_cast<int64_t>( y & 0xFFFFFF ) << 8 ) | a;
+}
+
+// e^x for x <= 709, or 0 from x = -708 down, where it would be denormal. It is accurate to about one double ulp,
+// and has no calls or branches, unlike exp(), so loops over it vectorize. The polynomials are those of the Cephes
+// library.
+inline double Exp( double x )
+{
+  // Underflow is found from the high word of x, since floating point comparisons are not if-converted, as they
+  // may trap, and SSE2 has no 64 bit integer comparisons. It masks the bits of x and of the result.
+  int64_t x_bits;
+  memcpy( &x_bits, &x, sizeof( x_bits ) );
+  const int32_t high = static_cast<int32_t>( static_cast<uint64_t>( x_bits ) >> 32 );
+  const int64_t underflow = -static_cast<int64_t>( ( high < 0 ) & ( ( high & 0x7FFFFFFF ) >= 0x40862000 ) );
+  const int64_t clamped_bits = ( x_bits & ~underflow ) | ( static_cast<int64_t>( 0xC086200000000000 ) & underflow );
+  double clamped;
+  memcpy( &clamped, &clamped_bits, sizeof( clamped ) );
+  // Adding 1.5*2^52 rounds x/ln(2) to the nearest integer n, which ends up in the low bits of the sum
+  const double kRound = 6755399441055744.0;
+  const double shifted = clamped*1.4426950408889634 + kRound;
+  const double n = shifted - kRound;
+  int64_t n_bits;
+  memcpy( &n_bits, &shifted, sizeof( n_bits ) );
+  const int64_t scale_bits = ( n_bits - 0x4338000000000000 + 1023 ) << 52;
+  double scale;
+  memcpy( &scale, &scale_bits, sizeof( scale ) );
+  // e^x = 2^n e^r, with |r| <= ln(2)/2
+  const double r = clamped - n*6.93145751953125e-1 - n*1.42860682030941723212e-6;
+  const double r2 = r*r;
+  const double p = r*( ( 1.26177193074810590878e-4*r2 + 3.02994407707441961300e-2 )*r2 + 9.99999999999999999910e-1 );
+  const double q = ( ( 3.00198505138664455042e-6*r2 + 2.52448340349684104192e-3 )*r2 + 2.27265548208155028766e-1 )*r2 +
+                   2.00000000000000000009e0;
+  const double e = scale*( 1.0 + 2.0*p/( q - p ) );
+  int64_t e_bits;
+  memcpy( &e_bits, &e, sizeof( e_bits ) );
+  e_bits &= ~underflow;
+  double result;
+  memcpy( &result, &e_bits, sizeof( result ) );
+  return result;
+}
+
+}  // namespace
+
 ParticleFilter::ParticleFilter() :
     prev_odom_loc_(0, 0),
     prev_odom_angle_(0),
@@ -119,7 +199,7 @@ void ParticleFilter::GetPredictedPointCloud(const Vector2f& loc,
   vector<Vector2f>& scan = *scan_ptr;
   scan.resize(num_ranges);
 
-  int const step_size = scan.size()/num_beams_;
+  int const step_size = std::max<int>( 1, scan.size()/CONFIG_num_beams_ );
   for( size_t i = 0; i <scan.size(); i += step_size ) 
   { 
     float const laser_angle = angle_min + i*(angle_max - angle_min)/num_ranges;
@@ -156,6 +236,7 @@ void ParticleFilter::Update(const vector<float>& ranges,
                             float angle_min,
                             float angle_max,
                             vector<Particle> *particle_set_ptr) {
+  PROFILE_FUNCTION();
   
   if( !particle_set_ptr )
   {
@@ -164,41 +245,240 @@ void ParticleFilter::Update(const vector<float>& ranges,
   }
 
   vector<Particle>& particle_set = *particle_set_ptr;
-  double max_weight = 0.0;
-  for(auto& p: particle_set)
-  {    
-    // Now we are in log land after this 
-    p.weight = log( p.weight ) + log( MeasurementLikelihood( p, 
-                                                             ranges,
-                                                             gamma_, 
-                                                             num_beams_, 
-                                                             range_min,
-                                                             range_max,
-                                                             angle_min,
-                                                             angle_max) );  
-
-    if( p.weight>max_weight )
+  SelectBeams( ranges, range_min, range_max, angle_min, angle_max, BeamCount( particle_set.size() ), &beams_ );
+  // The beam budget is in CPU time, summed over the thread pool workers, while the deadline is in wall time
+  const double cpu_start = GetProcessCpuTime();
+  const bool likelihood_field = UseLikelihoodField();
+  if( likelihood_field )
+  {
+    // The beam endpoints are the same in base_link for every particle
+    GetObservedPoints( ranges, beams_, range_min, range_max, angle_min, angle_max, &observed_points_ );
+  }
+
+  // Evaluate the most likely particles first, so that running out of time only leaves out the least
+  // important ones. At least one particle is always evaluated.
+  const size_t num_particles = particle_set.size();
+  update_order_.resize( num_particles );
+  for( size_t i = 0; i < num_particles; ++i ) update_order_[i] = i;
+  if( update_deadline_ > 0 )
+  {
+    std::sort( update_order_.begin(), update_order_.end(), [&particle_set]( size_t a, size_t b ) {
+      return particle_set[a].weight > particle_set[b].weight;
+    });
+  }
+  log_likelihoods_.resize( num_particles );
+  // Particles are evaluated in parallel, in batches of a few per thread when there is a deadline, which is
+  // checked between batches
+  ThreadPool& pool = ThreadPool::Default();
+  const size_t batch_size = ( update_deadline_ > 0 ) ? kDeadlineBatchPerThread*pool.NumThreads() : num_particles;
+  size_t num_evaluated = 0;
+  while( num_evaluated < num_particles )
+  {
+    if( num_evaluated > 0 && update_deadline_ > 0 && GetMonotonicTime() > update_deadline_ ) break;
+    const size_t batch_end = std::min( num_particles, num_evaluated + batch_size );
+    pool.ParallelFor( num_evaluated, batch_end, 1, [&]( size_t k ) {
+      const size_t i = update_order_[k];
+      const Particle& p = particle_set[i];
+      log_likelihoods_[i] = likelihood_field ?
+          LikelihoodFieldLogLikelihood( p, observed_points_ ) :
+          MeasurementLogLikelihood( p, ranges, CONFIG_gamma_, beams_, range_min, range_max, angle_min, angle_max );
+    });
+    num_evaluated = batch_end;
+  }
+  const double evaluation_cpu_time = GetProcessCpuTime() - cpu_start;
+  if( num_evaluated < num_particles )
+  {
+    InterpolateLogLikelihoods( particle_set, num_evaluated );
+    ++anytime_stats_.deadline_hits;
+  }
+  ++anytime_stats_.scans;
+  anytime_stats_.evaluated_particles += num_evaluated;
+  anytime_stats_.interpolated_particles += num_particles - num_evaluated;
+
+  // Now we are in log land. The max and the sum of the log weights relative to it are tracked in the same
+  // pass (streaming log-sum-exp), so the weights are normalized without ever leaving log land.
+  log_weights_.resize( num_particles );
+  double max_log_weight = -std::numeric_limits<double>::infinity();
+  double relative_sum = 0.0;
+  for( size_t i = 0; i < num_particles; ++i )
+  {
+    const double log_weight = log( particle_set[i].weight ) + log_likelihoods_[i];
+    log_weights_[i] = log_weight;
+
+    if( log_weight == -std::numeric_limits<double>::infinity() ) continue;
+    if( log_weight > max_log_weight )
     {
-      max_weight = p.weight;
+      relative_sum = relative_sum*exp( max_log_weight - log_weight ) + 1.0;
+      max_log_weight = log_weight;
+    }
+    else
+    {
+      relative_sum += exp( log_weight - max_log_weight );
     }
   }
 
   // After this executes we are out of log land
-  logLikelihoodReweight( max_weight, &particles_ ); 
+  logLikelihoodReweight( max_log_weight + log( relative_sum ), &particle_set );
+
+  if( num_evaluated > 0 && !beams_.empty() )
+  {
+    const double time_per_beam = evaluation_cpu_time/(num_evaluated*beams_.size());
+    time_per_beam_ = (time_per_beam_ > 0) ? 0.8*time_per_beam_ + 0.2*time_per_beam : time_per_beam;
+  }
   
   return;
 }
 
+void ParticleFilter::InterpolateLogLikelihoods( const vector<Particle>& particle_set, size_t num_evaluated )
+{
+  PROFILE_FUNCTION();
+  // The evaluated particles are pooled into grid cells, and each of the others is interpolated from the cells
+  // around its own, so that this takes linear time however many particles were left out
+  interpolation_index_.clear();
+  interpolation_cells_.clear();
+  double min_log_likelihood = std::numeric_limits<double>::infinity();
+  int x, y, a;
+  for( size_t j = 0; j < num_evaluated; ++j )
+  {
+    const size_t e = update_order_[j];
+    const Particle& q = particle_set[e];
+    PoseCell( q, interpolation_cell_size_, interpolation_angle_bins_, &x, &y, &a );
+    const auto inserted = interpolation_index_.insert( std::make_pair( CellKey( x, y, a ), interpolation_cells_.size() ) );
+    if( inserted.second ) interpolation_cells_.push_back( InterpolationCell() );
+    InterpolationCell& cell = interpolation_cells_[inserted.first->second];
+    ++cell.count;
+    cell.log_likelihood += log_likelihoods_[e];
+    cell.loc += q.loc;
+    cell.cos_angle += cos( q.angle );
+    cell.sin_angle += sin( q.angle );
+    min_log_likelihood = std::min( min_log_likelihood, log_likelihoods_[e] );
+  }
+  for( auto& cell: interpolation_cells_ )
+  {
+    cell.log_likelihood /= cell.count;
+    cell.loc /= cell.count;
+    cell.angle = atan2( cell.sin_angle, cell.cos_angle );
+  }
+
+  // Inverse distance weighting of the mean poses of the neighbouring cells, each counting for the particles in it
+  float const angle_scale = interpolation_angle_scale_;
+  for( size_t k = num_evaluated; k < update_order_.size(); ++k )
+  {
+    const size_t i = update_order_[k];
+    const Particle& p = particle_set[i];
+    PoseCell( p, interpolation_cell_size_, interpolation_angle_bins_, &x, &y, &a );
+    double weighted_sum = 0.0;
+    double weight_sum = 0.0;
+    for( int dy = -1; dy <= 1; ++dy )
+    {
+      for( int dx = -1; dx <= 1; ++dx )
+      {
+        for( int da = -1; da <= 1; ++da )
+        {
+          const int na = ( a + da + interpolation_angle_bins_ ) % interpolation_angle_bins_;
+          const auto it = interpolation_index_.find( CellKey( x + dx, y + dy, na ) );
+          if( it == interpolation_index_.end() ) continue;
+          const InterpolationCell& cell = interpolation_cells_[it->second];
+          const float angle_diff = angle_scale*math_util::AngleDiff( p.angle, cell.angle );
+          const double weight = cell.count/( (p.loc - cell.loc).squaredNorm() + angle_diff*angle_diff + 1e-6 );
+          weighted_sum += weight*cell.log_likelihood;
+          weight_sum += weight;
+        }
+      }
+    }
+    // A particle far from all the evaluated ones, which are the most likely, gets the least likelihood among them
+    log_likelihoods_[i] = ( weight_sum > 0 ) ? weighted_sum/weight_sum : min_log_likelihood;
+  }
+  return;
+}
+
+int ParticleFilter::BeamCount( size_t num_particles ) const
+{
+  const int max_beams = std::max( 1, CONFIG_num_beams_ );
+  if( CONFIG_beam_time_budget_ <= 0 || time_per_beam_ <= 0 || num_particles == 0 ) return max_beams;
+
+  const double affordable = CONFIG_beam_time_budget_/(time_per_beam_*num_particles);
+  return std::max( std::min( min_beams_, max_beams ), static_cast<int>( std::min<double>( max_beams, affordable ) ) );
+}
+
+void ParticleFilter::SelectBeams( const vector<float>& ranges,
+                                  float range_min,
+                                  float range_max,
+                                  float angle_min,
+                                  float angle_max,
+                                  int num_beams,
+                                  vector<int>* beams_ptr )
+{
+  PROFILE_FUNCTION();
+  vector<int>& beams = *beams_ptr;
+  beams.clear();
+  if( ranges.empty() ) return;
+
+  if( CONFIG_beam_selection_ != "informative" )
+  {
+    int const step_size = std::max<int>( 1, ranges.size()/num_beams );
+    for( size_t i = 0; i < ranges.size(); i += step_size )
+    {
+      beams.push_back( i );
+    }
+    return;
+  }
+
+  // Informative: consider twice as many beams, dropping max range readings, which carry no endpoint, and
+  // readings that end away from any wall at the estimated pose, which are most likely people
+  EnsureDistanceField();
+  Vector2f const laser_link( 0.2, 0 );
+  Vector2f loc;
+  float angle;
+  GetLocation( &loc, &angle );
+  Eigen::Rotation2Df const rotation( angle );
+
+  candidate_beams_.clear();
+  dynamic_beams_.clear();
+  int num_dynamic = 0;
+  int const step_size = std::max<int>( 1, ranges.size()/(2*num_beams) );
+  for( size_t i = 0; i < ranges.size(); i += step_size )
+  {
+    if( ranges[i] <= range_min || ranges[i] >= range_max ) continue;
+    float const laser_angle = angle_min + i*(angle_max - angle_min)/ranges.size();
+    const Vector2f endpoint = loc + rotation*( laser_link + ranges[i]*Vector2f( cos(laser_angle), sin(laser_angle) ) );
+    const bool dynamic = distance_field_.Distance( endpoint ) > dynamic_obstacle_distance_;
+    candidate_beams_.push_back( i );
+    dynamic_beams_.push_back( dynamic );
+    num_dynamic += dynamic;
+  }
+
+  // When most of the scan disagrees with the map, the estimate is more likely wrong than the world full of
+  // people, so keep those beams to let the filter recover
+  const bool keep_dynamic = ( 2*num_dynamic > static_cast<int>( candidate_beams_.size() ) );
+  for( size_t i = 0; i < candidate_beams_.size(); ++i )
+  {
+    if( keep_dynamic || !dynamic_beams_[i] ) beams.push_back( candidate_beams_[i] );
+  }
+
+  // Thin out evenly to the requested count
+  if( static_cast<int>( beams.size() ) > num_beams )
+  {
+    for( int k = 0; k < num_beams; ++k )
+    {
+      beams[k] = beams[k*beams.size()/num_beams];
+    }
+    beams.resize( num_beams );
+  }
+  return;
+}
+
 
-double ParticleFilter::MeasurementLikelihood( const Particle& p, 
+double ParticleFilter::MeasurementLogLikelihood( const Particle& p, 
                                               const std::vector<float>& ranges, 
                                               const float& gamma, 
-                                              const float& beam_count, 
+                                              const std::vector<int>& beams, 
                                               const float& range_min,
                                               const float& range_max,
                                               const float& angle_min,
                                               const float& angle_max )
 {
+  PROFILE_FUNCTION();
   Vector2f const laser_position( p.loc[0] + .2, p.loc[1] );
 
   float const d_short = 0.5;
@@ -207,11 +487,10 @@ double ParticleFilter::MeasurementLikelihood( const Particle& p,
   float const s_max = 15.0;
   float const sigma_s = 0.75;
   
-  int const step_size = ranges.size()/beam_count;
-  double p_z_x = 1.0;
-  double p_z_x_i;
+  double log_p_z_x = 0.0;
+  double log_p_z_x_i;
   
-  for( size_t i = 0; i <ranges.size(); i += step_size )
+  for( const int i: beams )
   {
     const double predicted_range = ( GetPredictedPoint( p.loc,
                                                  p.angle,
@@ -225,32 +504,92 @@ double ParticleFilter::MeasurementLikelihood( const Particle& p,
     if( ranges[i] < s_min ||
         ranges[i] > s_max )
     {
-      p_z_x_i = 1.0;
+      log_p_z_x_i = 0.0;
     }
 
     else if( ranges[i]<predicted_range - d_short )
     {
-      p_z_x_i = exp( -0.5*d_short*d_short/(sigma_s*sigma_s) );
+      log_p_z_x_i = -0.5*d_short*d_short/(sigma_s*sigma_s);
     }
 
     else if( ranges[i]>predicted_range + d_short )
     {
-      p_z_x_i = exp( -0.5*d_long*d_long/(sigma_s*sigma_s) );
+      log_p_z_x_i = -0.5*d_long*d_long/(sigma_s*sigma_s);
     }
 
     else
     {
-      p_z_x_i = exp( -0.5*(ranges[i] - predicted_range)*(ranges[i] - predicted_range)/(sigma_s*sigma_s) );
+      log_p_z_x_i = -0.5*(ranges[i] - predicted_range)*(ranges[i] - predicted_range)/(sigma_s*sigma_s);
     }
 
-    p_z_x *= p_z_x_i;
+    log_p_z_x += log_p_z_x_i;
   }
 
-  return p_z_x;
+  return gamma*log_p_z_x;
 }
 
 
+bool ParticleFilter::UseLikelihoodField()
+{
+  if( CONFIG_observation_model_ != "likelihood_field" ) return false;
+  EnsureDistanceField();
+  return true;
+}
+
+void ParticleFilter::EnsureDistanceField()
+{
+  if( distance_field_.Empty() )
+  {
+    // Cached next to the map, since building it takes a while
+    distance_field_.LoadOrBuild( map_,
+                                 likelihood_field_resolution_,
+                                 likelihood_field_max_distance_,
+                                 map_.file_name + ".esdf" );
+  }
+  return;
+}
+
+void ParticleFilter::GetObservedPoints( const vector<float>& ranges,
+                                        const vector<int>& beams,
+                                        float range_min,
+                                        float range_max,
+                                        float angle_min,
+                                        float angle_max,
+                                        vector<Vector2f>* points_ptr ) const
+{
+  Vector2f const laser_link( 0.2, 0 );
+  vector<Vector2f>& points = *points_ptr;
+  points.clear();
+
+  for( const int i: beams )
+  {
+    // Max range readings did not hit anything to compare against
+    if( ranges[i] <= range_min || ranges[i] >= range_max ) continue;
+    float const laser_angle = angle_min + i*(angle_max - angle_min)/ranges.size();
+    points.push_back( laser_link + ranges[i]*Vector2f( cos(laser_angle), sin(laser_angle) ) );
+  }
+  return;
+}
+
+double ParticleFilter::LikelihoodFieldLogLikelihood( const Particle& p,
+                                                     const vector<Vector2f>& points ) const
+{
+  PROFILE_FUNCTION();
+  Eigen::Rotation2Df const rotation( p.angle );
+  float const max_distance = likelihood_field_max_distance_;
+  float const inv_variance = 1.0/(likelihood_field_sigma_*likelihood_field_sigma_);
+
+  double log_p_z_x = 0.0;
+  for( const auto& point: points )
+  {
+    float const d = std::min( max_distance, distance_field_.Distance( p.loc + rotation*point ) );
+    log_p_z_x -= 0.5*d*d*inv_variance;
+  }
+  return CONFIG_gamma_*log_p_z_x;
+}
+
 void ParticleFilter::Resample() {
+  PROFILE_FUNCTION();
   
   // Create a variable to store the new particles 
   vector <Particle> new_particle_set(FLAGS_num_particles);
@@ -262,7 +601,7 @@ void ParticleFilter::Resample() {
     weight_sum.push_back(weight_sum.back() + particle.weight);
   }
 
-  assert(weight_sum.back() == 1.0 );
+  assert( fabs( weight_sum.back() - 1.0 ) < 1e-6 );
   
   // Pick new particles from old particle set
   for( auto& new_particle: new_particle_set)
@@ -280,6 +619,13 @@ void ParticleFilter::Resample() {
 
   particles_ = move( new_particle_set );
 
+  PoseMoments moments;
+  for( const auto& particle: particles_ )
+  {
+    moments.Add( particle );
+  }
+  UpdatePoseEstimate( moments );
+
   return; 
 }
 
@@ -287,16 +633,21 @@ void ParticleFilter::ObserveLaser(const vector<float>& ranges,
                                   float range_min,
                                   float range_max,
                                   float angle_min,
-                                  float angle_max) {
+                                  float angle_max,
+                                  double scan_time) {
+  PROFILE_FUNCTION();
   // A new laser scan observation is available (in the laser frame)
   // Call the Update and Resample steps as necessary.
 
+  // The deadline counts from when the scan was taken, so time it spent queued is part of the budget
+  update_deadline_ = ( CONFIG_laser_update_deadline_ > 0 ) ? scan_time + CONFIG_laser_update_deadline_ : 0;
   Update( ranges,
           range_min,
           range_max,
           angle_min,
           angle_max,
           &particles_);
+  update_deadline_ = 0;
 
   if( isDegenerate() )
   {    
@@ -307,6 +658,7 @@ void ParticleFilter::ObserveLaser(const vector<float>& ranges,
 
 void ParticleFilter::ObserveOdometry(const Vector2f& odom_loc,
                                      const float odom_angle) {
+  PROFILE_FUNCTION();
   if( !odom_initialized_ )
   {
     prev_odom_loc_ = odom_loc;
@@ -320,19 +672,30 @@ void ParticleFilter::ObserveOdometry(const Vector2f& odom_loc,
   {
     Eigen::Rotation2D<float> base_link_rot( -prev_odom_angle_ );        // THIS HAS TO BE NEGATIVE :)
     Vector2f delta_T_bl = base_link_rot*( odom_loc - prev_odom_loc_ );  // delta_T_base_link: pres 6 slide 14
-    double const delta_angle_bl = odom_angle - prev_odom_angle_;        // delta_angle_base_link: pres 6 slide 15
+    double const delta_angle_bl = math_util::AngleDiff( odom_angle, prev_odom_angle_ ); // delta_angle_base_link: pres 6 slide 15
   
-    for(auto& particle: particles_)
+    // The noise of all particles is drawn in two batches, which is much cheaper than drawing it per particle
+    const size_t num_particles = particles_.size();
+    loc_noise_.resize( 2*num_particles );
+    angle_noise_.resize( num_particles );
+    rng_.FillGaussian( loc_noise_.data(), loc_noise_.size(), 0, CONFIG_Q_tt_*delta_T_bl.norm() + Q_at_*fabs(delta_angle_bl) );
+    rng_.FillGaussian( angle_noise_.data(), angle_noise_.size(), 0, Q_aa_*fabs(delta_angle_bl) + Q_at_*delta_T_bl.norm() );
+
+    PoseMoments moments;
+    for( size_t i = 0; i < num_particles; ++i )
     {
+      Particle& particle = particles_[i];
       Eigen::Rotation2D<float> map_rot( particle.angle );
       particle.loc += map_rot*delta_T_bl;
       particle.angle += delta_angle_bl;
 
       // Add noise
-      particle.loc.x() += rng_.Gaussian( 0, Q_tt_*delta_T_bl.norm() + Q_at_*fabs(delta_angle_bl) ); 
-      particle.loc.y() += rng_.Gaussian( 0, Q_tt_*delta_T_bl.norm() + Q_at_*fabs(delta_angle_bl) ); 
-      particle.angle += rng_.Gaussian( 0, Q_aa_*fabs(delta_angle_bl) + Q_at_*delta_T_bl.norm() ); 
+      particle.loc.x() += loc_noise_[2*i];
+      particle.loc.y() += loc_noise_[2*i + 1];
+      particle.angle += angle_noise_[i];
+      moments.Add( particle );
     }
+    UpdatePoseEstimate( moments );
     
     prev_odom_loc_ = odom_loc;
     prev_odom_angle_ = odom_angle;
@@ -341,25 +704,45 @@ void ParticleFilter::ObserveOdometry(const Vector2f& odom_loc,
   }
 }
 
-void ParticleFilter::logLikelihoodReweight(const double &max_weight, vector<Particle> *particle_set )
+void ParticleFilter::logLikelihoodReweight(const double &log_normalizer, vector<Particle> *particle_set )
 {
-    // Preventing numerical underflow  
-    double weight_sum = 0;
-    for( auto& particle: *particle_set )
+  vector<Particle>& particles = *particle_set;
+  if( !std::isfinite( log_normalizer ) )
+  {
+    // Every particle is impossible, so there is nothing to prefer any of them by
+    PoseMoments moments;
+    for( auto& particle: particles )
     {
-      // particle-weight = log(p(z|x)) + log(w(k-1))
-      // max_weight = log(max_weight)
-      particle.weight = exp( particle.weight - max_weight ); // weights are already in in log land
-      weight_sum += particle.weight; 
+      particle.weight = 1.0/particles.size();
+      moments.Add( particle );
     }
+    if( particle_set == &particles_ ) UpdatePoseEstimate( moments );
+    return;
+  }
 
-    // Normalize the cdf to 1
-    for( auto& particle: *particle_set )
-    {
-        particle.weight /= weight_sum;
-    }
+  // particle-weight = exp(log(p(z|x)) + log(w(k-1)) - log(sum)), which already sums to 1. The weights are
+  // exponentiated in place in the contiguous log_weights_, so that the loop vectorizes, and then copied into
+  // the particles.
+  const size_t num_particles = particles.size();
+  // Copied, since the reference could alias the weights, which would keep the loop from vectorizing
+  const double normalizer = log_normalizer;
+  double* const weights = log_weights_.data();
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for( size_t i = 0; i < num_particles; ++i )
+  {
+    weights[i] = Exp( weights[i] - normalizer );
+  }
+  PoseMoments moments;
+  for( size_t i = 0; i < num_particles; ++i )
+  {
+    particles[i].weight = weights[i];
+    moments.Add( particles[i] );
+  }
+  if( particle_set == &particles_ ) UpdatePoseEstimate( moments );
 
-    return;
+  return;
 }
 
 void ParticleFilter::Initialize(const string& map_file,
@@ -367,15 +750,25 @@ void ParticleFilter::Initialize(const string& map_file,
                                 const float angle) {
   odom_initialized_ = false;
 
-  map_ = VectorMap("maps/"+ map_file +".txt");
+  const string map_path = "maps/"+ map_file +".txt";
+  if( map_path != map_.file_name )
+  {
+    map_ = VectorMap( map_path );
+    // Rebuilt for the new map on the next laser scan, if it is used
+    distance_field_ = vector_map::DistanceField();
+  }
+  UseLikelihoodField();
   
+  PoseMoments moments;
   for(auto& particle: particles_)
   {
     particle.loc.x() = rng_.Gaussian( loc.x(), I_xx_ );
     particle.loc.y() = rng_.Gaussian( loc.y(), I_yy_ );
     particle.angle = rng_.Gaussian( angle, I_aa_ );
     particle.weight = 1/FLAGS_num_particles;
+    moments.Add( particle );
   }
+  UpdatePoseEstimate( moments );
 
   return;
 }
@@ -388,22 +781,105 @@ void ParticleFilter::GetLocation(Eigen::Vector2f* loc_ptr,
     return;
   }
 
-  Vector2f& loc = *loc_ptr;
-  float& angle = *angle_ptr;
+  *loc_ptr = estimate_loc_;
+  *angle_ptr = estimate_angle_;
+  
+  return;
+}
+
+void ParticleFilter::GetLocationCovariance(Eigen::Matrix2f* loc_covariance_ptr,
+                                           float* angle_variance_ptr) const {
+  if(!loc_covariance_ptr || !angle_variance_ptr)
+  {
+    std::cout<<"GetLocationCovariance() was passed a nullptr! What the hell man...\n";
+    return;
+  }
 
-  loc = Vector2f(0, 0);
-  angle = 0;
+  *loc_covariance_ptr = estimate_loc_covariance_;
+  *angle_variance_ptr = estimate_angle_variance_;
 
+  return;
+}
+
+void ParticleFilter::UpdatePoseEstimate( const PoseMoments& all_moments )
+{
+  PoseMoments cluster_moments;
+  if( CONFIG_pose_estimate_ == "cluster" )
+  {
+    ClusterMoments( &cluster_moments );
+  }
+  const PoseMoments& moments = ( CONFIG_pose_estimate_ == "cluster" ) ? cluster_moments : all_moments;
+  if( !(moments.weight > 0) ) return;
+
+  const double mean_x = moments.x/moments.weight;
+  const double mean_y = moments.y/moments.weight;
+  estimate_loc_ = Vector2f( mean_x, mean_y );
+  estimate_loc_covariance_ << moments.xx/moments.weight - mean_x*mean_x, moments.xy/moments.weight - mean_x*mean_y,
+                              moments.xy/moments.weight - mean_x*mean_y, moments.yy/moments.weight - mean_y*mean_y;
+  estimate_angle_ = atan2( moments.sin_angle, moments.cos_angle );
+
+  // Variance of the wrapped normal distribution with the same mean resultant length
+  const double resultant = sqrt( moments.cos_angle*moments.cos_angle + moments.sin_angle*moments.sin_angle )/moments.weight;
+  estimate_angle_variance_ = ( resultant > 0 ) ? std::min<double>( -2.0*log( std::min( 1.0, resultant ) ), M_PI*M_PI ) : M_PI*M_PI;
+
+  return;
+}
+
+void ParticleFilter::ClusterMoments( PoseMoments* moments_ptr )
+{
+  PROFILE_FUNCTION();
+  cluster_weights_.clear();
+  cluster_cells_.clear();
+  int x, y, a;
   for( const auto& particle: particles_ )
   {
-    loc.x() += particle.loc.x();
-    loc.y() += particle.loc.y();
-    angle += particle.angle;
+    PoseCell( particle, cluster_cell_size_, cluster_angle_bins_, &x, &y, &a );
+    double& weight = cluster_weights_[CellKey( x, y, a )];
+    if( weight == 0 ) cluster_cells_.push_back( Eigen::Vector3i( x, y, a ) );
+    weight += particle.weight;
   }
 
-  loc /= FLAGS_num_particles;
-  angle /= FLAGS_num_particles;
-  
+  // The cluster is a cell and its neighbours, so that a mode on a cell boundary is not split. Pick the
+  // cell whose neighbourhood has the most weight.
+  int best_x = 0;
+  int best_y = 0;
+  int best_a = 0;
+  double best_weight = -1;
+  for( const auto& c: cluster_cells_ )
+  {
+    double weight = 0;
+    for( int dy = -1; dy <= 1; ++dy )
+    {
+      for( int dx = -1; dx <= 1; ++dx )
+      {
+        for( int da = -1; da <= 1; ++da )
+        {
+          const int na = ( c.z() + da + cluster_angle_bins_ ) % cluster_angle_bins_;
+          const auto it = cluster_weights_.find( CellKey( c.x() + dx, c.y() + dy, na ) );
+          if( it != cluster_weights_.end() ) weight += it->second;
+        }
+      }
+    }
+    if( weight > best_weight )
+    {
+      best_weight = weight;
+      best_x = c.x();
+      best_y = c.y();
+      best_a = c.z();
+    }
+  }
+
+  PoseMoments& moments = *moments_ptr;
+  for( const auto& particle: particles_ )
+  {
+    PoseCell( particle, cluster_cell_size_, cluster_angle_bins_, &x, &y, &a );
+    const int angle_bins = abs( a - best_a );
+    if( abs( x - best_x ) <= 1 && abs( y - best_y ) <= 1 &&
+        std::min( angle_bins, cluster_angle_bins_ - angle_bins ) <= 1 )
+    {
+      moments.Add( particle );
+    }
+  }
   return;
 }
 
@@ -19,13 +19,18 @@
 */
 //========================================================================
 
+#include <stdint.h>
+
 #include <algorithm>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 #include "shared/math/line2d.h"
 #include "shared/util/random.h"
+#include "vector_map/distance_field.h"
 #include "vector_map/vector_map.h"
 
 #ifndef SRC_PARTICLE_FILTER_H_
@@ -39,17 +44,63 @@ struct Particle {
   double weight;
 };
 
+// Weighted sums over particle poses, from which the weighted mean pose and its covariance follow. Headings
+// are summed as unit vectors, so that the mean is circular.
+struct PoseMoments {
+  void Add( const Particle& p ) {
+    const double w = p.weight;
+    weight += w;
+    x += w*p.loc.x();
+    y += w*p.loc.y();
+    xx += w*p.loc.x()*p.loc.x();
+    xy += w*p.loc.x()*p.loc.y();
+    yy += w*p.loc.y()*p.loc.y();
+    cos_angle += w*cos( p.angle );
+    sin_angle += w*sin( p.angle );
+  }
+  double weight = 0;
+  double x = 0;
+  double y = 0;
+  double xx = 0;
+  double xy = 0;
+  double yy = 0;
+  double cos_angle = 0;
+  double sin_angle = 0;
+};
+
+// Counters of the anytime measurement update, see laser_update_deadline
+struct AnytimeStats {
+  // Scans observed, and how many of them ran out of time before evaluating every particle
+  uint64_t scans = 0;
+  uint64_t deadline_hits = 0;
+  // Particles whose likelihood was evaluated, and interpolated instead
+  uint64_t evaluated_particles = 0;
+  uint64_t interpolated_particles = 0;
+};
+
+// Evaluated particles in one cell of the interpolation grid: their number, and their mean log likelihood
+// and pose once they are all added
+struct InterpolationCell {
+  int count = 0;
+  double log_likelihood = 0;
+  Eigen::Vector2f loc = Eigen::Vector2f( 0, 0 );
+  float cos_angle = 0;
+  float sin_angle = 0;
+  float angle = 0;
+};
+
 class ParticleFilter {
  public:
   // Default Constructor.
    ParticleFilter();
 
-  // Observe a new laser scan.
+  // Observe a new laser scan, taken at scan_time on the GetMonotonicTime() clock.
   void ObserveLaser(const std::vector<float>& ranges,
                     float range_min,
                     float range_max,
                     float angle_min,
-                    float angle_max);
+                    float angle_max,
+                    double scan_time);
 
   // Observe new odometry-reported location.
   void ObserveOdometry(const Eigen::Vector2f& odom_loc,
@@ -63,8 +114,12 @@ class ParticleFilter {
   // Return the list of particles.
   void GetParticles(std::vector<Particle>* particles) const;
 
-  // Get robot's current location.
+  // Get robot's current location. The estimate is kept up to date as the particles change, so this is
+  // constant time.
   void GetLocation(Eigen::Vector2f* loc, float* angle) const;
+
+  // Covariance of the location estimate, and the circular variance of its heading
+  void GetLocationCovariance(Eigen::Matrix2f* loc_covariance, float* angle_variance) const;
  
   // Update particle weight based on laser.
   void Update(const std::vector<float>& ranges,
@@ -76,15 +131,47 @@ class ParticleFilter {
 
   // Resample particles.
   void Resample();
-  // Measurement Liklihood for weight calculation
-  double MeasurementLikelihood( const Particle& p, 
+  // Log of the ray cast measurement likelihood of the selected beams, summed so that it cannot underflow
+  double MeasurementLogLikelihood( const Particle& p, 
                                 const std::vector<float>& ranges, 
                                 const float& gamma, 
-                                const float& beam_count, 
+                                const std::vector<int>& beams, 
                                 const float& range_min,
                                 const float& range_max,
                                 const float& angle_min,
                                 const float& angle_max );
+
+  // Log of the likelihood field measurement model: each beam endpoint, given in base_link, is scored by its
+  // distance to the closest wall, so no rays are cast
+  double LikelihoodFieldLogLikelihood( const Particle& p,
+                                       const std::vector<Eigen::Vector2f>& points ) const;
+
+  // Endpoints in base_link of the selected beams, skipping readings out of range
+  void GetObservedPoints( const std::vector<float>& ranges,
+                          const std::vector<int>& beams,
+                          float range_min,
+                          float range_max,
+                          float angle_min,
+                          float angle_max,
+                          std::vector<Eigen::Vector2f>* points ) const;
+
+  // Number of beams to use for the next update, adapted to the beam time budget if there is one
+  int BeamCount( size_t num_particles ) const;
+
+  // Pick the beams for the measurement model, as configured by beam_selection
+  void SelectBeams( const std::vector<float>& ranges,
+                    float range_min,
+                    float range_max,
+                    float angle_min,
+                    float angle_max,
+                    int num_beams,
+                    std::vector<int>* beams );
+
+  // True if the Lua config selects the likelihood field model, building its distance field if needed
+  bool UseLikelihoodField();
+
+  // Build or load the distance field for the current map, if it has not been yet
+  void EnsureDistanceField();
   
   Eigen::Vector2f GetPredictedPoint(const Eigen::Vector2f& loc,
                                     const float angle,
@@ -104,10 +191,24 @@ class ParticleFilter {
                               float angle_max,
                               std::vector<Eigen::Vector2f>* scan);
 
-  void logLikelihoodReweight(const double &max_weight, std::vector <Particle> *particle_set );
+  // Set the weights of particle_set from log_weights_, normalized by log_normalizer, the log of their sum.
+  // log_weights_ is left holding the weights.
+  void logLikelihoodReweight(const double &log_normalizer, std::vector <Particle> *particle_set );
 
   bool isDegenerate();
 
+  const AnytimeStats& GetAnytimeStats() const { return anytime_stats_; }
+
+  // Set the pose estimate from the moments of the particles, or in cluster mode, from the densest cluster
+  void UpdatePoseEstimate( const PoseMoments& moments );
+
+  // Moments of the particles around the grid cell of (x, y, angle) with the most weight
+  void ClusterMoments( PoseMoments* moments );
+
+  // Fill in the log likelihoods of the particles after the first num_evaluated in update_order_, by
+  // inverse distance weighting of the evaluated ones nearby
+  void InterpolateLogLikelihoods( const std::vector<Particle>& particle_set, size_t num_evaluated );
+
  private:
 
   // List of particles being tracked.
@@ -117,7 +218,7 @@ class ParticleFilter {
   vector_map::VectorMap map_;
 
   // Random number generator.
-  util_random::Random rng_;
+  util_random::CounterRandom rng_;
 
   // Previous odometry-reported locations.
   Eigen::Vector2f prev_odom_loc_;
@@ -131,16 +232,69 @@ class ParticleFilter {
   float const I_yy_ = 0.15;
   float const I_aa_ = 0.15;
 
-  // Process noise (prediction) variance
-  float const Q_tt_ = 0.5;   // tt - translation*translation - we dont distinguish between xx and yy
+  // Process noise (prediction) variance. Q_tt, translation*translation, is configured by Q_tt - we dont
+  // distinguish between xx and yy
   float const Q_aa_ = 0.15;
   float const Q_at_ = 0.75;     // at - rotation*translation - we dont distinguish between ay, ya, xa, ax
 
-  // How many beams to calculate p_z_x with
-  int const num_beams_= 50;
+  // The number of beams to calculate p_z_x with is configured by num_beams, and adapted down to this
+  // many to meet beam_time_budget
+  int const min_beams_ = 10;
+  // Informative beam selection treats endpoints further than this from any wall, at the estimated pose,
+  // as dynamic obstacles
+  float const dynamic_obstacle_distance_ = 0.5; // m
+
+  // Correlation between laser beams, applied as an exponent on p_z_x, is configured by gamma
+
+  // Motion noise of the particles for the latest odometry, x and y interleaved for the location
+  std::vector<float> loc_noise_;
+  std::vector<float> angle_noise_;
+
+  // Beams selected for the latest scan
+  std::vector<int> beams_;
+  // Candidate beams for informative selection, and whether they look like dynamic obstacles
+  std::vector<int> candidate_beams_;
+  std::vector<bool> dynamic_beams_;
+  // Smoothed CPU time of one beam of one particle in the measurement update
+  double time_per_beam_ = 0; // s
+
+  // Likelihood field observation model, selected with observation_model = "likelihood_field"
+  vector_map::DistanceField distance_field_;
+  float const likelihood_field_resolution_ = 0.05; // m
+  // Endpoints further than this from any wall, e.g. on people or unmapped obstacles, are all equally unlikely
+  float const likelihood_field_max_distance_ = 1.0; // m
+  float const likelihood_field_sigma_ = 0.3; // m
+  // Beam endpoints of the latest scan in base_link, shared by all particles
+  std::vector<Eigen::Vector2f> observed_points_;
+
+  // Unnormalized log weights of the particles being updated
+  std::vector<double> log_weights_;
+
+  // Anytime update: particles are evaluated from the most to the least likely until the deadline
+  std::vector<size_t> update_order_;
+  std::vector<double> log_likelihoods_;
+  // Monotonic time by which the current update has to finish, or 0 for none
+  double update_deadline_ = 0; // s
+  // Weight of the pose angle against position when interpolating likelihoods
+  float const interpolation_angle_scale_ = 1.0; // m/rad
+  // Grid pooling the evaluated particles for interpolation
+  float const interpolation_cell_size_ = 0.25; // m
+  int const interpolation_angle_bins_ = 24;
+  std::unordered_map<int64_t, size_t> interpolation_index_;
+  std::vector<InterpolationCell> interpolation_cells_;
+  AnytimeStats anytime_stats_;
+
+  // Pose estimate, updated whenever the particles move or are reweighted
+  Eigen::Vector2f estimate_loc_ = Eigen::Vector2f( 0, 0 );
+  float estimate_angle_ = 0;
+  Eigen::Matrix2f estimate_loc_covariance_ = Eigen::Matrix2f::Zero();
+  float estimate_angle_variance_ = 0;
 
-  // Correlation between laser beams
-  float const gamma_ = 1.0;
+  // Grid used by the cluster pose estimate
+  float const cluster_cell_size_ = 0.5; // m
+  int const cluster_angle_bins_ = 8;
+  std::unordered_map<int64_t, double> cluster_weights_;
+  std::vector<Eigen::Vector3i> cluster_cells_;
   
 };
 }  // namespace slam
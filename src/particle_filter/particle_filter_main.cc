@@ -27,6 +27,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <termios.h>
+#include <algorithm>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
@@ -45,6 +46,8 @@
 #include "config_reader/config_reader.h"
 #include "shared/math/math_util.h"
 #include "shared/math/line2d.h"
+#include "shared/ros/profile_publisher.h"
+#include "shared/util/profiler.h"
 #include "shared/util/timer.h"
 
 #include "particle_filter.h"
@@ -73,6 +76,12 @@ DEFINE_string(init_topic,
               "/set_pose",
               "Name of ROS topic for initialization");
 DEFINE_string(map, "", "Map file to use");
+DEFINE_string(profile_output, "",
+              "File to periodically write the scoped profile to, if not empty");
+DEFINE_string(profile_topic, "",
+              "ROS topic to periodically publish the scoped profile on, if "
+              "not empty");
+DEFINE_double(profile_period, 5.0, "Seconds between scoped profile dumps");
 
 DECLARE_int32(v);
 
@@ -173,12 +182,16 @@ void LaserCallback(const sensor_msgs::LaserScan& msg) {
     printf("Laser t=%f\n", msg.header.stamp.toSec());
   }
   last_laser_msg_ = msg;
+  // The age of the scan on the ROS clock dates it on the monotonic clock.
+  const double scan_age =
+      std::max(0.0, (Time::now() - msg.header.stamp).toSec());
   particle_filter_.ObserveLaser(
       msg.ranges,
       msg.range_min,
       msg.range_max,
       msg.angle_min,
-      msg.angle_max);
+      msg.angle_max,
+      GetMonotonicTime() - scan_age);
   PublishVisualization();
 }
 
@@ -228,10 +241,20 @@ void ProcessLive(ros::NodeHandle* n) {
       1,
       OdometryCallback);
   while (ros::ok() && run_) {
+    // Config changes take effect between callbacks.
+    config_reader::Update();
     ros::spinOnce();
     PublishVisualization();
     Sleep(0.01);
   }
+  const particle_filter::AnytimeStats& stats =
+      particle_filter_.GetAnytimeStats();
+  printf("Laser updates: %lu scans, %lu past the deadline, "
+         "%lu particles evaluated, %lu interpolated\n",
+         static_cast<unsigned long>(stats.scans),
+         static_cast<unsigned long>(stats.deadline_hits),
+         static_cast<unsigned long>(stats.evaluated_particles),
+         static_cast<unsigned long>(stats.interpolated_particles));
 }
 
 void SignalHandler(int) {
@@ -258,8 +281,14 @@ int main(int argc, char** argv) {
       n.advertise<amrl_msgs::Localization2DMsg>("localization", 1);
   laser_publisher_ =
       n.advertise<sensor_msgs::LaserScan>("scan", 1);
+  if (!FLAGS_profile_output.empty()) {
+    profiler::StartPeriodicDump(FLAGS_profile_output, FLAGS_profile_period);
+  }
+  ros_helpers::ProfilePublisher profile_publisher(
+      &n, FLAGS_profile_topic, FLAGS_profile_period);
 
   ProcessLive(&n);
+  profiler::StopPeriodicDump();
 
   return 0;
 }
@@ -0,0 +1,57 @@
+// This software is free: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License Version 3,
+// as published by the Free Software Foundation.
+//
+// This software is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// Version 3 in the file COPYING that came with this distribution.
+// If not, see <http://www.gnu.org/licenses/>.
+// ========================================================================
+
+// C++ headers.
+#include <string>
+
+// C++ Library headers.
+#include "ros/ros.h"
+#include "std_msgs/String.h"
+
+// Custom headers.
+#include "util/profiler.h"
+
+#ifndef PROFILE_PUBLISHER_H
+#define PROFILE_PUBLISHER_H
+
+namespace ros_helpers {
+
+// Periodically publish the scoped profiler report as a std_msgs/String, from
+// the callbacks of the node. An empty topic disables publishing.
+class ProfilePublisher {
+ public:
+  ProfilePublisher(ros::NodeHandle* n,
+                   const std::string& topic,
+                   double period) {
+    if (topic.empty()) return;
+    publisher_ = n->advertise<std_msgs::String>(topic, 1);
+    timer_ = n->createWallTimer(ros::WallDuration(period),
+                                &ProfilePublisher::Publish,
+                                this);
+  }
+
+ private:
+  void Publish(const ros::WallTimerEvent&) {
+    std_msgs::String msg;
+    msg.data = profiler::Report();
+    publisher_.publish(msg);
+  }
+
+  ros::Publisher publisher_;
+  ros::WallTimer timer_;
+};
+
+}  // namespace ros_helpers
+
+#endif  // PROFILE_PUBLISHER_H
@@ -0,0 +1,136 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/background_builder.h"
+
+using std::vector;
+
+namespace {
+
+// Builds a table of n values, blocking while the gate is closed, and records
+// the sizes it was called with.
+class Tables {
+ public:
+  Tables() : open_(true) {}
+
+  std::shared_ptr<const vector<int>> Build(int n) {
+    while (!open_) std::this_thread::yield();
+    std::lock_guard<std::mutex> lock(mutex_);
+    built_.push_back(n);
+    return std::make_shared<const vector<int>>(n, n);
+  }
+
+  void Close() { open_ = false; }
+  void Open() { open_ = true; }
+
+  vector<int> Built() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return built_;
+  }
+
+ private:
+  std::atomic<bool> open_;
+  std::mutex mutex_;
+  vector<int> built_;
+};
+
+// Calls Update() until it swaps in a value.
+void WaitForUpdate(BackgroundBuilder<int, vector<int>>* builder) {
+  while (!builder->Update()) std::this_thread::yield();
+}
+
+}  // namespace
+
+TEST(BackgroundBuilder, BuildAndRequest) {
+  Tables tables;
+  BackgroundBuilder<int, vector<int>> builder(
+      [&tables](int n) { return tables.Build(n); });
+  EXPECT_TRUE(builder.Get() == nullptr);
+  builder.Build(3);
+  ASSERT_TRUE(builder.Get() != nullptr);
+  EXPECT_EQ(vector<int>(3, 3), *builder.Get());
+  EXPECT_EQ(3, builder.GetParams());
+
+  // Current parameters are not built again.
+  builder.Request(3);
+  EXPECT_FALSE(builder.Building());
+  EXPECT_FALSE(builder.Update());
+
+  tables.Close();
+  builder.Request(5);
+  EXPECT_TRUE(builder.Building());
+  // The current value stays until the build finishes and Update() is called.
+  const std::shared_ptr<const vector<int>> old = builder.Get();
+  EXPECT_FALSE(builder.Update());
+  EXPECT_EQ(old, builder.Get());
+  tables.Open();
+  WaitForUpdate(&builder);
+  EXPECT_EQ(vector<int>(5, 5), *builder.Get());
+  EXPECT_EQ(5, builder.GetParams());
+  EXPECT_FALSE(builder.Building());
+  // Values handed out earlier remain valid.
+  EXPECT_EQ(vector<int>(3, 3), *old);
+  EXPECT_EQ(vector<int>({3, 5}), tables.Built());
+}
+
+TEST(BackgroundBuilder, OnlyLatestRequestIsBuiltNext) {
+  Tables tables;
+  BackgroundBuilder<int, vector<int>> builder(
+      [&tables](int n) { return tables.Build(n); });
+  builder.Build(1);
+  tables.Close();
+  builder.Request(2);
+  builder.Request(3);
+  builder.Request(4);
+  tables.Open();
+  WaitForUpdate(&builder);
+  EXPECT_EQ(2, builder.GetParams());
+  WaitForUpdate(&builder);
+  EXPECT_EQ(4, builder.GetParams());
+  EXPECT_FALSE(builder.Building());
+  EXPECT_EQ(vector<int>({1, 2, 4}), tables.Built());
+
+  // A pending request is replaced by the latest one, even if that is for the
+  // parameters current when it is made.
+  tables.Close();
+  builder.Request(5);
+  builder.Request(6);
+  builder.Request(4);
+  tables.Open();
+  WaitForUpdate(&builder);
+  EXPECT_EQ(5, builder.GetParams());
+  EXPECT_TRUE(builder.Building());
+  WaitForUpdate(&builder);
+  EXPECT_EQ(4, builder.GetParams());
+  EXPECT_EQ(vector<int>({1, 2, 4, 5, 4}), tables.Built());
+}
+
+TEST(BackgroundBuilder, DestructorWaitsForBuild) {
+  Tables tables;
+  {
+    BackgroundBuilder<int, vector<int>> builder(
+        [&tables](int n) { return tables.Build(n); });
+    builder.Request(7);
+  }
+  EXPECT_EQ(vector<int>({7}), tables.Built());
+}
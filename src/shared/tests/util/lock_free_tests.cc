@@ -0,0 +1,189 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Stress tests of the lock-free hand off primitives: every test runs a
+// producer against consumers for long enough that they interleave in every
+// way, and checks that no value is torn, reordered or lost.
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "util/seqlock.h"
+#include "util/spsc_queue.h"
+#include "util/triple_buffer.h"
+
+using std::vector;
+
+namespace {
+
+const uint64_t kNumValues = 1000000;
+
+// Value whose fields are all derived from one number, so that a mix of two
+// values is detected.
+struct Stamped {
+  uint64_t sequence;
+  uint64_t checks[7];
+
+  void Set(uint64_t s) {
+    sequence = s;
+    for (uint64_t& check : checks) check = ~s;
+  }
+
+  bool Consistent() const {
+    for (const uint64_t check : checks) {
+      if (check != ~sequence) return false;
+    }
+    return true;
+  }
+};
+
+}  // namespace
+
+TEST(SpscQueue, FifoAndCapacity) {
+  SpscQueue<int, 4> queue;
+  int value = 0;
+  EXPECT_FALSE(queue.TryPop(&value));
+  // Wrap around the slots a few times.
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < 4; ++i) EXPECT_TRUE(queue.TryPush(10 * round + i));
+    EXPECT_FALSE(queue.TryPush(-1));
+    EXPECT_EQ(4u, queue.Size());
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_TRUE(queue.TryPop(&value));
+      EXPECT_EQ(10 * round + i, value);
+    }
+    EXPECT_TRUE(queue.Empty());
+  }
+}
+
+TEST(SpscQueue, MoveOnly) {
+  SpscQueue<std::unique_ptr<int>, 2> queue;
+  EXPECT_TRUE(queue.TryPush(std::unique_ptr<int>(new int(7))));
+  std::unique_ptr<int> value;
+  EXPECT_TRUE(queue.TryPop(&value));
+  ASSERT_TRUE(value != nullptr);
+  EXPECT_EQ(7, *value);
+}
+
+TEST(SpscQueue, StressInOrder) {
+  SpscQueue<Stamped, 64> queue;
+  std::thread producer([&queue]() {
+    Stamped value;
+    for (uint64_t i = 0; i < kNumValues; ++i) {
+      value.Set(i);
+      while (!queue.TryPush(value)) std::this_thread::yield();
+    }
+  });
+  Stamped value;
+  bool ok = true;
+  for (uint64_t i = 0; i < kNumValues && ok; ++i) {
+    while (!queue.TryPop(&value)) std::this_thread::yield();
+    ok = value.sequence == i && value.Consistent();
+  }
+  producer.join();
+  EXPECT_TRUE(ok) << "Value " << value.sequence << " out of order or torn";
+  EXPECT_TRUE(queue.Empty());
+}
+
+TEST(TripleBuffer, StressLatestValue) {
+  TripleBuffer<Stamped> buffer;
+  std::atomic<bool> done(false);
+  std::thread producer([&buffer, &done]() {
+    for (uint64_t i = 1; i <= kNumValues; ++i) {
+      buffer.WriteBuffer().Set(i);
+      buffer.Publish();
+    }
+    done = true;
+  });
+  uint64_t last = 0;
+  bool ok = true;
+  // Values may be skipped, but never torn or seen out of order, and the
+  // final value is always delivered.
+  while (ok && last < kNumValues) {
+    const bool finished = done;
+    if (buffer.Update()) {
+      const Stamped& value = buffer.ReadBuffer();
+      ok = value.Consistent() && value.sequence > last;
+      last = value.sequence;
+    } else if (finished) {
+      break;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  EXPECT_TRUE(ok) << "Value " << last << " out of order or torn";
+  EXPECT_EQ(kNumValues, last);
+}
+
+TEST(SeqLock, Pose) {
+  struct Pose {
+    Eigen::Vector2f loc;
+    float angle;
+  };
+  SeqLock<Pose> pose(Pose{Eigen::Vector2f(1, 2), 3});
+  uint64_t version = 0;
+  Pose value = pose.Load(&version);
+  EXPECT_EQ(Eigen::Vector2f(1, 2), value.loc);
+  EXPECT_EQ(3, value.angle);
+  EXPECT_EQ(1u, version);
+  pose.Store(Pose{Eigen::Vector2f(4, 5), 6});
+  value = pose.Load(&version);
+  EXPECT_EQ(Eigen::Vector2f(4, 5), value.loc);
+  EXPECT_EQ(2u, version);
+}
+
+TEST(SeqLock, StressManyReaders) {
+  SeqLock<Stamped> lock;
+  std::atomic<bool> done(false);
+  const int kNumReaders = 3;
+  vector<int> failures(kNumReaders, 0);
+  vector<std::thread> readers;
+  for (int r = 0; r < kNumReaders; ++r) {
+    readers.emplace_back([&lock, &done, &failures, r]() {
+      uint64_t last_version = 0;
+      while (!done) {
+        uint64_t version = 0;
+        const Stamped value = lock.Load(&version);
+        // The writer stores sequence v - 1 as version v.
+        if (version < last_version ||
+            (version > 0 && (!value.Consistent() ||
+                             value.sequence != version - 1))) {
+          ++failures[r];
+        }
+        last_version = version;
+        std::this_thread::yield();
+      }
+    });
+  }
+  Stamped value;
+  for (uint64_t i = 0; i < kNumValues; ++i) {
+    value.Set(i);
+    lock.Store(value);
+  }
+  done = true;
+  for (std::thread& reader : readers) reader.join();
+  for (int r = 0; r < kNumReaders; ++r) {
+    EXPECT_EQ(0, failures[r]) << "Reader " << r;
+  }
+}
@@ -0,0 +1,141 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "util/random.h"
+
+using std::vector;
+using util_random::CounterRandom;
+
+namespace {
+
+void ExpectBlock(CounterRandom* rng,
+                 uint32_t w0, uint32_t w1, uint32_t w2, uint32_t w3) {
+  EXPECT_EQ(w0, rng->RandomUint32());
+  EXPECT_EQ(w1, rng->RandomUint32());
+  EXPECT_EQ(w2, rng->RandomUint32());
+  EXPECT_EQ(w3, rng->RandomUint32());
+}
+
+void ExpectMoments(const vector<float>& values,
+                   double mean, double stddev, double tolerance) {
+  double sum = 0;
+  double sum_squares = 0;
+  for (const float value : values) {
+    sum += value;
+    sum_squares += value * value;
+  }
+  const double sample_mean = sum / values.size();
+  EXPECT_NEAR(mean, sample_mean, tolerance);
+  EXPECT_NEAR(stddev,
+              sqrt(sum_squares / values.size() - sample_mean * sample_mean),
+              tolerance);
+}
+
+}  // namespace
+
+// Known answers of Philox4x32-10 from the Random123 distribution. The counter
+// is (block, stream) and the key is the seed, low words first.
+TEST(CounterRandom, KnownAnswers) {
+  CounterRandom zeros(0, 0);
+  ExpectBlock(&zeros, 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8);
+
+  CounterRandom ones(0xffffffffffffffff, 0xffffffffffffffff);
+  ones.Seek(0xffffffffffffffff);
+  ExpectBlock(&ones, 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd);
+
+  CounterRandom pi(0x299f31d0a4093822, 0x0370734413198a2e);
+  pi.Seek(0x85a308d3243f6a88);
+  ExpectBlock(&pi, 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1);
+}
+
+TEST(CounterRandom, SeekAndStreams) {
+  CounterRandom rng(7, 3);
+  vector<uint32_t> first;
+  for (int i = 0; i < 40; ++i) first.push_back(rng.RandomUint32());
+  EXPECT_EQ(10u, rng.Block());
+
+  rng.Seek(5);
+  for (int i = 20; i < 40; ++i) EXPECT_EQ(first[i], rng.RandomUint32());
+
+  CounterRandom same = CounterRandom(7, 4).Stream(3);
+  CounterRandom other = rng.Stream(4);
+  int num_equal = 0;
+  for (int i = 0; i < 40; ++i) {
+    EXPECT_EQ(first[i], same.RandomUint32());
+    if (first[i] == other.RandomUint32()) ++num_equal;
+  }
+  EXPECT_EQ(0, num_equal);
+}
+
+TEST(CounterRandom, FillIsIndependentOfBatching) {
+  CounterRandom whole(11);
+  vector<float> values(100);
+  whole.FillGaussian(values.data(), values.size(), 0, 1);
+  EXPECT_EQ(25u, whole.Block());
+
+  // Batches of multiples of four values consume whole blocks.
+  CounterRandom split(11);
+  vector<float> parts(100);
+  split.FillGaussian(parts.data(), 4, 0, 1);
+  split.FillGaussian(parts.data() + 4, 68, 0, 1);
+  split.FillGaussian(parts.data() + 72, 28, 0, 1);
+  EXPECT_EQ(values, parts);
+
+  CounterRandom uniform(11);
+  uniform.FillUniform(values.data(), 7, 0, 1);
+  EXPECT_EQ(2u, uniform.Block());
+}
+
+TEST(CounterRandom, UniformDistribution) {
+  CounterRandom rng(3);
+  vector<float> values(1 << 18);
+  rng.FillUniform(values.data(), values.size(), -2, 6);
+  for (const float value : values) {
+    ASSERT_LE(-2, value);
+    ASSERT_GT(6, value);
+  }
+  ExpectMoments(values, 2, 8 / sqrt(12.0), 0.02);
+
+  for (int i = 0; i < 10000; ++i) {
+    const double value = rng.UniformRandom();
+    ASSERT_LE(0, value);
+    ASSERT_GT(1, value);
+  }
+}
+
+TEST(CounterRandom, GaussianDistribution) {
+  CounterRandom rng(5);
+  vector<float> values(1 << 18);
+  rng.FillGaussian(values.data(), values.size(), 1.5, 0.5);
+  ExpectMoments(values, 1.5, 0.5, 0.005);
+  int num_within_one = 0;
+  for (const float value : values) {
+    ASSERT_TRUE(std::isfinite(value));
+    if (fabs(value - 1.5) < 0.5) ++num_within_one;
+  }
+  EXPECT_NEAR(0.6827, static_cast<double>(num_within_one) / values.size(),
+              0.005);
+
+  vector<float> scalar;
+  for (int i = 0; i < (1 << 16); ++i) scalar.push_back(rng.Gaussian(-1, 2));
+  ExpectMoments(scalar, -1, 2, 0.04);
+}
@@ -0,0 +1,152 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "util/thread_pool.h"
+
+using std::vector;
+
+namespace {
+
+ThreadPool::Options NumThreads(int num_threads) {
+  ThreadPool::Options options;
+  options.num_threads = num_threads;
+  return options;
+}
+
+float Term(size_t i) {
+  return 1.0f / (1.0f + i) * ((i % 3 == 0) ? -1.0f : 1.0f);
+}
+
+}  // namespace
+
+TEST(ThreadPool, ParallelForVisitsEveryIndexOnce) {
+  for (const int num_threads : {1, 2, 4, 8}) {
+    ThreadPool pool(NumThreads(num_threads));
+    EXPECT_EQ(num_threads, pool.NumThreads());
+    for (const size_t grain : {0, 1, 7, 1000}) {
+      const size_t n = 10007;
+      std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[n]);
+      for (size_t i = 0; i < n; ++i) visits[i] = 0;
+      pool.ParallelFor(3, n, grain, [&visits](size_t i) { ++visits[i]; });
+      for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ((i < 3) ? 0 : 1, visits[i])
+            << "Index " << i << ", " << num_threads << " threads, grain "
+            << grain;
+      }
+    }
+  }
+}
+
+TEST(ThreadPool, EmptyRange) {
+  ThreadPool pool(NumThreads(4));
+  bool called = false;
+  pool.ParallelFor(5, 5, 0, [&called](size_t) { called = true; });
+  EXPECT_FALSE(called);
+  EXPECT_EQ(42, pool.ParallelReduce(
+      5, 5, 0, 42, [](size_t i) { return static_cast<int>(i); },
+      [](int a, int b) { return a + b; }));
+}
+
+TEST(ThreadPool, NestedLoops) {
+  ThreadPool pool(NumThreads(4));
+  const size_t n = 64;
+  vector<uint64_t> sums(n, 0);
+  pool.ParallelFor(0, n, 1, [&pool, &sums](size_t i) {
+    sums[i] = pool.ParallelReduce(
+        0, 1000, 0, uint64_t(0), [i](size_t j) { return uint64_t(i * j); },
+        [](uint64_t a, uint64_t b) { return a + b; });
+  });
+  for (size_t i = 0; i < n; ++i) EXPECT_EQ(i * 999 * 1000 / 2, sums[i]);
+}
+
+TEST(ThreadPool, ConcurrentCallers) {
+  ThreadPool pool(NumThreads(3));
+  const size_t n = 100000;
+  vector<uint64_t> results(4, 0);
+  vector<std::thread> callers;
+  for (size_t c = 0; c < results.size(); ++c) {
+    callers.emplace_back([&pool, &results, c]() {
+      for (int repeat = 0; repeat < 20; ++repeat) {
+        results[c] = pool.ParallelReduce(
+            0, n, 0, uint64_t(0), [c](size_t i) { return uint64_t(i + c); },
+            [](uint64_t a, uint64_t b) { return a + b; },
+            ThreadPool::Reduction::kFast);
+      }
+    });
+  }
+  for (std::thread& caller : callers) caller.join();
+  for (size_t c = 0; c < results.size(); ++c) {
+    EXPECT_EQ(n * (n - 1) / 2 + n * c, results[c]);
+  }
+}
+
+TEST(ThreadPool, DeterministicReductionIndependentOfThreads) {
+  const size_t n = 123457;
+  auto sum = [](float a, float b) { return a + b; };
+  ThreadPool serial(NumThreads(1));
+  const float expected =
+      serial.ParallelReduce(0, n, 0, 0.0f, Term, sum);
+  for (const int num_threads : {2, 3, 8}) {
+    ThreadPool pool(NumThreads(num_threads));
+    for (int repeat = 0; repeat < 10; ++repeat) {
+      // Bitwise equality, not just within rounding error.
+      ASSERT_EQ(expected, pool.ParallelReduce(0, n, 0, 0.0f, Term, sum))
+          << num_threads << " threads";
+    }
+  }
+  float serial_sum = 0;
+  for (size_t i = 0; i < n; ++i) serial_sum += Term(i);
+  EXPECT_NEAR(serial_sum, expected, 1e-3);
+}
+
+TEST(ThreadPool, ArgMaxKeepsFirstMaximum) {
+  // Ties resolve to the lowest index, as in a serial loop with a strict
+  // comparison.
+  struct Best {
+    float value;
+    size_t index;
+  };
+  ThreadPool pool(NumThreads(4));
+  const Best best = pool.ParallelReduce(
+      0, 10000, 0, Best{-INFINITY, 0},
+      [](size_t i) { return Best{static_cast<float>(i % 1000), i}; },
+      [](const Best& a, const Best& b) { return (b.value > a.value) ? b : a; });
+  EXPECT_EQ(999, best.value);
+  EXPECT_EQ(999u, best.index);
+}
+
+TEST(ThreadPool, PinnedThreads) {
+  ThreadPool::Options options = NumThreads(2);
+  options.pin_threads = true;
+  ThreadPool pool(options);
+  EXPECT_EQ(uint64_t(4950), pool.ParallelReduce(
+      0, 100, 1, uint64_t(0), [](size_t i) { return uint64_t(i); },
+      [](uint64_t a, uint64_t b) { return a + b; }));
+}
+
+TEST(ThreadPool, Default) {
+  EXPECT_EQ(&ThreadPool::Default(), &ThreadPool::Default());
+  EXPECT_GE(ThreadPool::Default().NumThreads(), 1);
+}
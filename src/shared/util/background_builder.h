@@ -0,0 +1,113 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Precomputed structure that is rebuilt on a background thread when the
+// parameters it depends on change, and swapped in between cycles:
+// ==============================
+// BackgroundBuilder<Params, Table> table([](const Params& params) {
+//   return std::make_shared<const Table>(params);
+// });
+// table.Build(params);
+// // Every cycle:
+// table.Request(CurrentParams());
+// table.Update();
+// const Table& current = *table.Get();
+// ==============================
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+
+#ifndef SRC_UTIL_BACKGROUND_BUILDER_H_
+#define SRC_UTIL_BACKGROUND_BUILDER_H_
+
+// Values are immutable once built, and shared with std::shared_ptr, so that a
+// value handed to another thread stays valid after the next one is swapped
+// in. At most one build runs at a time: parameters requested meanwhile are
+// built after it, and only the latest of them. The build function runs on
+// another thread, so it may only read state that does not change while the
+// builder exists, and the builder, whose destructor waits for a running
+// build, has to be destroyed before that state.
+template <typename Params, typename Value>
+class BackgroundBuilder {
+ public:
+  typedef std::function<std::shared_ptr<const Value>(const Params&)>
+      BuildFunction;
+
+  explicit BackgroundBuilder(const BuildFunction& build) :
+      build_(build), building_(false) {}
+
+  // Builds the value for params on the calling thread, and makes it the
+  // current one.
+  void Build(const Params& params) {
+    value_ = build_(params);
+    params_ = params;
+    requested_ = params;
+  }
+
+  // Starts building the value for params in the background, unless it is
+  // current or being built already. Returns without waiting for the build.
+  void Request(const Params& params) {
+    requested_ = params;
+    Start();
+  }
+
+  // Makes the value of a finished build the current one. Returns whether it
+  // did. Call between cycles, from the thread that reads Get().
+  bool Update() {
+    if (!building_ ||
+        future_.wait_for(std::chrono::seconds(0)) !=
+            std::future_status::ready) {
+      return false;
+    }
+    value_ = future_.get();
+    params_ = building_params_;
+    building_ = false;
+    Start();
+    return true;
+  }
+
+  // Whether a build is running.
+  bool Building() const { return building_; }
+
+  // Current value, or null before the first build, and its parameters.
+  const std::shared_ptr<const Value>& Get() const { return value_; }
+  const Params& GetParams() const { return params_; }
+
+ private:
+  // Disable copy constructor and assignment operator.
+  BackgroundBuilder(const BackgroundBuilder&);
+  void operator=(const BackgroundBuilder&);
+
+  void Start() {
+    if (building_ || (value_ != nullptr && requested_ == params_)) return;
+    building_params_ = requested_;
+    building_ = true;
+    future_ = std::async(std::launch::async, build_, building_params_);
+  }
+
+  const BuildFunction build_;
+  std::shared_ptr<const Value> value_;
+  Params params_;
+  // Latest parameters requested.
+  Params requested_;
+  // Build in the background, if building_, and its parameters.
+  bool building_;
+  Params building_params_;
+  std::future<std::shared_ptr<const Value>> future_;
+};
+
+#endif  // SRC_UTIL_BACKGROUND_BUILDER_H_
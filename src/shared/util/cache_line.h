@@ -0,0 +1,43 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Cache line padding, to keep data written by different threads from sharing
+// a cache line.
+
+#include <stddef.h>
+
+#include <utility>
+
+#ifndef SRC_UTIL_CACHE_LINE_H_
+#define SRC_UTIL_CACHE_LINE_H_
+
+// Size of a cache line on the x86 and ARM processors we run on.
+static const size_t kCacheLineSize = 64;
+
+// A value that shares no cache line with any other data, wherever the
+// enclosing object is allocated. This pads instead of using alignas, since
+// operator new ignores extended alignment before C++17.
+template <typename T>
+struct CacheLinePadded {
+  template <typename... Args>
+  explicit CacheLinePadded(Args&&... args) :
+      value(std::forward<Args>(args)...) {}
+
+  char padding_before[kCacheLineSize];
+  T value;
+  char padding_after[kCacheLineSize];
+};
+
+#endif  // SRC_UTIL_CACHE_LINE_H_
@@ -0,0 +1,248 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+
+#include "util/profiler.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/timer.h"
+
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace {
+
+// Tree of scopes of one thread.
+struct ThreadTree {
+  ThreadTree() : root(nullptr, nullptr) {}
+  string name;
+  // Held while adding nodes, and while reporting.
+  std::mutex mutex;
+  profiler::Node root;
+};
+
+// Trees of all threads that ever entered a scope. Trees outlive their threads,
+// so that the time they spent is still reported.
+struct Registry {
+  std::mutex mutex;
+  vector<unique_ptr<ThreadTree>> trees;
+  const double t_start = GetMonotonicTime();
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+thread_local ThreadTree* thread_tree_ = nullptr;
+// Innermost open scope of this thread.
+thread_local profiler::Node* current_node_ = nullptr;
+
+ThreadTree* GetThreadTree() {
+  if (thread_tree_ == nullptr) {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.trees.emplace_back(new ThreadTree());
+    thread_tree_ = registry.trees.back().get();
+    thread_tree_->name = "thread " + std::to_string(registry.trees.size());
+    current_node_ = &thread_tree_->root;
+  }
+  return thread_tree_;
+}
+
+// Open a scope for site within the innermost open scope of this thread.
+profiler::Node* EnterScope(const profiler::Site* site) {
+  ThreadTree* tree = GetThreadTree();
+  current_node_ = current_node_->Child(site, &tree->mutex);
+  return current_node_;
+}
+
+void ReportNode(const profiler::Node& node, int depth, string* report) {
+  const profiler::Histogram& h = node.histogram;
+  const uint64_t count = h.Count();
+  auto ms = [](uint64_t ticks) { return 1e-6 * TicksToNanoseconds(ticks); };
+  char line[512];
+  snprintf(line, sizeof(line),
+           "%*s%-*s %10lu calls %11.3f ms total %9.3f ms mean"
+           "   p50 %9.3f  p99 %9.3f  max %9.3f ms\n",
+           2 * depth, "",
+           std::max(1, 48 - 2 * depth), node.site->name,
+           static_cast<unsigned long>(count),
+           ms(h.Total()),
+           (count > 0) ? ms(h.Total()) / count : 0.0,
+           ms(h.Percentile(0.5)),
+           ms(h.Percentile(0.99)),
+           ms(h.Max()));
+  *report += line;
+  for (const auto& child : node.children) {
+    ReportNode(*child, depth + 1, report);
+  }
+}
+
+struct PeriodicDump {
+  std::mutex mutex;
+  std::condition_variable stop_condition;
+  bool stop = false;
+  std::thread thread;
+};
+
+PeriodicDump periodic_dump_;
+
+void WriteReport(const string& file) {
+  // Write to a temporary file and rename it, so that readers never see a
+  // partial report.
+  const string tmp_file = file + ".tmp";
+  FILE* fid = fopen(tmp_file.c_str(), "w");
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to write profile %s\n", tmp_file.c_str());
+    return;
+  }
+  const string report = profiler::Report();
+  fwrite(report.data(), 1, report.size(), fid);
+  fclose(fid);
+  rename(tmp_file.c_str(), file.c_str());
+}
+
+}  // namespace
+
+namespace profiler {
+
+Histogram::Histogram() : count_(0), total_(0), max_(0) {
+  for (std::atomic<uint64_t>& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+int Histogram::Bucket(uint64_t duration) {
+  if (duration < 4) return static_cast<int>(duration);
+  const int exponent = 63 - __builtin_clzll(duration);
+  const int sub_bucket = static_cast<int>((duration >> (exponent - 2)) & 3);
+  return std::min(kNumBuckets - 1, 4 * (exponent - 1) + sub_bucket);
+}
+
+uint64_t Histogram::BucketStart(int bucket) {
+  if (bucket < 4) return bucket;
+  const int exponent = bucket / 4 + 1;
+  return static_cast<uint64_t>(4 + bucket % 4) << (exponent - 2);
+}
+
+void Histogram::Record(uint64_t duration) {
+  Increment(&count_, 1);
+  Increment(&total_, duration);
+  if (duration > max_.load(std::memory_order_relaxed)) {
+    max_.store(duration, std::memory_order_relaxed);
+  }
+  Increment(&buckets_[Bucket(duration)], 1);
+}
+
+uint64_t Histogram::Percentile(double q) const {
+  uint64_t total = 0;
+  for (const std::atomic<uint64_t>& bucket : buckets_) {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0) return 0;
+  const uint64_t target =
+      std::max<uint64_t>(1, static_cast<uint64_t>(ceil(q * total)));
+  uint64_t cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    if (cumulative >= target) {
+      // Middle of the bucket, but never more than the largest duration.
+      const uint64_t middle = (i + 1 < kNumBuckets) ?
+          (BucketStart(i) + BucketStart(i + 1)) / 2 : BucketStart(i);
+      return std::min(middle, Max());
+    }
+  }
+  return Max();
+}
+
+Node* Node::Child(const Site* child_site, std::mutex* tree_mutex) {
+  for (const auto& child : children) {
+    if (child->site == child_site) return child.get();
+  }
+  std::lock_guard<std::mutex> lock(*tree_mutex);
+  children.emplace_back(new Node(child_site, this));
+  return children.back().get();
+}
+
+void SetThreadName(const string& name) {
+  ThreadTree* tree = GetThreadTree();
+  std::lock_guard<std::mutex> lock(tree->mutex);
+  tree->name = name;
+}
+
+Scope::Scope(const Site* site) :
+    node_(EnterScope(site)), t_start_(GetTicks()) {}
+
+Scope::~Scope() {
+  node_->histogram.Record(GetTicks() - t_start_);
+  current_node_ = node_->parent;
+}
+
+string Report() {
+  Registry& registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  char header[128];
+  snprintf(header, sizeof(header), "Profile after %.1f s\n",
+           GetMonotonicTime() - registry.t_start);
+  string report = header;
+  for (const auto& tree : registry.trees) {
+    std::lock_guard<std::mutex> tree_lock(tree->mutex);
+    if (tree->root.children.empty()) continue;
+    report += "[" + tree->name + "]\n";
+    for (const auto& child : tree->root.children) {
+      ReportNode(*child, 1, &report);
+    }
+  }
+  return report;
+}
+
+bool StartPeriodicDump(const string& file, double period) {
+  std::lock_guard<std::mutex> lock(periodic_dump_.mutex);
+  if (periodic_dump_.thread.joinable()) return false;
+  periodic_dump_.stop = false;
+  periodic_dump_.thread = std::thread([file, period]() {
+    SetThreadName("profiler");
+    std::unique_lock<std::mutex> lock(periodic_dump_.mutex);
+    while (!periodic_dump_.stop) {
+      periodic_dump_.stop_condition.wait_for(
+          lock, std::chrono::duration<double>(period));
+      WriteReport(file);
+    }
+  });
+  return true;
+}
+
+void StopPeriodicDump() {
+  {
+    std::lock_guard<std::mutex> lock(periodic_dump_.mutex);
+    periodic_dump_.stop = true;
+  }
+  periodic_dump_.stop_condition.notify_all();
+  if (periodic_dump_.thread.joinable()) periodic_dump_.thread.join();
+}
+
+}  // namespace profiler
@@ -0,0 +1,161 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Hierarchical, thread-aware scoped profiler. Instrument code with the
+// PROFILE_SCOPE and PROFILE_FUNCTION macros, which compile to nothing unless
+// ENABLE_PROFILING is defined, as in the Profile build type (make profile_all):
+// ==============================
+// void Foo() {
+//   PROFILE_FUNCTION();
+//   for (...) {
+//     PROFILE_SCOPE("Foo inner loop");
+//     // ... Do some stuff ...
+//   }
+// }
+// ==============================
+// Every thread accumulates into its own tree of scopes, keyed by the path of
+// enclosing scopes, without locks or atomic read-modify-writes. Scopes are
+// timed with the TSC where it is invariant, which makes them cheap enough for
+// per-particle and per-voxel loops. Report()
+// renders the trees of all threads with invocation counts, total time and
+// latency percentiles, and StartPeriodicDump() writes it to a file
+// periodically.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef SRC_UTIL_PROFILER_H_
+#define SRC_UTIL_PROFILER_H_
+
+namespace profiler {
+
+// Static description of an instrumented scope. One is declared per call site
+// by the PROFILE_* macros, and its address identifies the scope.
+struct Site {
+  explicit Site(const char* name) : name(name) {}
+  const char* const name;
+};
+
+// Log-linear histogram of durations in GetTicks() ticks, with four buckets per
+// power of two, so percentiles are accurate to within 25%. Durations are only
+// converted to time when reporting, to keep recording cheap.
+class Histogram {
+ public:
+  static const int kNumBuckets = 4 * 42;
+
+  Histogram();
+
+  // Record a duration. Only one thread may record into a histogram, but any
+  // thread may read it concurrently.
+  void Record(uint64_t duration);
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t Total() const { return total_.load(std::memory_order_relaxed); }
+  uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+
+  // Approximate duration below which a fraction q of the recorded durations
+  // fall.
+  uint64_t Percentile(double q) const;
+
+  static int Bucket(uint64_t duration);
+  // Smallest duration that falls in the bucket.
+  static uint64_t BucketStart(int bucket);
+
+ private:
+  // Single-writer counters: the owning thread increments them with a relaxed
+  // load and store, which readers can never see torn.
+  static void Increment(std::atomic<uint64_t>* counter, uint64_t value) {
+    counter->store(counter->load(std::memory_order_relaxed) + value,
+                   std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> total_;
+  std::atomic<uint64_t> max_;
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+};
+
+// A scope in the tree of one thread, reached through a path of sites.
+struct Node {
+  Node(const Site* site, Node* parent) : site(site), parent(parent) {}
+
+  // Child for site, created if it does not exist yet. Only called by the
+  // thread that owns the tree.
+  Node* Child(const Site* site, std::mutex* tree_mutex);
+
+  const Site* const site;
+  Node* const parent;
+  Histogram histogram;
+  // Children are only added by the owning thread while holding the tree
+  // mutex, and only read by other threads while holding it.
+  std::vector<std::unique_ptr<Node>> children;
+};
+
+// Name the calling thread in reports.
+void SetThreadName(const std::string& name);
+
+// Time the enclosing scope, as a child of the innermost enclosing Scope of the
+// same thread.
+class Scope {
+ public:
+  explicit Scope(const Site* site);
+  ~Scope();
+
+ private:
+  // Disable copy constructor and assignment operator.
+  Scope(const Scope&);
+  void operator=(const Scope&);
+
+  Node* node_;
+  // Start time, in GetTicks() ticks.
+  const uint64_t t_start_;
+};
+
+// Text report of the scope trees of all threads.
+std::string Report();
+
+// Write Report() to file every period seconds from a background thread,
+// replacing the previous report. Returns false if dumps are already running.
+bool StartPeriodicDump(const std::string& file, double period);
+
+// Stop the background thread and write a final report.
+void StopPeriodicDump();
+
+}  // namespace profiler
+
+#define PROFILER_CONCAT_INNER(a, b) a ## b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#ifdef ENABLE_PROFILING
+#define PROFILE_SCOPE(name) \
+  static const ::profiler::Site PROFILER_CONCAT(profiler_site_, __LINE__)( \
+      name); \
+  const ::profiler::Scope PROFILER_CONCAT(profiler_scope_, __LINE__)( \
+      &PROFILER_CONCAT(profiler_site_, __LINE__))
+// Name the calling thread in reports.
+#define PROFILE_THREAD(name) ::profiler::SetThreadName(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_THREAD(name)
+#endif
+
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+
+#endif  // SRC_UTIL_PROFILER_H_
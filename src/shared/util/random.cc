@@ -20,8 +20,12 @@
 //========================================================================
 #include "random.h"
 
-#include <random>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
+#include <random>
 
 namespace util_random {
 
@@ -37,4 +41,247 @@ double Random::Gaussian(const double mean, const double stddev) {
   return mean + stddev * randn_(generator_);
 }
 
+namespace {
+
+// Philox4x32 multipliers and Weyl sequence key increments.
+const uint32_t kPhiloxM0 = 0xD2511F53;
+const uint32_t kPhiloxM1 = 0xCD9E8D57;
+const uint32_t kPhiloxW0 = 0x9E3779B9;
+const uint32_t kPhiloxW1 = 0xBB67AE85;
+const int kPhiloxRounds = 10;
+
+// Blocks hashed at once by the batch functions, one per vector lane.
+const int kLanes = 16;
+
+// Hash blocks [block, block + num_blocks) of a stream into words[j][k], word j
+// of block block + k. The blocks are structures of arrays, so that each round
+// is a loop over blocks. At -O2, only OpenMP makes GCC vectorize such loops.
+void PhiloxBlocks(uint64_t seed,
+                  uint64_t stream,
+                  uint64_t block,
+                  int num_blocks,
+                  uint32_t words[4][kLanes]) {
+  uint32_t* const c0 = words[0];
+  uint32_t* const c1 = words[1];
+  uint32_t* const c2 = words[2];
+  uint32_t* const c3 = words[3];
+  for (int k = 0; k < num_blocks; ++k) {
+    c0[k] = static_cast<uint32_t>(block + k);
+    c1[k] = static_cast<uint32_t>((block + k) >> 32);
+    c2[k] = static_cast<uint32_t>(stream);
+    c3[k] = static_cast<uint32_t>(stream >> 32);
+  }
+  uint32_t key0 = static_cast<uint32_t>(seed);
+  uint32_t key1 = static_cast<uint32_t>(seed >> 32);
+  for (int round = 0; round < kPhiloxRounds; ++round) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int k = 0; k < num_blocks; ++k) {
+      const uint64_t product0 = static_cast<uint64_t>(kPhiloxM0) * c0[k];
+      const uint64_t product1 = static_cast<uint64_t>(kPhiloxM1) * c2[k];
+      c0[k] = static_cast<uint32_t>(product1 >> 32) ^ c1[k] ^ key0;
+      c1[k] = static_cast<uint32_t>(product1);
+      c2[k] = static_cast<uint32_t>(product0 >> 32) ^ c3[k] ^ key1;
+      c3[k] = static_cast<uint32_t>(product0);
+    }
+    key0 += kPhiloxW0;
+    key1 += kPhiloxW1;
+  }
+}
+
+// The top 24 bits of a word, which a float holds exactly, in [0, 1).
+inline float UnitFloat(uint32_t word) {
+  return (word >> 8) * (1.0f / 16777216.0f);
+}
+
+// The following approximations are accurate to about one float ulp, and have
+// no calls or branches, unlike the libm functions, so loops over them
+// vectorize. The polynomials are those of the Cephes library.
+
+// Natural log of a normal, positive x.
+inline float Log(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  // x = m * 2^e, with m in [sqrt(1/2), sqrt(2)], split with integer operations
+  // since floating point ones are not if-converted, as they may trap.
+  const uint32_t mantissa = bits & 0x007FFFFF;
+  const uint32_t high = (mantissa > 0x003504F3) ? 1 : 0;
+  const float e =
+      static_cast<float>(static_cast<int>((bits >> 23) + high) - 127);
+  const uint32_t m_bits = mantissa | (0x3F800000 - (high << 23));
+  float m;
+  memcpy(&m, &m_bits, sizeof(m));
+  const float t = m - 1.0f;
+  const float t2 = t * t;
+  float p = 7.0376836292e-2f;
+  p = p * t - 1.1514610310e-1f;
+  p = p * t + 1.1676998740e-1f;
+  p = p * t - 1.2420140846e-1f;
+  p = p * t + 1.4249322787e-1f;
+  p = p * t - 1.6668057665e-1f;
+  p = p * t + 2.0000714765e-1f;
+  p = p * t - 2.4999993993e-1f;
+  p = p * t + 3.3333331174e-1f;
+  return t + (p * t * t2 - 2.12194440e-4f * e - 0.5f * t2) +
+      0.693359375f * e;
+}
+
+// Square root of x >= 0, as x times Newton iterations of its reciprocal, since
+// sqrtf() sets errno, which is a branch.
+inline float Sqrt(float x) {
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5F3759DF - (bits >> 1);
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  const float half_x = 0.5f * x;
+  y = y * (1.5f - half_x * y * y);
+  y = y * (1.5f - half_x * y * y);
+  y = y * (1.5f - half_x * y * y);
+  return x * y;
+}
+
+// Sine and cosine of x in [-pi/4, pi/4].
+inline float SinQuarter(float x) {
+  const float x2 = x * x;
+  return x + x * x2 * (-1.6666654611e-1f +
+                       x2 * (8.3321608736e-3f - x2 * 1.9515295891e-4f));
+}
+
+inline float CosQuarter(float x) {
+  const float x2 = x * x;
+  return 1.0f - 0.5f * x2 +
+      x2 * x2 * (4.166664568298827e-2f +
+                 x2 * (-1.388731625493765e-3f + x2 * 2.443315711809948e-5f));
+}
+
+// Pair of independent standard normal samples from a pair of random words,
+// by the Box-Muller transform. The radius is drawn from the top 24 bits of
+// radius_word, in (0, 1] so that its log is finite, which cuts off the tails
+// beyond 5.7 standard deviations. The direction is drawn within a quarter of
+// the circle from the top 24 bits of angle_word, and moved to a random
+// quarter, with the same distribution, by reflections chosen by its low bits.
+inline void BoxMuller(uint32_t radius_word,
+                      uint32_t angle_word,
+                      float* z0,
+                      float* z1) {
+  const float radius =
+      Sqrt(-2.0f * Log(((radius_word >> 8) + 1) * (1.0f / 16777216.0f)));
+  const float angle = (UnitFloat(angle_word) - 0.5f) * 1.57079632679f;
+  const float c = CosQuarter(angle);
+  const float s = SinQuarter(angle);
+  const float swap = static_cast<float>(angle_word & 1);
+  const float signed_radius =
+      radius * (1.0f - static_cast<float>(angle_word & 2));
+  *z0 = signed_radius * (c + swap * (s - c));
+  *z1 = signed_radius * (s + swap * (c - s));
+}
+
+}  // namespace
+
+CounterRandom::CounterRandom(uint64_t seed, uint64_t stream) :
+    seed_(seed),
+    stream_(stream),
+    block_(0),
+    num_outputs_(0),
+    gaussian_(0),
+    has_gaussian_(false) {}
+
+void CounterRandom::Seek(uint64_t block) {
+  block_ = block;
+  num_outputs_ = 0;
+  has_gaussian_ = false;
+}
+
+uint32_t CounterRandom::RandomUint32() {
+  if (num_outputs_ == 0) {
+    uint32_t words[4][kLanes];
+    PhiloxBlocks(seed_, stream_, block_, 1, words);
+    ++block_;
+    for (int j = 0; j < 4; ++j) outputs_[j] = words[j][0];
+    num_outputs_ = 4;
+  }
+  return outputs_[4 - num_outputs_--];
+}
+
+double CounterRandom::UniformRandom() {
+  // 53 random bits, as many as a double holds.
+  const uint64_t high = RandomUint32() >> 5;
+  const uint64_t low = RandomUint32() >> 6;
+  return (high * 67108864.0 + low) * (1.0 / 9007199254740992.0);
+}
+
+double CounterRandom::UniformRandom(double a, double b) {
+  return (b - a) * UniformRandom() + a;
+}
+
+double CounterRandom::Gaussian(double mean, double stddev) {
+  if (has_gaussian_) {
+    has_gaussian_ = false;
+    return mean + stddev * gaussian_;
+  }
+  // Box-Muller transform, of a radius in (0, 1] so that its log is finite.
+  const double radius = sqrt(-2.0 * log(1.0 - UniformRandom()));
+  const double angle = 2.0 * M_PI * UniformRandom();
+  gaussian_ = radius * sin(angle);
+  has_gaussian_ = true;
+  return mean + stddev * radius * cos(angle);
+}
+
+void CounterRandom::FillUniform(float* values, size_t n, float a, float b) {
+  const float scale = b - a;
+  uint32_t words[4][kLanes];
+  float uniforms[4][kLanes];
+  for (size_t i = 0; i < n;) {
+    const int num_blocks =
+        static_cast<int>(std::min<size_t>(kLanes, (n - i + 3) / 4));
+    PhiloxBlocks(seed_, stream_, block_, num_blocks, words);
+    block_ += num_blocks;
+    for (int j = 0; j < 4; ++j) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int k = 0; k < num_blocks; ++k) {
+        uniforms[j][k] = a + scale * UnitFloat(words[j][k]);
+      }
+    }
+    const size_t count = std::min<size_t>(n - i, 4 * num_blocks);
+    for (size_t m = 0; m < count; ++m) values[i + m] = uniforms[m % 4][m / 4];
+    i += count;
+  }
+  num_outputs_ = 0;
+}
+
+void CounterRandom::FillGaussian(float* values,
+                                 size_t n,
+                                 float mean,
+                                 float stddev) {
+  uint32_t words[4][kLanes];
+  float gaussians[4][kLanes];
+  for (size_t i = 0; i < n;) {
+    const int num_blocks =
+        static_cast<int>(std::min<size_t>(kLanes, (n - i + 3) / 4));
+    PhiloxBlocks(seed_, stream_, block_, num_blocks, words);
+    block_ += num_blocks;
+    // Words 0 and 1, and words 2 and 3, of each block make a pair.
+    for (int j = 0; j < 4; j += 2) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+      for (int k = 0; k < num_blocks; ++k) {
+        float z0;
+        float z1;
+        BoxMuller(words[j][k], words[j + 1][k], &z0, &z1);
+        gaussians[j][k] = mean + stddev * z0;
+        gaussians[j + 1][k] = mean + stddev * z1;
+      }
+    }
+    const size_t count = std::min<size_t>(n - i, 4 * num_blocks);
+    for (size_t m = 0; m < count; ++m) values[i + m] = gaussians[m % 4][m / 4];
+    i += count;
+  }
+  num_outputs_ = 0;
+}
+
 }  // namespace util_random
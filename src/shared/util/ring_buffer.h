@@ -0,0 +1,84 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Fixed-capacity ring buffer that never allocates after construction.
+
+#include <stddef.h>
+
+#include <array>
+
+#include "glog/logging.h"
+
+#ifndef SRC_UTIL_RING_BUFFER_H_
+#define SRC_UTIL_RING_BUFFER_H_
+
+// FIFO of at most N elements, stored inline. Pushing onto a full buffer
+// overwrites its oldest element. Elements are indexed from oldest to newest.
+template <typename T, size_t N>
+class RingBuffer {
+ public:
+  RingBuffer() : head_(0), size_(0) {}
+
+  size_t Size() const { return size_; }
+
+  bool Empty() const { return size_ == 0; }
+
+  bool Full() const { return size_ == N; }
+
+  static size_t Capacity() { return N; }
+
+  void Clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // Append value as the newest element, dropping the oldest one if full.
+  void PushBack(const T& value) {
+    if (size_ == N) {
+      elements_[head_] = value;
+      head_ = (head_ + 1) % N;
+    } else {
+      elements_[(head_ + size_) % N] = value;
+      ++size_;
+    }
+  }
+
+  // Remove the oldest element. The buffer must not be empty.
+  void PopFront() {
+    DCHECK_GT(size_, 0);
+    head_ = (head_ + 1) % N;
+    --size_;
+  }
+
+  // Oldest element. The buffer must not be empty.
+  const T& Front() const { return (*this)[0]; }
+
+  // Newest element. The buffer must not be empty.
+  const T& Back() const { return (*this)[size_ - 1]; }
+
+  // The i-th oldest element, for i in [0, Size()).
+  const T& operator[](size_t i) const {
+    DCHECK_LT(i, size_);
+    return elements_[(head_ + i) % N];
+  }
+
+ private:
+  std::array<T, N> elements_;
+  // Slot of the oldest element.
+  size_t head_;
+  size_t size_;
+};
+
+#endif  // SRC_UTIL_RING_BUFFER_H_
@@ -0,0 +1,113 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Sequence lock, to share the latest value of a small plain-old-data object,
+// such as a pose, from one writer thread with any number of reader threads.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <type_traits>
+
+#include "util/cache_line.h"
+
+#ifndef SRC_UTIL_SEQLOCK_H_
+#define SRC_UTIL_SEQLOCK_H_
+
+// Store() never blocks or waits for readers. Load() never blocks the writer:
+// it copies the value and retries if a Store() ran meanwhile, which a sequence
+// number that is odd during a Store() tells it. Readers therefore only wait
+// for the few nanoseconds of a Store(), which makes this suited to values
+// small enough to copy in a few cache lines, unlike TripleBuffer. T is copied
+// bytewise, so it must not own memory or other resources: structs of numbers
+// and fixed-size Eigen types are fine, std::vector is not. Exactly one thread
+// may store, and any number may load.
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_destructible<T>::value,
+                "SeqLock values are copied bytewise, so they cannot own "
+                "resources");
+
+ public:
+  SeqLock() {}
+
+  explicit SeqLock(const T& value) : SeqLock() { Store(value); }
+
+  void Store(const T& value) {
+    uint64_t words[kNumWords] = {};
+    memcpy(words, &value, sizeof(T));
+    std::atomic<uint64_t>& sequence = state_.value.sequence;
+    std::atomic<uint64_t>* const shared_words = state_.value.words;
+    const uint64_t s = sequence.load(std::memory_order_relaxed);
+    sequence.store(s + 1, std::memory_order_relaxed);
+    // Readers that see any of the new words also see the odd sequence.
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kNumWords; ++i) {
+      shared_words[i].store(words[i], std::memory_order_relaxed);
+    }
+    sequence.store(s + 2, std::memory_order_release);
+  }
+
+  // The latest stored value.
+  T Load() const { return Load(nullptr); }
+
+  // The latest stored value, and its version: the number of values stored up
+  // to and including it, so that a reader can tell whether it is new to it.
+  T Load(uint64_t* version) const {
+    const std::atomic<uint64_t>& sequence = state_.value.sequence;
+    const std::atomic<uint64_t>* const shared_words = state_.value.words;
+    uint64_t words[kNumWords];
+    uint64_t s0 = 0;
+    uint64_t s1 = 0;
+    do {
+      s0 = sequence.load(std::memory_order_acquire);
+      for (size_t i = 0; i < kNumWords; ++i) {
+        words[i] = shared_words[i].load(std::memory_order_relaxed);
+      }
+      // The words are read before the sequence is checked again.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      s1 = sequence.load(std::memory_order_relaxed);
+    } while ((s0 & 1) != 0 || s0 != s1);
+    if (version != nullptr) *version = s0 / 2;
+    T value;
+    memcpy(static_cast<void*>(&value), words, sizeof(T));
+    return value;
+  }
+
+ private:
+  // Disable copy constructor and assignment operator.
+  SeqLock(const SeqLock&);
+  void operator=(const SeqLock&);
+
+  static const size_t kNumWords = (sizeof(T) + 7) / 8;
+
+  struct State {
+    State() : sequence(0) {
+      for (std::atomic<uint64_t>& word : words) {
+        word.store(0, std::memory_order_relaxed);
+      }
+    }
+    // Odd while a Store() is in progress.
+    std::atomic<uint64_t> sequence;
+    // The value is kept in atomic words, so that reading it while it is
+    // being stored is not a data race.
+    std::atomic<uint64_t> words[kNumWords];
+  };
+
+  CacheLinePadded<State> state_;
+};
+
+#endif  // SRC_UTIL_SEQLOCK_H_
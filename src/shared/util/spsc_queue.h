@@ -0,0 +1,119 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Lock-free bounded FIFO, to pass every one of a stream of values from one
+// producer thread to one consumer thread.
+
+#include <stddef.h>
+
+#include <array>
+#include <atomic>
+#include <utility>
+
+#include "util/cache_line.h"
+
+#ifndef SRC_UTIL_SPSC_QUEUE_H_
+#define SRC_UTIL_SPSC_QUEUE_H_
+
+// Ring buffer of N slots, N a power of two. The producer calls TryPush() and
+// the consumer TryPop(); neither ever blocks, they fail instead when the queue
+// is full or empty. Unlike TripleBuffer, no value is ever dropped. The
+// producer's and consumer's positions are on cache lines of their own, along
+// with each side's cached copy of the other's position, so that a side only
+// reads the other's cache line when its cached copy says the queue is full or
+// empty. Exactly one thread may push, and exactly one may pop.
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+ public:
+  SpscQueue() : slots_() {}
+
+  static size_t Capacity() { return N; }
+
+  // Append a value, unless the queue is full. Returns false iff it is.
+  bool TryPush(const T& value) {
+    T copy(value);
+    return TryPush(std::move(copy));
+  }
+
+  bool TryPush(T&& value) {
+    Producer& producer = producer_.value;
+    const size_t tail = producer.tail.load(std::memory_order_relaxed);
+    if (tail - producer.cached_head == N) {
+      producer.cached_head =
+          consumer_.value.head.load(std::memory_order_acquire);
+      if (tail - producer.cached_head == N) return false;
+    }
+    slots_[tail & kIndexMask] = std::move(value);
+    producer.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Remove the oldest value into value, unless the queue is empty. Returns
+  // false iff it is.
+  bool TryPop(T* value) {
+    Consumer& consumer = consumer_.value;
+    const size_t head = consumer.head.load(std::memory_order_relaxed);
+    if (head == consumer.cached_tail) {
+      consumer.cached_tail =
+          producer_.value.tail.load(std::memory_order_acquire);
+      if (head == consumer.cached_tail) return false;
+    }
+    *value = std::move(slots_[head & kIndexMask]);
+    consumer.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Number of values in the queue. Exact when called by the producer or the
+  // consumer while the other is idle, and a snapshot otherwise.
+  size_t Size() const {
+    const size_t head = consumer_.value.head.load(std::memory_order_acquire);
+    const size_t tail = producer_.value.tail.load(std::memory_order_acquire);
+    return tail - head;
+  }
+
+  bool Empty() const { return Size() == 0; }
+
+ private:
+  // Disable copy constructor and assignment operator.
+  SpscQueue(const SpscQueue&);
+  void operator=(const SpscQueue&);
+
+  static const size_t kIndexMask = N - 1;
+
+  // Positions count pushes and pops since construction, and are only reduced
+  // to slot indices when accessing slots, so that a full queue is told apart
+  // from an empty one.
+  struct Producer {
+    Producer() : tail(0), cached_head(0) {}
+    std::atomic<size_t> tail;
+    // Consumer position as last read by the producer, never ahead of it.
+    size_t cached_head;
+  };
+  struct Consumer {
+    Consumer() : head(0), cached_tail(0) {}
+    std::atomic<size_t> head;
+    // Producer position as last read by the consumer, never ahead of it.
+    size_t cached_tail;
+  };
+
+  CacheLinePadded<Producer> producer_;
+  CacheLinePadded<Consumer> consumer_;
+  std::array<T, N> slots_;
+};
+
+#endif  // SRC_UTIL_SPSC_QUEUE_H_
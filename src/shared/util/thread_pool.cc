@@ -0,0 +1,216 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+
+#include "util/thread_pool.h"
+
+#include <glog/logging.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Chunks per thread of a loop with the grain left to the pool: enough for
+// stealing to even out the load, and few enough that scheduling them costs
+// little next to running them.
+const size_t kChunksPerThread = 4;
+
+// Chunks of a deterministic reduction with the grain left to the pool. It may
+// not depend on the number of threads, so it is sized for a large machine.
+const size_t kDeterministicChunks = 64;
+
+// Attempts to find a task before a worker goes to sleep, since loops tend to
+// come in bursts, as one per scan.
+const int kSpinsBeforeSleep = 64;
+
+// The pool that the current thread is a worker of, if any, and its index.
+thread_local const ThreadPool* current_pool_ = nullptr;
+thread_local int current_worker_ = -1;
+
+int NumWorkers(const ThreadPool::Options& options) {
+  const int num_threads = (options.num_threads > 0) ?
+      options.num_threads :
+      static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(0, num_threads - 1);
+}
+
+void PinThread(std::thread* thread, int cpu) {
+#ifdef __linux__
+  const int num_cpus =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu % num_cpus, &cpus);
+  const int error =
+      pthread_setaffinity_np(thread->native_handle(), sizeof(cpus), &cpus);
+  if (error != 0) {
+    LOG(WARNING) << "Unable to pin thread pool worker to CPU "
+                 << cpu % num_cpus << ", error " << error;
+  }
+#else
+  LOG(WARNING) << "Pinning thread pool workers is only supported on Linux";
+#endif
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool() : ThreadPool(Options()) {}
+
+ThreadPool::ThreadPool(const Options& options) :
+    num_workers_(NumWorkers(options)),
+    queues_(new CacheLinePadded<Queue>[num_workers_]),
+    num_queued_(0),
+    next_queue_(0),
+    num_sleeping_(0),
+    stop_(false) {
+  for (int k = 0; k < num_workers_; ++k) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, k);
+    if (options.pin_threads) {
+      PinThread(&workers_.back(), options.first_cpu + 1 + k);
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+ThreadPool& ThreadPool::Default() {
+  static ThreadPool pool;
+  return pool;
+}
+
+size_t ThreadPool::ChunkSize(size_t num_indices,
+                             size_t grain,
+                             bool deterministic) const {
+  if (grain > 0) return grain;
+  const size_t num_chunks = deterministic ?
+      kDeterministicChunks : kChunksPerThread * NumThreads();
+  return std::max<size_t>(1, (num_indices + num_chunks - 1) / num_chunks);
+}
+
+void ThreadPool::RunChunks(size_t num_chunks,
+                           const std::function<void(size_t)>& chunk_body) {
+  if (num_workers_ == 0 || num_chunks <= 1) {
+    for (size_t chunk = 0; chunk < num_chunks; ++chunk) chunk_body(chunk);
+    return;
+  }
+  const int self = (current_pool_ == this) ? current_worker_ : -1;
+  Loop loop;
+  loop.chunk_body = &chunk_body;
+  loop.remaining_chunks.store(num_chunks, std::memory_order_relaxed);
+  Execute(Task{&loop, 0, num_chunks}, self);
+  // Help with whatever is queued, possibly chunks of other loops, until the
+  // chunks that were stolen from this loop are done.
+  Task task;
+  while (loop.remaining_chunks.load(std::memory_order_acquire) > 0) {
+    if (TakeTask(self, &task)) {
+      Execute(task, self);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::Execute(Task task, int self) {
+  while (task.end - task.begin > 1) {
+    const size_t middle = task.begin + (task.end - task.begin) / 2;
+    Push(Task{task.loop, middle, task.end}, self);
+    task.end = middle;
+  }
+  (*task.loop->chunk_body)(task.begin);
+  // Publishes what the chunk wrote to the thread waiting for the loop.
+  task.loop->remaining_chunks.fetch_sub(1, std::memory_order_release);
+}
+
+void ThreadPool::Push(const Task& task, int self) {
+  const int index = (self >= 0) ?
+      self : next_queue_.fetch_add(1, std::memory_order_relaxed) % num_workers_;
+  // Counted before it is queued, so that the count is never less than the
+  // number of queued tasks.
+  num_queued_.fetch_add(1);
+  {
+    Queue& queue = queues_[index].value;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(task);
+  }
+  // A worker counts itself as sleeping before it checks num_queued_, so either
+  // it sees this task or this sees it.
+  if (num_sleeping_.load() > 0) {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    wake_.notify_one();
+  }
+}
+
+bool ThreadPool::TakeTask(int self, Task* task) {
+  if (num_queued_.load(std::memory_order_relaxed) == 0) return false;
+  if (self >= 0) {
+    Queue& queue = queues_[self].value;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = queue.tasks.back();
+      queue.tasks.pop_back();
+      num_queued_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  const unsigned int first = (self >= 0) ?
+      self + 1 : next_queue_.load(std::memory_order_relaxed);
+  for (int k = 0; k < num_workers_; ++k) {
+    const int victim = (first + k) % num_workers_;
+    if (victim == self) continue;
+    Queue& queue = queues_[victim].value;
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      *task = queue.tasks.front();
+      queue.tasks.pop_front();
+      num_queued_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::WorkerLoop(int self) {
+  current_pool_ = this;
+  current_worker_ = self;
+  Task task;
+  while (true) {
+    bool found = false;
+    for (int spin = 0; spin < kSpinsBeforeSleep && !found; ++spin) {
+      found = TakeTask(self, &task);
+      if (!found) std::this_thread::yield();
+    }
+    if (found) {
+      Execute(task, self);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    num_sleeping_.fetch_add(1);
+    wake_.wait(lock, [this]() { return stop_ || num_queued_.load() > 0; });
+    num_sleeping_.fetch_sub(1);
+    if (stop_) return;
+  }
+}
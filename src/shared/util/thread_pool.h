@@ -0,0 +1,207 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Work-stealing thread pool for data-parallel loops, shared by the particle,
+// voxel and path option loops instead of each spawning threads of its own:
+// ==============================
+// ThreadPool::Default().ParallelFor(0, particles.size(), 0, [&](size_t i) {
+//   weights[i] = Likelihood(particles[i]);
+// });
+// const double total = ThreadPool::Default().ParallelReduce(
+//     0, weights.size(), 0, 0.0,
+//     [&](size_t i) { return weights[i]; },
+//     [](double a, double b) { return a + b; });
+// ==============================
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util/cache_line.h"
+
+#ifndef SRC_UTIL_THREAD_POOL_H_
+#define SRC_UTIL_THREAD_POOL_H_
+
+// A loop is cut into chunks of consecutive indices, and the range of chunks is
+// split in halves on demand: a thread keeps the lower half and pushes the upper
+// half onto the back of its own queue, until it is left with one chunk to run,
+// and then pops the next range from the back. Idle threads steal the oldest,
+// and so largest, range from the front of another thread's queue, so that load
+// balances itself with few steals. The thread that calls ParallelFor() runs
+// chunks too until the loop is done, so loops may be nested, and a pool of one
+// thread runs loops inline. Loop bodies must not throw.
+class ThreadPool {
+ public:
+  struct Options {
+    Options() : num_threads(0), pin_threads(false), first_cpu(0) {}
+
+    // Threads that run a loop, including the calling thread. 0 for one per
+    // hardware thread.
+    int num_threads;
+    // Pin worker k, counting from 0, to CPU first_cpu + 1 + k, modulo the
+    // number of CPUs, leaving CPU first_cpu to the calling thread. Keeps the
+    // caches of workers warm, at the cost of sharing CPUs with other
+    // processes badly. Only supported on Linux.
+    bool pin_threads;
+    int first_cpu;
+  };
+
+  enum class Reduction {
+    // Chunking depends only on the range and grain, and chunk results are
+    // combined in index order, so the result is the same for any number of
+    // threads and any schedule, even if combine is not associative, as with
+    // floating point sums.
+    kDeterministic,
+    // Chunk results are combined in the order chunks finish, and the chunk
+    // size adapts to the number of threads.
+    kFast,
+  };
+
+  ThreadPool();
+
+  explicit ThreadPool(const Options& options);
+
+  // Waits for the workers to finish the chunks they are running.
+  ~ThreadPool();
+
+  // Pool of one thread per hardware thread, created on first use, for
+  // everything that does not need its own.
+  static ThreadPool& Default();
+
+  int NumThreads() const { return num_workers_ + 1; }
+
+  // Calls body(i) for every i in [begin, end), in chunks of grain indices, and
+  // returns once all calls returned. A grain of 0 picks one from the number of
+  // threads; pass a larger one if single iterations are very cheap.
+  template <typename Body>
+  void ParallelFor(size_t begin, size_t end, size_t grain, const Body& body) {
+    if (end <= begin) return;
+    const size_t chunk_size = ChunkSize(end - begin, grain, false);
+    RunChunks((end - begin + chunk_size - 1) / chunk_size,
+              [begin, end, chunk_size, &body](size_t chunk) {
+      const size_t chunk_begin = begin + chunk * chunk_size;
+      const size_t chunk_end = std::min(end, chunk_begin + chunk_size);
+      for (size_t i = chunk_begin; i < chunk_end; ++i) body(i);
+    });
+  }
+
+  // combine(...combine(combine(identity, map(begin)), map(begin + 1))...,
+  // map(end - 1)), computed in parallel by reducing chunks independently,
+  // starting from identity, and combining their results. identity must
+  // therefore be neutral for combine.
+  template <typename T, typename Map, typename Combine>
+  T ParallelReduce(size_t begin, size_t end, size_t grain, const T& identity,
+                   const Map& map, const Combine& combine,
+                   Reduction reduction = Reduction::kDeterministic) {
+    if (end <= begin) return identity;
+    const bool deterministic = (reduction == Reduction::kDeterministic);
+    const size_t chunk_size = ChunkSize(end - begin, grain, deterministic);
+    const size_t num_chunks = (end - begin + chunk_size - 1) / chunk_size;
+    auto reduce_chunk = [&](size_t chunk) {
+      const size_t chunk_begin = begin + chunk * chunk_size;
+      const size_t chunk_end = std::min(end, chunk_begin + chunk_size);
+      T result = identity;
+      for (size_t i = chunk_begin; i < chunk_end; ++i) {
+        result = combine(result, map(i));
+      }
+      return result;
+    };
+    if (deterministic) {
+      std::vector<T> chunk_results(num_chunks, identity);
+      RunChunks(num_chunks, [&](size_t chunk) {
+        chunk_results[chunk] = reduce_chunk(chunk);
+      });
+      T result = chunk_results[0];
+      for (size_t chunk = 1; chunk < num_chunks; ++chunk) {
+        result = combine(result, chunk_results[chunk]);
+      }
+      return result;
+    }
+    std::mutex result_mutex;
+    T result = identity;
+    RunChunks(num_chunks, [&](size_t chunk) {
+      const T chunk_result = reduce_chunk(chunk);
+      std::lock_guard<std::mutex> lock(result_mutex);
+      result = combine(result, chunk_result);
+    });
+    return result;
+  }
+
+ private:
+  // Disable copy constructor and assignment operator.
+  ThreadPool(const ThreadPool&);
+  void operator=(const ThreadPool&);
+
+  // One call to RunChunks().
+  struct Loop {
+    const std::function<void(size_t)>* chunk_body;
+    std::atomic<size_t> remaining_chunks;
+  };
+
+  // Chunks [begin, end) of a loop.
+  struct Task {
+    Loop* loop;
+    size_t begin;
+    size_t end;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  size_t ChunkSize(size_t num_indices, size_t grain, bool deterministic) const;
+
+  // Calls chunk_body(chunk) for every chunk in [0, num_chunks), and returns
+  // once all calls returned.
+  void RunChunks(size_t num_chunks,
+                 const std::function<void(size_t)>& chunk_body);
+
+  // Runs chunks of the task, pushing what it does not run itself onto the
+  // queue of worker self, or of any worker if self is negative.
+  void Execute(Task task, int self);
+
+  void Push(const Task& task, int self);
+
+  // Pops the newest task of worker self, or steals the oldest task of another
+  // worker. Returns false if all queues are empty.
+  bool TakeTask(int self, Task* task);
+
+  void WorkerLoop(int self);
+
+  const int num_workers_;
+  std::unique_ptr<CacheLinePadded<Queue>[]> queues_;
+  std::vector<std::thread> workers_;
+
+  // Tasks in all queues, to tell whether a worker may sleep.
+  std::atomic<size_t> num_queued_;
+  // Queue that the next task pushed from outside the pool goes to.
+  std::atomic<unsigned int> next_queue_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<int> num_sleeping_;
+  bool stop_;
+};
+
+#endif  // SRC_UTIL_THREAD_POOL_H_
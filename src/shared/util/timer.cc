@@ -22,7 +22,11 @@
 #include <inttypes.h>
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 #include <algorithm>
 #include <string>
@@ -46,6 +50,100 @@ uint64_t RDTSC() {
 }
 #endif
 
+namespace {
+// Rate of the clock behind GetTicks().
+struct TickCalibration {
+  bool use_tsc;
+  double ns_per_tick;
+};
+
+uint64_t MonotonicNanoseconds() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL +
+      static_cast<uint64_t>(ts.tv_nsec);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+// Sample the TSC and CLOCK_MONOTONIC at the same instant, as closely as
+// possible: keep the tightest of a few clock reads bracketing a TSC read, so
+// that a preemption between the reads does not skew the calibration.
+void SampleClocks(uint64_t* ns, uint64_t* tsc) {
+  uint64_t best_width = UINT64_MAX;
+  for (int i = 0; i < 5; ++i) {
+    const uint64_t t0 = MonotonicNanoseconds();
+    const uint64_t cycles = RDTSC();
+    const uint64_t t1 = MonotonicNanoseconds();
+    if (t1 - t0 < best_width) {
+      best_width = t1 - t0;
+      *ns = t0 + (t1 - t0) / 2;
+      *tsc = cycles;
+    }
+  }
+}
+#endif
+
+TickCalibration Calibrate() {
+  TickCalibration calibration = {false, 1.0};
+#if defined(__i386__) || defined(__x86_64__)
+  if (!HasInvariantTSC()) return calibration;
+  uint64_t ns0 = 0, tsc0 = 0, ns1 = 0, tsc1 = 0;
+  SampleClocks(&ns0, &tsc0);
+  // Sampling jitter is tens of nanoseconds, so 10ms calibrates the rate to
+  // within a few parts per million.
+  usleep(10000);
+  SampleClocks(&ns1, &tsc1);
+  if (tsc1 > tsc0 && ns1 > ns0) {
+    calibration.use_tsc = true;
+    calibration.ns_per_tick =
+        static_cast<double>(ns1 - ns0) / static_cast<double>(tsc1 - tsc0);
+  }
+#endif
+  return calibration;
+}
+
+const TickCalibration& GetTickCalibration() {
+  static const TickCalibration calibration = Calibrate();
+  return calibration;
+}
+}  // namespace
+
+bool HasInvariantTSC() {
+#if defined(__i386__) || defined(__x86_64__)
+  // CPUID leaf 0x80000007 reports the invariant TSC in bit 8 of EDX.
+  unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+  if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 ||
+      eax < 0x80000007 ||
+      __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 ||
+      (edx & (1u << 8)) == 0) {
+    return false;
+  }
+  // The kernel switches away from the TSC if it finds it unsynchronized
+  // across cores, or unstable under a hypervisor.
+  FILE* fid = fopen(
+      "/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+  if (fid == NULL) return true;
+  char clock_source[64] = {0};
+  const bool is_tsc = fgets(clock_source, sizeof(clock_source), fid) != NULL &&
+      strncmp(clock_source, "tsc", 3) == 0;
+  fclose(fid);
+  return is_tsc;
+#else
+  return false;
+#endif
+}
+
+uint64_t GetTicks() {
+#if defined(__i386__) || defined(__x86_64__)
+  if (GetTickCalibration().use_tsc) return RDTSC();
+#endif
+  return MonotonicNanoseconds();
+}
+
+double TicksToNanoseconds(uint64_t ticks) {
+  return static_cast<double>(ticks) * GetTickCalibration().ns_per_tick;
+}
+
 double GetWallTime() {
   timespec ts;
   clock_gettime(CLOCK_REALTIME, &ts);
@@ -62,6 +160,14 @@ double GetMonotonicTime() {
   return time;
 }
 
+double GetProcessCpuTime() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  const double time =
+      static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec)*(1.0E-9);
+  return time;
+}
+
 void Sleep(double duration) {
   const useconds_t duration_usec = static_cast<useconds_t>(duration * 1.0E6);
   usleep(duration_usec);
@@ -78,43 +184,49 @@ void RateLoop::Sleep() {
 }
 
 FunctionTimer::FunctionTimer(const char* name) :
-    name_(name), t_start_(GetMonotonicTime()), t_lap_start_(t_start_) {}
+    name_(name), t_start_(GetTicks()), t_lap_start_(t_start_) {}
 
 FunctionTimer::~FunctionTimer() {
-  const double t_stop = GetMonotonicTime();
-  printf("%s: %f ms\n", name_.c_str(), 1.0E3 * (t_stop - t_start_));
+  const uint64_t t_stop = GetTicks();
+  printf("%s: %f ms\n",
+         name_.c_str(),
+         1.0E-6 * TicksToNanoseconds(t_stop - t_start_));
 }
 
 void FunctionTimer::Lap(int id) {
-  const double t_now = GetMonotonicTime();
+  const uint64_t t_now = GetTicks();
   printf("%s(%d): %f ms\n",
          name_.c_str(),
          id,
-         1.0E3 * (t_now - t_lap_start_));
+         1.0E-6 * TicksToNanoseconds(t_now - t_lap_start_));
   t_lap_start_ = t_now;
 }
 
 CumulativeFunctionTimer::Invocation::Invocation(
     CumulativeFunctionTimer* cumulative_timer) :
-    t_start_(GetMonotonicTime()), cumulative_timer_(cumulative_timer) {}
+    t_start_(GetTicks()), cumulative_timer_(cumulative_timer) {}
 
 CumulativeFunctionTimer::Invocation::~Invocation() {
-  const double t_duration = GetMonotonicTime() - t_start_;
-  cumulative_timer_->total_invocations_++;
-  cumulative_timer_->total_run_time_ += t_duration;
+  const uint64_t t_duration = GetTicks() - t_start_;
+  cumulative_timer_->total_invocations_.fetch_add(1, std::memory_order_relaxed);
+  cumulative_timer_->total_run_time_ns_.fetch_add(
+      static_cast<uint64_t>(TicksToNanoseconds(t_duration)),
+      std::memory_order_relaxed);
 }
 
 CumulativeFunctionTimer::CumulativeFunctionTimer(const char* name) :
-    name_(name), total_run_time_(0.0), total_invocations_(0) {}
+    name_(name), total_run_time_ns_(0), total_invocations_(0) {}
 
 CumulativeFunctionTimer::~CumulativeFunctionTimer() {
-  const double mean_run_time =
-      total_run_time_ / static_cast<double>(total_invocations_);
+  const uint64_t total_invocations = total_invocations_.load();
+  const double mean_run_time = (total_invocations > 0) ?
+      1.0E-9 * total_run_time_ns_.load() /
+          static_cast<double>(total_invocations) : 0.0;
   printf("Run-time stats for %s : mean run time = %f ms, "
          "invocations = %" PRIu64 "\n",
          name_.c_str(),
          1.0E3 * mean_run_time,
-         total_invocations_);
+         total_invocations);
 }
 
 
@@ -21,6 +21,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <string>
 
 #ifndef SRC_UTIL_TIMER_H_
@@ -47,6 +48,20 @@ class RateLoop {
 // Return the value of the CPU TSC register.
 uint64_t RDTSC();
 
+// Returns true iff the CPU has an invariant TSC, which ticks at a constant
+// rate regardless of frequency scaling and sleep states, and the kernel trusts
+// it as a clock source.
+bool HasInvariantTSC();
+
+// Get a cheap monotonic timestamp in ticks, for profiling. Ticks are TSC cycles
+// when the TSC is invariant, and CLOCK_MONOTONIC nanoseconds otherwise. Only
+// differences between timestamps are meaningful.
+uint64_t GetTicks();
+
+// Convert a difference of GetTicks() timestamps to nanoseconds. The TSC rate is
+// calibrated against CLOCK_MONOTONIC at the first call to either function.
+double TicksToNanoseconds(uint64_t ticks);
+
 // Get wall time in seconds elapsed since epoch.
 double GetWallTime();
 
@@ -54,6 +69,10 @@ double GetWallTime();
 // for code profiling.
 double GetMonotonicTime();
 
+// Get the CPU time in seconds used by all threads of the process, including
+// thread pool workers.
+double GetProcessCpuTime();
+
 // Sleep for the specified duration in seconds.
 void Sleep(double duration);
 
@@ -83,10 +102,10 @@ class FunctionTimer {
  private:
   // Name of the timer.
   const std::string name_;
-  // Start time.
-  const double t_start_;
-  // Last lap start time.
-  double t_lap_start_;
+  // Start time, in ticks.
+  const uint64_t t_start_;
+  // Last lap start time, in ticks.
+  uint64_t t_lap_start_;
 };
 
 // Timer to profile repeated invocations of a function. To use this timer,
@@ -100,6 +119,8 @@ class FunctionTimer {
 //   // ... Do some stuff ...
 // }
 // ==============================
+// Invocations may run concurrently on several threads. For nested scopes and
+// latency percentiles, see the PROFILE_* macros in util/profiler.h.
 class CumulativeFunctionTimer {
  public:
   class Invocation {
@@ -116,8 +137,8 @@ class CumulativeFunctionTimer {
     Invocation();
 
    private:
-    // Start time.
-    const double t_start_;
+    // Start time, in ticks.
+    const uint64_t t_start_;
     // Pointer to cumulative timer.
     CumulativeFunctionTimer* const cumulative_timer_;
   };
@@ -139,10 +160,10 @@ class CumulativeFunctionTimer {
  private:
   // Name of the timer.
   const std::string name_;
-  // Cumulative run time.
-  double total_run_time_;
+  // Cumulative run time, in nanoseconds.
+  std::atomic<uint64_t> total_run_time_ns_;
   // Number of times the function was invoked.
-  uint64_t total_invocations_;
+  std::atomic<uint64_t> total_invocations_;
 };
 
 #endif  // SRC_UTIL_TIMER_H_
@@ -0,0 +1,86 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+//
+// Lock-free triple buffer, to hand off the latest value of a large object
+// from one producer thread to one consumer thread.
+
+#include <atomic>
+
+#include "util/cache_line.h"
+
+#ifndef SRC_UTIL_TRIPLE_BUFFER_H_
+#define SRC_UTIL_TRIPLE_BUFFER_H_
+
+// The producer fills WriteBuffer() and calls Publish(); the consumer calls
+// Update() and then reads ReadBuffer(). Neither side ever blocks or copies:
+// publishing swaps the write buffer with a shared middle buffer, and updating
+// swaps the read buffer with it if it holds a newer value. Values published
+// faster than they are consumed are overwritten, so the consumer always sees
+// the latest one. Exactly one thread may write, and exactly one may read.
+// Every buffer and index is on cache lines of its own, so that the producer
+// and consumer only contend on the middle index, once per hand off.
+template <typename T>
+class TripleBuffer {
+ public:
+  TripleBuffer() : write_(0), middle_(1), read_(2) {}
+
+  // Buffer owned by the producer, to be filled before calling Publish().
+  // Holds an arbitrary older value, which may be reused to avoid allocations.
+  T& WriteBuffer() { return buffers_[write_.value].value; }
+
+  // Make the contents of WriteBuffer() the latest value, and hand the
+  // producer a new buffer to write to.
+  void Publish() {
+    write_.value = middle_.value.exchange(write_.value | kFresh,
+                                          std::memory_order_acq_rel) &
+        kIndexMask;
+  }
+
+  // Swap in the latest published value, if there is one that the consumer has
+  // not seen yet. Returns true iff ReadBuffer() changed.
+  bool Update() {
+    if ((middle_.value.load(std::memory_order_relaxed) & kFresh) == 0) {
+      return false;
+    }
+    read_.value = middle_.value.exchange(read_.value,
+                                         std::memory_order_acq_rel) &
+        kIndexMask;
+    return true;
+  }
+
+  // Buffer owned by the consumer, holding the value swapped in by the most
+  // recent successful Update().
+  const T& ReadBuffer() const { return buffers_[read_.value].value; }
+
+ private:
+  // Disable copy constructor and assignment operator.
+  TripleBuffer(const TripleBuffer&);
+  void operator=(const TripleBuffer&);
+
+  // The middle index is tagged with this bit while it holds a value that has
+  // been published but not yet read.
+  static const int kFresh = 4;
+  static const int kIndexMask = 3;
+
+  CacheLinePadded<T> buffers_[3];
+  // Index of the producer's buffer, only accessed by the producer.
+  CacheLinePadded<int> write_;
+  // Index of the shared buffer, and the kFresh flag.
+  CacheLinePadded<std::atomic<int>> middle_;
+  // Index of the consumer's buffer, only accessed by the consumer.
+  CacheLinePadded<int> read_;
+};
+
+#endif  // SRC_UTIL_TRIPLE_BUFFER_H_
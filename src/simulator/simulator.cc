@@ -0,0 +1,584 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    simulator.cc
+\brief   Headless simulator, which drives an Ackermann car through routes of
+         waypoints in a vector map with the navigation stack, and feeds the
+         particle filter and SLAM with simulated odometry and laser scans in
+         lockstep, as fast as they run. Reports the accuracy of every stage
+         alongside the CPU time it took. Does not need ROS, and has to be run
+         from the repository root, where the maps and config are.
+*/
+//========================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "eigen3/Eigen/Geometry"
+#include "gflags/gflags.h"
+#include "shared/math/line2d.h"
+#include "shared/math/math_util.h"
+#include "shared/util/random.h"
+#include "shared/util/timer.h"
+#include "navigation/global_planner.h"
+#include "navigation/navigation.h"
+#include "particle_filter/particle_filter.h"
+#include "slam/slam.h"
+#include "vector_map/vector_map.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using geometry::line2f;
+using math_util::AngleDiff;
+using math_util::AngleMod;
+using navigation::GlobalPlanner;
+using navigation::Navigation;
+using particle_filter::ParticleFilter;
+using std::string;
+using std::vector;
+
+DEFINE_string(map, "GDC1", "Name of the map in maps/ to drive in");
+DEFINE_int32(scenarios, 10, "Number of scenarios to run");
+DEFINE_int32(seed, 1, "Random seed for the scenarios and the noise");
+DEFINE_string(route, "",
+              "Comma-separated x,y coordinates of the start and waypoints to "
+              "drive through in every scenario. If empty, every scenario "
+              "drives through --waypoints random waypoints.");
+DEFINE_int32(waypoints, 3, "Number of random waypoints per scenario");
+DEFINE_double(min_leg_length, 3.0,
+              "Minimum distance between random waypoints, in m");
+DEFINE_double(max_duration, 120.0, "Simulated time limit per scenario, in s");
+DEFINE_double(goal_tolerance, 0.3,
+              "Distance from the final waypoint at which a stopped car has "
+              "reached it, in m");
+DEFINE_double(actuation_lag, 0.15,
+              "Time between a drive command and its execution, in s");
+DEFINE_double(max_acceleration, 4.0, "Acceleration limit of the car, in m/s^2");
+DEFINE_double(laser_noise, 0.02, "Standard deviation of laser ranges, in m");
+DEFINE_double(odom_translation_noise, 0.05,
+              "Standard deviation of odometry translation, as a fraction of "
+              "the translation");
+DEFINE_double(odom_rotation_noise, 0.05,
+              "Standard deviation of odometry rotation, as a fraction of "
+              "the rotation, plus the same fraction of the translation in rad");
+DEFINE_bool(particle_filter, true,
+            "Localize with the particle filter. If false, navigation is "
+            "given the true pose.");
+DEFINE_bool(slam, true, "Run SLAM on the simulated odometry and scans");
+DEFINE_string(output, "",
+              "CSV file to write one line of results per scenario to, if not "
+              "empty");
+
+namespace {
+// Rate at which Navigation::Run expects to be called.
+const double kTimeStep = 1.0 / 20;
+// Simulated laser, matching the real one, mounted ahead of base_link.
+const int kNumRays = 1081;
+const float kAngleMin = -2.35;
+const float kAngleMax = 2.35;
+const float kRangeMin = 0.02;
+const float kRangeMax = 10.0;
+const Vector2f kLaserLoc(0.2, 0);
+// Footprint of the car in base_link, matching Navigation.
+const float kLength = 0.535;
+const float kWidth = 0.281;
+const float kWheelBase = 0.40;
+// The car stops if it gets no commands for this long, in s.
+const double kCommandTimeout = 0.5;
+// Clearance from walls required of random waypoints, in m.
+const float kWaypointClearance = 0.5;
+// Lattice the reachability of random waypoints is checked on, matching the
+// inflation of the Navigation global planner.
+const float kPlannerResolution = 0.1;
+const float kPlannerInflation = kWidth / 2 + 0.1;
+
+struct Pose {
+  Vector2f loc;
+  float angle;
+};
+
+// Time spent in one stage of the stack.
+struct StageTime {
+  int64_t calls = 0;
+  double cpu_time = 0;
+  double wall_time = 0;
+
+  void Add(const StageTime& other) {
+    calls += other.calls;
+    cpu_time += other.cpu_time;
+    wall_time += other.wall_time;
+  }
+};
+
+// Adds the time spent until it goes out of scope to a stage.
+class StageTimer {
+ public:
+  explicit StageTimer(StageTime* stage) :
+      stage_(stage),
+      cpu_start_(GetProcessCpuTime()),
+      wall_start_(GetMonotonicTime()) {}
+
+  ~StageTimer() {
+    ++stage_->calls;
+    stage_->cpu_time += GetProcessCpuTime() - cpu_start_;
+    stage_->wall_time += GetMonotonicTime() - wall_start_;
+  }
+
+ private:
+  StageTime* const stage_;
+  const double cpu_start_;
+  const double wall_start_;
+};
+
+enum Stage {
+  kSimulation,
+  kParticleFilter,
+  kSlam,
+  kNavigation,
+  kNumStages,
+};
+const char* const kStageNames[kNumStages] = {
+  "simulation", "particle_filter", "slam", "navigation",
+};
+
+// Ackermann car, which executes the drive commands of Navigation after the
+// actuation lag, with bounded acceleration, and reports odometry that drifts
+// from its true pose.
+class Vehicle : public navigation::NavigationSink {
+ public:
+  explicit Vehicle(const Pose& pose) :
+      pose_(pose),
+      odom_{Vector2f(0, 0), 0},
+      velocity_(0),
+      curvature_(0),
+      distance_(0) {}
+
+  void DriveCommand(double time, float velocity, float curvature) override {
+    commands_.push_back(Command{time, velocity, curvature});
+  }
+
+  // Advance to time by dt.
+  void Step(double time, double dt, util_random::Random* rng) {
+    // Execute the latest command issued at least the actuation lag ago.
+    const double execution_time = time - FLAGS_actuation_lag;
+    while (commands_.size() > 1 && commands_[1].time <= execution_time) {
+      commands_.pop_front();
+    }
+    float target_velocity = 0;
+    if (!commands_.empty() && commands_.front().time <= execution_time &&
+        execution_time - commands_.front().time < kCommandTimeout) {
+      target_velocity = commands_.front().velocity;
+      curvature_ = commands_.front().curvature;
+    }
+    const float max_delta_v = FLAGS_max_acceleration * dt;
+    velocity_ += std::max(-max_delta_v,
+                          std::min(max_delta_v, target_velocity - velocity_));
+
+    // Exact motion along the arc, in the previous base_link.
+    const float distance = velocity_ * dt;
+    const float delta_angle = distance * curvature_;
+    const Vector2f delta_loc = (fabs(curvature_) > 1e-6) ?
+        Vector2f(sin(delta_angle), 1 - cos(delta_angle)) / curvature_ :
+        Vector2f(distance, 0);
+    pose_.loc += Rotation2Df(pose_.angle) * delta_loc;
+    pose_.angle = AngleMod(pose_.angle + delta_angle);
+    distance_ += fabs(distance);
+
+    const float odom_scale =
+        1 + rng->Gaussian(0, FLAGS_odom_translation_noise);
+    const float odom_delta_angle = delta_angle + rng->Gaussian(
+        0, FLAGS_odom_rotation_noise * (fabs(delta_angle) + fabs(distance)));
+    odom_.loc += Rotation2Df(odom_.angle) * (odom_scale * delta_loc);
+    odom_.angle = AngleMod(odom_.angle + odom_delta_angle);
+  }
+
+  // Laser scan from the true pose, with range noise.
+  void Scan(vector_map::VectorMap* map,
+            util_random::Random* rng,
+            vector<float>* ranges) const {
+    map->GetPredictedScan(pose_.loc + Rotation2Df(pose_.angle) * kLaserLoc,
+                          kRangeMin, kRangeMax,
+                          pose_.angle + kAngleMin, pose_.angle + kAngleMax,
+                          kNumRays, ranges);
+    for (float& r : *ranges) {
+      if (r < kRangeMax) {
+        r = std::max(kRangeMin, std::min(
+            kRangeMax, r + static_cast<float>(
+                rng->Gaussian(0, FLAGS_laser_noise))));
+      }
+    }
+  }
+
+  // Edges of the footprint in the map frame.
+  vector<line2f> Footprint() const {
+    const Rotation2Df rotation(pose_.angle);
+    const float back = -(kLength - kWheelBase) / 2;
+    const Vector2f corners[4] = {
+      pose_.loc + rotation * Vector2f(back, -kWidth / 2),
+      pose_.loc + rotation * Vector2f(back + kLength, -kWidth / 2),
+      pose_.loc + rotation * Vector2f(back + kLength, kWidth / 2),
+      pose_.loc + rotation * Vector2f(back, kWidth / 2),
+    };
+    vector<line2f> edges;
+    for (int i = 0; i < 4; ++i) {
+      edges.push_back(line2f(corners[i], corners[(i + 1) % 4]));
+    }
+    return edges;
+  }
+
+  const Pose& pose() const { return pose_; }
+  const Pose& odom() const { return odom_; }
+  float velocity() const { return velocity_; }
+  float angular_velocity() const { return velocity_ * curvature_; }
+  // Distance driven so far.
+  float distance() const { return distance_; }
+
+ private:
+  struct Command {
+    double time;
+    float velocity;
+    float curvature;
+  };
+
+  Pose pose_;
+  Pose odom_;
+  float velocity_;
+  float curvature_;
+  float distance_;
+  // Commands not superseded yet, oldest first.
+  std::deque<Command> commands_;
+};
+
+// Start pose and waypoints to drive through, in order.
+struct Scenario {
+  Pose start;
+  vector<Vector2f> waypoints;
+};
+
+struct ScenarioResult {
+  bool success = false;
+  bool collision = false;
+  double time = 0;
+  float distance = 0;
+  float min_clearance = std::numeric_limits<float>::infinity();
+  // Root mean square and largest error of the particle filter.
+  double pf_rms_error = 0;
+  double pf_max_error = 0;
+  double pf_rms_angle_error = 0;
+  // Root mean square error of SLAM, relative to the pose it started at.
+  double slam_rms_error = 0;
+  StageTime stages[kNumStages];
+};
+
+// Whether loc is inside the building and clear of walls.
+bool IsOpen(vector_map::VectorMap* map, const Vector2f& loc) {
+  const int kNumTestRays = 90;
+  vector<float> ranges;
+  map->GetPredictedScan(loc, 0, kRangeMax, -M_PI, M_PI, kNumTestRays,
+                        &ranges);
+  int num_hits = 0;
+  for (const float r : ranges) {
+    if (r < kWaypointClearance) return false;
+    if (r < kRangeMax) ++num_hits;
+  }
+  return num_hits > 3 * kNumTestRays / 4;
+}
+
+// Random start and waypoints in the open, each reachable from the previous
+// one.
+bool RandomScenario(vector_map::VectorMap* map,
+                    GlobalPlanner* planner,
+                    util_random::Random* rng,
+                    Scenario* scenario) {
+  Vector2f min_corner = map->lines[0].p0;
+  Vector2f max_corner = map->lines[0].p0;
+  for (const line2f& l : map->lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  // Start over after this many open points unreachable from the last one, which
+  // is then likely to be in a small enclosed area.
+  const int kMaxUnreachable = 20;
+  int num_unreachable = 0;
+  vector<Vector2f> points;
+  vector<Vector2f> path;
+  for (int attempt = 0;
+       static_cast<int>(points.size()) < FLAGS_waypoints + 1 &&
+       attempt < 10000;
+       ++attempt) {
+    const Vector2f loc(rng->UniformRandom(min_corner.x(), max_corner.x()),
+                       rng->UniformRandom(min_corner.y(), max_corner.y()));
+    if (!points.empty() &&
+        (loc - points.back()).norm() < FLAGS_min_leg_length) {
+      continue;
+    }
+    if (!IsOpen(map, loc) || !planner->IsFree(loc)) continue;
+    if (!points.empty() && !planner->Plan(points.back(), loc, &path)) {
+      if (++num_unreachable == kMaxUnreachable) {
+        num_unreachable = 0;
+        points.clear();
+      }
+      continue;
+    }
+    num_unreachable = 0;
+    points.push_back(loc);
+  }
+  if (static_cast<int>(points.size()) < FLAGS_waypoints + 1) return false;
+  scenario->start.loc = points[0];
+  scenario->start.angle = rng->UniformRandom(-M_PI, M_PI);
+  scenario->waypoints.assign(points.begin() + 1, points.end());
+  return true;
+}
+
+bool ParseRoute(const string& route, Scenario* scenario) {
+  vector<float> values;
+  std::stringstream stream(route);
+  string value;
+  while (std::getline(stream, value, ',')) {
+    values.push_back(atof(value.c_str()));
+  }
+  if (values.size() < 4 || values.size() % 2 != 0) return false;
+  vector<Vector2f> points;
+  for (size_t i = 0; i < values.size(); i += 2) {
+    points.push_back(Vector2f(values[i], values[i + 1]));
+  }
+  const Vector2f heading = points[1] - points[0];
+  scenario->start.loc = points[0];
+  scenario->start.angle = atan2(heading.y(), heading.x());
+  scenario->waypoints.assign(points.begin() + 1, points.end());
+  return true;
+}
+
+ScenarioResult RunScenario(vector_map::VectorMap* map,
+                           const Scenario& scenario,
+                           util_random::Random* rng) {
+  ScenarioResult result;
+  StageTime* const stages = result.stages;
+  double t = 0;
+  Vehicle vehicle(scenario.start);
+  // Scans are evaluated inline, so that runs are repeatable.
+  Navigation navigation("maps/" + FLAGS_map + ".txt",
+                        &vehicle,
+                        [&t]() { return t; },
+                        false);
+  ParticleFilter particle_filter;
+  if (FLAGS_particle_filter) {
+    particle_filter.Initialize(FLAGS_map, scenario.start.loc,
+                               scenario.start.angle);
+  }
+  slam::SLAM slam;
+  // SLAM builds its map in the frame of the first pose it sees.
+  Pose slam_origin = scenario.start;
+
+  navigation.UpdateLocation(scenario.start.loc, scenario.start.angle);
+  navigation.SetNavGoal(scenario.waypoints[0], 0);
+  for (size_t i = 1; i < scenario.waypoints.size(); ++i) {
+    if (!navigation.AddWaypoint(scenario.waypoints[i], 0)) {
+      printf("Waypoint (%f,%f) is unreachable\n",
+             scenario.waypoints[i].x(), scenario.waypoints[i].y());
+    }
+  }
+  const Vector2f goal = scenario.waypoints.back();
+
+  vector<float> ranges;
+  vector<Vector2f> point_cloud;
+  int64_t pf_samples = 0;
+  int64_t slam_samples = 0;
+  double pf_sum_sq_error = 0;
+  double pf_sum_sq_angle_error = 0;
+  double slam_sum_sq_error = 0;
+  while (t < FLAGS_max_duration) {
+    {
+      StageTimer timer(&stages[kSimulation]);
+      t += kTimeStep;
+      vehicle.Step(t, kTimeStep, rng);
+      vehicle.Scan(map, rng, &ranges);
+      point_cloud.clear();
+      const float da = (kAngleMax - kAngleMin) / kNumRays;
+      for (int i = 0; i < kNumRays; ++i) {
+        const float a = kAngleMin + i * da;
+        point_cloud.push_back(kLaserLoc + ranges[i] * Vector2f(cos(a),
+                                                               sin(a)));
+      }
+    }
+    const Pose& truth = vehicle.pose();
+    const Pose& odom = vehicle.odom();
+
+    Pose estimate = truth;
+    if (FLAGS_particle_filter) {
+      StageTimer timer(&stages[kParticleFilter]);
+      particle_filter.ObserveOdometry(odom.loc, odom.angle);
+      particle_filter.ObserveLaser(ranges, kRangeMin, kRangeMax, kAngleMin,
+                                   kAngleMax, GetMonotonicTime());
+      particle_filter.GetLocation(&estimate.loc, &estimate.angle);
+    }
+    if (FLAGS_particle_filter) {
+      const double error = (estimate.loc - truth.loc).norm();
+      const double angle_error = AngleDiff(estimate.angle, truth.angle);
+      pf_sum_sq_error += error * error;
+      pf_sum_sq_angle_error += angle_error * angle_error;
+      result.pf_max_error = std::max(result.pf_max_error, error);
+      ++pf_samples;
+    }
+
+    if (FLAGS_slam) {
+      if (slam_samples == 0) slam_origin = truth;
+      Pose slam_pose{Vector2f(NAN, NAN), NAN};
+      {
+        StageTimer timer(&stages[kSlam]);
+        slam.ObserveOdometry(odom.loc, odom.angle);
+        slam.ObserveLaser(ranges, kRangeMin, kRangeMax, kAngleMin, kAngleMax);
+        slam.GetPose(&slam_pose.loc, &slam_pose.angle);
+      }
+      if (!std::isnan(slam_pose.angle)) {
+        const Vector2f expected = Rotation2Df(-slam_origin.angle) *
+            (truth.loc - slam_origin.loc);
+        slam_sum_sq_error += (slam_pose.loc - expected).squaredNorm();
+        ++slam_samples;
+      }
+    }
+
+    {
+      StageTimer timer(&stages[kNavigation]);
+      navigation.UpdateOdometry(odom.loc, odom.angle,
+                                Vector2f(vehicle.velocity(), 0),
+                                vehicle.angular_velocity());
+      navigation.UpdateLocation(estimate.loc, estimate.angle);
+      navigation.ObservePointCloud(point_cloud, t);
+      navigation.Run();
+    }
+
+    for (const line2f& edge : vehicle.Footprint()) {
+      for (const line2f& wall : map->lines) {
+        if (edge.Intersects(wall)) result.collision = true;
+        result.min_clearance =
+            std::min(result.min_clearance, edge.ClosestApproach(wall));
+      }
+    }
+    if (result.collision) break;
+    if ((truth.loc - goal).norm() < FLAGS_goal_tolerance &&
+        fabs(vehicle.velocity()) < 0.05) {
+      result.success = true;
+      break;
+    }
+  }
+  result.time = t;
+  result.distance = vehicle.distance();
+  if (pf_samples > 0) {
+    result.pf_rms_error = sqrt(pf_sum_sq_error / pf_samples);
+    result.pf_rms_angle_error = sqrt(pf_sum_sq_angle_error / pf_samples);
+  }
+  if (slam_samples > 0) {
+    result.slam_rms_error = sqrt(slam_sum_sq_error / slam_samples);
+  }
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  util_random::Random rng(FLAGS_seed);
+  vector_map::VectorMap map("maps/" + FLAGS_map + ".txt");
+  if (map.lines.empty()) {
+    fprintf(stderr, "ERROR: Map %s is empty\n", FLAGS_map.c_str());
+    return 1;
+  }
+  GlobalPlanner planner(map, kPlannerResolution, kPlannerInflation);
+  Scenario route;
+  if (!FLAGS_route.empty() && !ParseRoute(FLAGS_route, &route)) {
+    fprintf(stderr, "ERROR: Unable to parse route '%s'\n", FLAGS_route.c_str());
+    return 1;
+  }
+  FILE* output = nullptr;
+  if (!FLAGS_output.empty()) {
+    output = fopen(FLAGS_output.c_str(), "w");
+    if (output == nullptr) {
+      fprintf(stderr, "ERROR: Unable to write %s\n", FLAGS_output.c_str());
+      return 1;
+    }
+    fprintf(output, "scenario,success,collision,time,distance,min_clearance,"
+            "pf_rms_error,pf_max_error,pf_rms_angle_error,slam_rms_error");
+    for (const char* name : kStageNames) fprintf(output, ",%s_cpu_time", name);
+    fprintf(output, "\n");
+  }
+
+  printf("%8s %7s %9s %9s %9s %9s %9s %9s %9s\n",
+         "scenario", "result", "time", "distance", "clearance",
+         "pf_rms", "pf_max", "pf_angle", "slam_rms");
+  int num_success = 0;
+  int num_collisions = 0;
+  double sim_time = 0;
+  StageTime totals[kNumStages];
+  const double wall_start = GetMonotonicTime();
+  for (int i = 0; i < FLAGS_scenarios; ++i) {
+    Scenario scenario = route;
+    if (FLAGS_route.empty() &&
+        !RandomScenario(&map, &planner, &rng, &scenario)) {
+      fprintf(stderr, "ERROR: Unable to find %d open waypoints in %s\n",
+              FLAGS_waypoints + 1, FLAGS_map.c_str());
+      return 1;
+    }
+    const ScenarioResult result = RunScenario(&map, scenario, &rng);
+    if (result.success) ++num_success;
+    if (result.collision) ++num_collisions;
+    sim_time += result.time;
+    for (int s = 0; s < kNumStages; ++s) totals[s].Add(result.stages[s]);
+    const char* outcome =
+        result.success ? "goal" : (result.collision ? "crash" : "timeout");
+    printf("%8d %7s %8.1fs %8.2fm %8.3fm %8.3fm %8.3fm %7.2f° %8.3fm\n",
+           i, outcome, result.time, result.distance, result.min_clearance,
+           result.pf_rms_error, result.pf_max_error,
+           math_util::RadToDeg(result.pf_rms_angle_error),
+           result.slam_rms_error);
+    fflush(stdout);
+    if (output != nullptr) {
+      fprintf(output, "%d,%d,%d,%f,%f,%f,%f,%f,%f,%f", i, result.success,
+              result.collision, result.time, result.distance,
+              result.min_clearance, result.pf_rms_error, result.pf_max_error,
+              result.pf_rms_angle_error, result.slam_rms_error);
+      for (const StageTime& stage : result.stages) {
+        fprintf(output, ",%f", stage.cpu_time);
+      }
+      fprintf(output, "\n");
+    }
+  }
+  if (output != nullptr) fclose(output);
+  const double wall_time = GetMonotonicTime() - wall_start;
+
+  printf("\n%d/%d scenarios reached the goal, %d crashed\n",
+         num_success, FLAGS_scenarios, num_collisions);
+  printf("Simulated %.1f s in %.1f s, %.1fx real time\n",
+         sim_time, wall_time, sim_time / wall_time);
+  printf("%-16s %10s %14s %14s\n", "stage", "steps", "cpu ms/step",
+         "wall ms/step");
+  for (int s = 0; s < kNumStages; ++s) {
+    if (totals[s].calls == 0) continue;
+    printf("%-16s %10ld %14.3f %14.3f\n", kStageNames[s],
+           static_cast<long>(totals[s].calls),
+           1e3 * totals[s].cpu_time / totals[s].calls,
+           1e3 * totals[s].wall_time / totals[s].calls);
+  }
+  return 0;
+}
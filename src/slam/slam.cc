@@ -23,10 +23,13 @@
 #include <iostream>
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
+#include "config_reader/config_reader.h"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "shared/math/geometry.h"
 #include "shared/math/math_util.h"
+#include "shared/util/profiler.h"
+#include "shared/util/thread_pool.h"
 #include "shared/util/timer.h"
 
 #include <numeric>
@@ -61,32 +64,81 @@ using vector_map::VectorMap;
 
 namespace slam {
 
+// Registration, tunable at run time
+CONFIG_FLOAT(min_trans_, "min_trans");
+CONFIG_FLOAT(resolution_, "resolution");
+CONFIG_INT(loc_samples_, "loc_samples");
+CONFIG_INT(angle_samples_, "angle_samples");
+config_reader::ConfigReader config_reader_({"config/slam.lua"});
+
 SLAM::SLAM() 
   : prev_odom_loc_( 0, 0 ),
     prev_odom_angle_( 0 ),
     odom_initialized_( false ),
-    map_initialized_( false ) 
+    map_initialized_( false ),
+    state_loc_( 0, 0 ),
+    state_angle_( 0 ),
+    prev_state_loc_( 0, 0 ),
+    prev_state_angle_( 0 ),
+    raster_resolution_( 0 ),
+    voxel_cube_( [this]( const VoxelParams& params ) { return BuildVoxelCube( params ); } )
+  {}
+
+VoxelParams SLAM::VoxelParamsFromConfig() const
+{
+  return VoxelParams{ std::max( 1, CONFIG_loc_samples_ ), std::max( 1, CONFIG_angle_samples_ ) };
+}
+
+void SLAM::UpdateVoxelCube()
+{
+  // The config is not read at construction, since a global SLAM may be constructed before the
+  // config variables are, so the first voxel cube is built on the first scan
+  if( voxel_cube_.Get() == nullptr )
+  {
+    voxel_cube_.Build( VoxelParamsFromConfig() );
+    return;
+  }
+  // A voxel cube for changed sampling parameters is built in the background, and swapped in between scans
+  voxel_cube_.Request( VoxelParamsFromConfig() );
+  voxel_cube_.Update();
+}
+
+std::shared_ptr<const vector<Voxel>> SLAM::BuildVoxelCube( const VoxelParams& params ) const
+{
+  std::shared_ptr<vector<Voxel>> voxel_cube = std::make_shared<vector<Voxel>>();
+  // Construct voxel cube
+  for( int a = -params.angle_samples; a <= params.angle_samples; ++a )  // Iterate over angle
   {
-    // Construct voxel cube
-    for( int a = -angle_samples_; a <= angle_samples_; ++a )  // Iterate over angle
+    float relative_angle_sample = a*angle_std_dev/params.angle_samples;
+
+    for( int ix = -params.loc_samples; ix <= params.loc_samples; ++ix )   // Iterate over x
     {
-      float relative_angle_sample = a*angle_std_dev/angle_samples_;
 
-      for( int ix = -loc_samples_; ix <= loc_samples_; ++ix )   // Iterate over x
+      for( int iy = -params.loc_samples; iy <= params.loc_samples; ++iy )   // Iterate over y
       {
-
-        for( int iy = -loc_samples_; iy <= loc_samples_; ++iy )   // Iterate over y
-        {
-          Vector2f relative_loc_sample( ix*loc_std_dev/loc_samples_,
-                                        iy*loc_std_dev/loc_samples_ );
-          
-          Voxel temp{relative_loc_sample, relative_angle_sample};
-          
-          voxel_cube_.push_back( temp );
-        }
+        Vector2f relative_loc_sample( ix*loc_std_dev/params.loc_samples,
+                                      iy*loc_std_dev/params.loc_samples );
+        
+        Voxel temp{relative_loc_sample, relative_angle_sample};
+        
+        voxel_cube->push_back( temp );
       }
     }
   }
+  return voxel_cube;
+}
+
+void SLAM::UpdateRaster( const vector<Vector2f>& point_cloud )
+{
+  raster_resolution_ = std::max( min_resolution_, CONFIG_resolution_ );
+  int const rows = 2*raster_height_/raster_resolution_;
+  int const cols = 2*raster_width_/raster_resolution_;
+  raster_.resize( rows+1, cols+1 );  // 2n+1
+  GenerateRaster( point_cloud,
+                  raster_resolution_,
+                  sigma_s_,
+                  &raster_ );
+}
 
 
 
@@ -131,7 +183,7 @@ void SLAM::GetRaster( float* resolution, MatrixXf* raster )
     return;
   }
 
-  *resolution = resolution_;
+  *resolution = raster_resolution_;
   *raster = raster_;
                 
   return;
@@ -144,9 +196,13 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
                          float angle_min,
                          float angle_max ) 
 {
+  PROFILE_FUNCTION();
   // A new laser scan has been observed. Decide whether to add it as a pose
   // for SLAM. If decided to add, align it to the scan from the last saved pose,
   // and save both the scan and the optimized pose.
+
+  UpdateVoxelCube();
+
   if( !map_initialized_ &&
       odom_initialized_ )
   {
@@ -164,10 +220,7 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
     prev_state_loc_ = state_loc_;
     prev_state_angle_ = state_angle_;
 
-    GenerateRaster( origin.point_cloud,
-                    resolution_,
-                    sigma_s_,
-                    &raster_ );
+    UpdateRaster( origin.point_cloud );
 
     return;
   }
@@ -175,7 +228,7 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
   // Default && short circuits so we wont get segfault if map_pose_scan doesnt have its first element
   if( odom_initialized_ &&
       map_initialized_ &&
-      ((prev_state_loc_ - state_loc_).norm() > min_trans_ ||
+      ((prev_state_loc_ - state_loc_).norm() > CONFIG_min_trans_ ||
       fabs(prev_state_angle_ - state_angle_) > min_rot_) )
   {
     
@@ -188,10 +241,7 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
 
     // This is the raster for the scan at our last update. The goal is to maximize the correlation between
     // the scan we just got, and this raster
-    GenerateRaster( map_pose_scan_.back().point_cloud,
-                    resolution_,
-                    sigma_s_,
-                    &raster_ );
+    UpdateRaster( map_pose_scan_.back().point_cloud );
 
     // This converts the scan we just got to a pointcloud
     vector<Vector2f> pcl = ScanToPointCloud( ranges,
@@ -208,22 +258,32 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
     // We use these as progress capture devices (read: keep most likely relative transform)
     Vector2f relative_loc( 0, 0 );
     float relative_angle = 0;
-    float likelihood = -1000000000;
 
-    for(const auto& v: voxel_cube_)
+    // The voxels are scored in parallel. Ties go to the first voxel, as in a serial search, so the result
+    // does not depend on the number of threads
+    struct Candidate
     {
-     
-      double const raster_likelihood = RasterWeighting( raster_,
-                                                        resolution_,
-                                                        TransformPointCloud(pcl, 
-                                                                           (relative_loc_mle + v.delta_loc), 
-                                                                           (relative_angle_mle + v.delta_angle)) );
-      if( likelihood < raster_likelihood )
-      { 
-        likelihood = raster_likelihood;
-        relative_loc = relative_loc_mle + v.delta_loc;
-        relative_angle = relative_angle_mle + v.delta_angle;
-      }
+      float likelihood;
+      size_t voxel;
+    };
+    const vector<Voxel>& voxel_cube = *voxel_cube_.Get();
+    const Candidate best = ThreadPool::Default().ParallelReduce(
+        0, voxel_cube.size(), 0, Candidate{ -1000000000, voxel_cube.size() },
+        [&]( size_t i ) {
+          const Voxel& v = voxel_cube[i];
+          double const raster_likelihood = RasterWeighting( raster_,
+                                                            raster_resolution_,
+                                                            TransformPointCloud(pcl, 
+                                                                               (relative_loc_mle + v.delta_loc), 
+                                                                               (relative_angle_mle + v.delta_angle)) );
+          return Candidate{ static_cast<float>( raster_likelihood ), i };
+        },
+        []( const Candidate& a, const Candidate& b ) { return ( a.likelihood < b.likelihood ) ? b : a; } );
+    float const likelihood = best.likelihood;
+    if( best.voxel < voxel_cube.size() )
+    {
+      relative_loc = relative_loc_mle + voxel_cube[best.voxel].delta_loc;
+      relative_angle = relative_angle_mle + voxel_cube[best.voxel].delta_angle;
     }
 
     // DELETE
@@ -244,6 +304,7 @@ void SLAM::ObserveLaser( const vector<float>& ranges,
 
 void SLAM::ProcessMPSwithGTSAM(std::vector<PoseScan>* mps_ptr)
 {
+  PROFILE_FUNCTION();
   if( !mps_ptr )
   {
     std::cout<<"ProcessMPSwithGTSAM was passed a nullptr! What the hell man...\n";
@@ -251,6 +312,8 @@ void SLAM::ProcessMPSwithGTSAM(std::vector<PoseScan>* mps_ptr)
   }
 
   std::vector<PoseScan>& mps = *mps_ptr; // mps = map_pose_scan
+
+  UpdateVoxelCube();
   
   std::vector<PoseScan> opt_rel_trans; //put at end 
 
@@ -261,21 +324,18 @@ void SLAM::ProcessMPSwithGTSAM(std::vector<PoseScan>* mps_ptr)
     float relative_angle_mle = mps[i].state_angle - mps[i+2].state_angle;
   
     // Raster from n pointcloud
-     GenerateRaster( mps[i].point_cloud,
-                     resolution_,
-                     sigma_s_,
-                     &raster_ );
+     UpdateRaster( mps[i].point_cloud );
 
     // We use these as progress capture devices (read: keep most likely relative transform)
     Vector2f relative_loc( 0, 0 );
     float relative_angle = 0.0;
     float likelihood = 0.0;
 
-    for(const auto& v: voxel_cube_)
+    for(const auto& v: *voxel_cube_.Get())
     {
 
       float raster_likelihood = RasterWeighting( raster_,
-                                                 resolution_,
+                                                 raster_resolution_,
                                                  mps[i+2].point_cloud);
         if( likelihood < raster_likelihood )
         { 
@@ -301,6 +361,7 @@ void SLAM::ProcessMPSwithGTSAM(std::vector<PoseScan>* mps_ptr)
 
 void SLAM::ObserveOdometry( const Vector2f& odom_loc, const float odom_angle ) 
 {
+  PROFILE_FUNCTION();
   if ( !odom_initialized_ ) 
   {
     prev_odom_angle_ = odom_angle;
@@ -314,7 +375,7 @@ void SLAM::ObserveOdometry( const Vector2f& odom_loc, const float odom_angle )
   
   const Rotation2Df base_link_rot( -prev_odom_angle_ );        // THIS HAS TO BE NEGATIVE :)
   Vector2f delta_T_bl = base_link_rot*( odom_loc - prev_odom_loc_ );  // delta_T_base_link: pres 6 slide 14
-  double const delta_angle_bl = odom_angle - prev_odom_angle_;        // delta_angle_base_link: pres 6 slide 15
+  double const delta_angle_bl = AngleDiff( odom_angle, prev_odom_angle_ ); // delta_angle_base_link: pres 6 slide 15
   
   Rotation2Df map_rot( state_angle_ );
   state_loc_ += map_rot*delta_T_bl;
@@ -329,6 +390,7 @@ void SLAM::ObserveOdometry( const Vector2f& odom_loc, const float odom_angle )
 
 vector<Vector2f> SLAM::GetMap() 
 {
+  PROFILE_FUNCTION();
   vector<Vector2f> map;
   // Reconstruct the map as a single aligned point cloud from all saved poses
   // and their respective scans.
@@ -353,6 +415,7 @@ void GenerateRaster( const vector<Vector2f>& pcl,
                      const float sensor_noise,
                      MatrixXf* raster_ptr )
 {
+  PROFILE_FUNCTION();
   // Pointcloud should be in the map frame
   if( !raster_ptr )
   {
@@ -438,6 +501,7 @@ double RasterWeighting( const MatrixXf& raster,
                         const float resolution,
                         const vector<Vector2f>& point_cloud )
 {
+  PROFILE_FUNCTION();
   // The point cloud given to this function should be transformed back to the rasters base_link
   // It is this reverse relative transfrom that we are essentially evaluating here
   double likelihood = 0.0;
@@ -28,10 +28,12 @@
 #include "gtsam/nonlinear/Marginals.h"
 #include "gtsam/nonlinear/Values.h"
 #include <algorithm>
+#include <memory>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
+#include "shared/util/background_builder.h"
 
 #ifndef SRC_SLAM_H_
 #define SRC_SLAM_H_
@@ -54,6 +56,18 @@ struct Voxel
   float delta_angle;
 };
 
+// Voxel cube sampling, tunable at run time. Total samples will be (2*loc_samples+1)^2*(2*angle_samples+1)
+struct VoxelParams
+{
+  int loc_samples;
+  int angle_samples;
+
+  bool operator==( const VoxelParams& other ) const
+  {
+    return loc_samples == other.loc_samples && angle_samples == other.angle_samples;
+  }
+};
+
 class SLAM {
   public:
     // Default Constructor.
@@ -85,6 +99,18 @@ class SLAM {
     void ProcessMPSwithGTSAM( std::vector<PoseScan>* mps );
     
   private:
+
+    // Voxel cube sampling from the config
+    VoxelParams VoxelParamsFromConfig() const;
+
+    // Build the voxel cube on first use, or swap in one rebuilt for changed sampling parameters
+    void UpdateVoxelCube();
+
+    // Offsets from the maximum likelihood relative transform to search for the best one
+    std::shared_ptr<const std::vector<Voxel>> BuildVoxelCube( const VoxelParams& params ) const;
+
+    // Rasterize a point cloud into raster_, at the configured resolution
+    void UpdateRaster( const std::vector<Eigen::Vector2f>& point_cloud );
     
     // Previous odometry-reported locations.
     Eigen::Vector2f prev_odom_loc_;
@@ -106,8 +132,7 @@ class SLAM {
     Eigen::Vector2f prev_state_loc_;
     float prev_state_angle_;
 
-    // Minumum translation before new scan will be registered
-    float const min_trans_ = 1.25;
+    // Minumum translation before new scan will be registered is configured by min_trans
     // Minumum rotation before new scan will be registered
     float const min_rot_ = M_PI/6;
 
@@ -115,25 +140,25 @@ class SLAM {
     float const raster_height_ = 8.5; // m 8.5
     float const raster_width_ = 5.5;  // m 5.5
     
-    // Raster
+    // Raster, at the resolution it was last generated with. The resolution is configured by resolution, and
+    // takes effect the next time the raster is generated.
     // Robot is at 0,0 of raster
-    float const resolution_ = 0.075; // m 0.075
-    int const rows =  2*raster_height_/resolution_;
-    int const cols = 2*raster_width_/resolution_;
-    Eigen::MatrixXf raster_{ rows+1, cols+1 };  // 2n+!
+    float raster_resolution_;
+    Eigen::MatrixXf raster_;
+    // Smallest resolution accepted from the config
+    float const min_resolution_ = 0.01; // m
     
     // Sensor noise
     float const sigma_s_ = 0.2; // ~ 0.1-0.2
 
-    // Voxel parameters
-    int const loc_samples_ = 10; // Total samples will be 2n+1 20
+    // Voxel parameters. The number of samples is configured by loc_samples and angle_samples.
     float const loc_std_dev = 0.4; // 0.2
-    int const angle_samples_ = 15; // 20
     float const angle_std_dev = 0.3; // 0.2
 
     // Voxel cube- can be made at construction time if the odom noise is the same throughout 
-    // which we assume is true
-    std::vector<Voxel> voxel_cube_;
+    // which we assume is true. Rebuilt in the background when the number of samples changes, and swapped in
+    // between scans.
+    BackgroundBuilder<VoxelParams, std::vector<Voxel>> voxel_cube_;
 
     // Factor graph container that contains relative successive poses ( read: the optimzed odom from aditional runs from CSM)
     gtsam::NonlinearFactorGraph nlfg_;
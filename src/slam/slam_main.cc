@@ -45,6 +45,8 @@
 #include "config_reader/config_reader.h"
 #include "shared/math/math_util.h"
 #include "shared/math/line2d.h"
+#include "shared/ros/profile_publisher.h"
+#include "shared/util/profiler.h"
 #include "shared/util/timer.h"
 
 #include "slam.h"
@@ -70,6 +72,12 @@ using visualization::DrawParticle;
 // Create command line arguements
 DEFINE_string(laser_topic, "/scan", "Name of ROS topic for LIDAR data");
 DEFINE_string(odom_topic, "/odom", "Name of ROS topic for odometry data");
+DEFINE_string(profile_output, "",
+              "File to periodically write the scoped profile to, if not empty");
+DEFINE_string(profile_topic, "",
+              "ROS topic to periodically publish the scoped profile on, if "
+              "not empty");
+DEFINE_double(profile_period, 5.0, "Seconds between scoped profile dumps");
 
 DECLARE_int32(v);
 
@@ -172,6 +180,8 @@ void LaserCallback(const sensor_msgs::LaserScan& msg) {
     printf("Laser t=%f\n", msg.header.stamp.toSec());
   }
   last_laser_msg_ = msg;
+  // Config changes take effect between scans.
+  config_reader::Update();
   slam_.ObserveLaser(
       msg.ranges,
       msg.range_min,
@@ -206,6 +216,11 @@ int main(int argc, char** argv) {
       n.advertise<VisualizationMsg>("visualization", 1);
   localization_publisher_ =
       n.advertise<amrl_msgs::Localization2DMsg>("localization", 1);
+  if (!FLAGS_profile_output.empty()) {
+    profiler::StartPeriodicDump(FLAGS_profile_output, FLAGS_profile_period);
+  }
+  ros_helpers::ProfilePublisher profile_publisher(
+      &n, FLAGS_profile_topic, FLAGS_profile_period);
 
   ros::Subscriber laser_sub = n.subscribe(
       FLAGS_laser_topic.c_str(),
@@ -216,6 +231,7 @@ int main(int argc, char** argv) {
       1,
       OdometryCallback);
   ros::spin();
+  profiler::StopPeriodicDump();
 
   return 0;
 }
@@ -0,0 +1,321 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.cc
+\brief   Precomputed Euclidean distance field of a vector map, for constant
+         time clearance queries.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "distance_field.h"
+
+using Eigen::Vector2f;
+using geometry::line2f;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+
+namespace {
+const char kMagic[4] = {'E', 'S', 'D', 'F'};
+const uint32_t kVersion = 2;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t map_hash;
+  float resolution;
+  float padding;
+  float origin_x;
+  float origin_y;
+  int32_t width;
+  int32_t height;
+};
+
+// FNV-1a hash of the map lines, the resolution and the padding.
+uint64_t MapHash(const vector_map::VectorMap& map,
+                 float resolution,
+                 float padding) {
+  uint64_t hash = 14695981039346656037ULL;
+  auto add = [&hash](float value) {
+    unsigned char bytes[sizeof(value)];
+    memcpy(bytes, &value, sizeof(value));
+    for (const unsigned char b : bytes) {
+      hash = (hash ^ b) * 1099511628211ULL;
+    }
+  };
+  add(resolution);
+  add(padding);
+  for (const line2f& l : map.lines) {
+    add(l.p0.x());
+    add(l.p0.y());
+    add(l.p1.x());
+    add(l.p1.y());
+  }
+  return hash;
+}
+
+// Distance from p to the segment from a to b.
+float SegmentDistance(const Vector2f& p, const Vector2f& a, const Vector2f& b) {
+  const Vector2f ab = b - a;
+  const float sq_length = ab.squaredNorm();
+  if (sq_length == 0) return (p - a).norm();
+  const float t = max(0.0f, min(1.0f, (p - a).dot(ab) / sq_length));
+  return (p - a - t * ab).norm();
+}
+}  // namespace
+
+namespace vector_map {
+
+void DistanceField::Build(const VectorMap& map,
+                          float resolution,
+                          float padding) {
+  const double t_start = GetMonotonicTime();
+  resolution_ = resolution;
+  padding_ = padding;
+  map_hash_ = MapHash(map, resolution, padding);
+  distance_.clear();
+  width_ = 0;
+  height_ = 0;
+  if (map.lines.empty()) return;
+
+  Vector2f min_corner = map.lines[0].p0;
+  Vector2f max_corner = map.lines[0].p0;
+  for (const line2f& l : map.lines) {
+    min_corner = min_corner.cwiseMin(l.p0).cwiseMin(l.p1);
+    max_corner = max_corner.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  origin_ = min_corner - Vector2f(padding, padding);
+  const Vector2f extent = max_corner - min_corner +
+      Vector2f(2.0 * padding, 2.0 * padding);
+  width_ = max(2, static_cast<int>(ceil(extent.x() / resolution_)) + 1);
+  height_ = max(2, static_cast<int>(ceil(extent.y() / resolution_)) + 1);
+  const int num_nodes = width_ * height_;
+  distance_.assign(num_nodes, std::numeric_limits<float>::infinity());
+  // Index of the closest line found so far, for every node.
+  vector<int> closest(num_nodes, -1);
+
+  auto node_loc = [this](int x, int y) {
+    return Vector2f(origin_.x() + x * resolution_,
+                    origin_.y() + y * resolution_);
+  };
+  auto try_line = [&](int x, int y, int line) {
+    const int index = y * width_ + x;
+    if (closest[index] == line) return;
+    const float d = SegmentDistance(node_loc(x, y),
+                                    map.lines[line].p0,
+                                    map.lines[line].p1);
+    if (d < distance_[index]) {
+      distance_[index] = d;
+      closest[index] = line;
+    }
+  };
+
+  // Seed the nodes around every line with their exact distance to it.
+  for (size_t j = 0; j < map.lines.size(); ++j) {
+    const line2f& l = map.lines[j];
+    const int num_steps =
+        static_cast<int>(ceil(l.Length() / (0.5 * resolution_)));
+    for (int i = 0; i <= num_steps; ++i) {
+      const Vector2f p = l.p0 + (l.p1 - l.p0) * i / max(1, num_steps);
+      const int x = static_cast<int>(floor((p.x() - origin_.x()) / resolution_));
+      const int y = static_cast<int>(floor((p.y() - origin_.y()) / resolution_));
+      for (int ny = max(0, y - 1); ny <= min(height_ - 1, y + 2); ++ny) {
+        for (int nx = max(0, x - 1); nx <= min(width_ - 1, x + 2); ++nx) {
+          try_line(nx, ny, j);
+        }
+      }
+    }
+  }
+
+  // Propagate the closest lines across the grid in forward and backward
+  // raster sweeps, as in 8SSEDT, but scoring every candidate line exactly
+  // instead of accumulating offsets. A single pair of sweeps leaves errors
+  // where Voronoi regions of lines are narrow, so sweep until nothing changes.
+  bool changed = true;
+  int num_sweeps = 0;
+  auto sweep = [&](int x, int y, int dx, int dy) {
+    const int index = y * width_ + x;
+    const int previous = closest[index];
+    if (x - dx >= 0 && x - dx < width_ && closest[index - dx] >= 0) {
+      try_line(x, y, closest[index - dx]);
+    }
+    if (y - dy >= 0 && y - dy < height_) {
+      for (int nx = max(0, x - 1); nx <= min(width_ - 1, x + 1); ++nx) {
+        const int neighbour = closest[(y - dy) * width_ + nx];
+        if (neighbour >= 0) try_line(x, y, neighbour);
+      }
+    }
+    if (closest[index] != previous) changed = true;
+  };
+  while (changed) {
+    changed = false;
+    ++num_sweeps;
+    for (int y = 0; y < height_; ++y) {
+      for (int x = 0; x < width_; ++x) sweep(x, y, 1, 1);
+    }
+    for (int y = height_ - 1; y >= 0; --y) {
+      for (int x = width_ - 1; x >= 0; --x) sweep(x, y, -1, -1);
+    }
+  }
+  printf("Distance field: %d x %d nodes, %d sweeps, %.1f ms\n",
+         width_, height_, 2 * num_sweeps, 1e3 * (GetMonotonicTime() - t_start));
+}
+
+bool DistanceField::Save(const string& file) const {
+  FILE* fid = fopen(file.c_str(), "wb");
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to write distance field %s\n",
+            file.c_str());
+    return false;
+  }
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.map_hash = map_hash_;
+  header.resolution = resolution_;
+  header.padding = padding_;
+  header.origin_x = origin_.x();
+  header.origin_y = origin_.y();
+  header.width = width_;
+  header.height = height_;
+  const bool ok =
+      fwrite(&header, sizeof(header), 1, fid) == 1 &&
+      fwrite(distance_.data(), sizeof(float), distance_.size(), fid) ==
+          distance_.size();
+  fclose(fid);
+  if (!ok) {
+    fprintf(stderr, "ERROR: Unable to write distance field %s\n",
+            file.c_str());
+  }
+  return ok;
+}
+
+bool DistanceField::Load(const string& file,
+                         const VectorMap& map,
+                         float resolution,
+                         float padding) {
+  FILE* fid = fopen(file.c_str(), "rb");
+  if (fid == NULL) return false;
+  FileHeader header;
+  bool ok = fread(&header, sizeof(header), 1, fid) == 1 &&
+      memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+      header.version == kVersion &&
+      header.map_hash == MapHash(map, resolution, padding) &&
+      header.resolution == resolution && header.padding == padding &&
+      header.width >= 0 && header.height >= 0;
+  if (ok) {
+    distance_.resize(static_cast<size_t>(header.width) * header.height);
+    ok = fread(distance_.data(), sizeof(float), distance_.size(), fid) ==
+        distance_.size();
+  }
+  fclose(fid);
+  if (!ok) {
+    distance_.clear();
+    width_ = 0;
+    height_ = 0;
+    return false;
+  }
+  map_hash_ = header.map_hash;
+  resolution_ = header.resolution;
+  padding_ = header.padding;
+  origin_ = Vector2f(header.origin_x, header.origin_y);
+  width_ = header.width;
+  height_ = header.height;
+  return true;
+}
+
+void DistanceField::LoadOrBuild(const VectorMap& map,
+                                float resolution,
+                                float padding,
+                                const string& cache_file) {
+  if (!cache_file.empty() && Load(cache_file, map, resolution, padding)) return;
+  Build(map, resolution, padding);
+  if (!cache_file.empty()) Save(cache_file);
+}
+
+float DistanceField::DistanceAndGradient(const Vector2f& loc,
+                                         Vector2f* gradient) const {
+  if (Empty()) {
+    if (gradient != nullptr) *gradient = Vector2f(0, 0);
+    return std::numeric_limits<float>::infinity();
+  }
+  // Grid coordinates of loc, and of the closest point on the grid.
+  const Vector2f g = (loc - origin_) / resolution_;
+  const float gx = max(0.0f, min<float>(width_ - 1, g.x()));
+  const float gy = max(0.0f, min<float>(height_ - 1, g.y()));
+  const int x = min(width_ - 2, static_cast<int>(gx));
+  const int y = min(height_ - 2, static_cast<int>(gy));
+  const float fx = gx - x;
+  const float fy = gy - y;
+  const float d00 = Node(x, y);
+  const float d10 = Node(x + 1, y);
+  const float d01 = Node(x, y + 1);
+  const float d11 = Node(x + 1, y + 1);
+  const float d = (1 - fy) * ((1 - fx) * d00 + fx * d10) +
+      fy * ((1 - fx) * d01 + fx * d11);
+  // Off the grid, the closest line is further away by at most the distance
+  // to the grid, and in that direction.
+  const Vector2f outside = resolution_ * Vector2f(g.x() - gx, g.y() - gy);
+  const float outside_distance = outside.norm();
+  if (gradient != nullptr) {
+    if (outside_distance > 0) {
+      *gradient = outside / outside_distance;
+    } else {
+      *gradient = Vector2f((1 - fy) * (d10 - d00) + fy * (d11 - d01),
+                           (1 - fx) * (d01 - d00) + fx * (d11 - d10)) /
+          resolution_;
+    }
+  }
+  return d + outside_distance;
+}
+
+bool DistanceField::IsClear(const Vector2f& v0,
+                            const Vector2f& v1,
+                            float margin) const {
+  if (Empty()) return true;
+  // Interpolating between nodes overestimates the distance by at most the
+  // distance to the farthest node of the cell.
+  const float error = M_SQRT1_2 * resolution_;
+  // Steps shorter than this are treated as contact, which bounds the number
+  // of steps along segments that graze a line.
+  const float min_step = 0.25 * resolution_;
+  const Vector2f direction = v1 - v0;
+  const float length = direction.norm();
+  float s = 0;
+  while (true) {
+    const Vector2f p =
+        (length > 0) ? Vector2f(v0 + (s / length) * direction) : v0;
+    const float step = Distance(p) - error - margin;
+    if (step < min_step) return false;
+    if (s >= length) return true;
+    s = min(length, s + step);
+  }
+}
+
+}  // namespace vector_map
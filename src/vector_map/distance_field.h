@@ -0,0 +1,119 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    distance_field.h
+\brief   Precomputed Euclidean distance field of a vector map, for constant
+         time clearance queries.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "vector_map.h"
+
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+namespace vector_map {
+
+// Distance from every node of a regular grid over a VectorMap to the closest
+// map line. Map lines are walls of zero thickness with no inside, so the
+// distances are never negative. Queries between nodes are bilinearly
+// interpolated, and queries off the grid are extrapolated from its border.
+class DistanceField {
+ public:
+  DistanceField() :
+      resolution_(1), padding_(0), width_(0), height_(0), map_hash_(0) {}
+
+  // Compute the field over the bounding box of the map lines, grown by
+  // padding on every side, with nodes every resolution meters.
+  void Build(const VectorMap& map, float resolution, float padding);
+
+  // Write the field to a binary file. Returns false on I/O errors.
+  bool Save(const std::string& file) const;
+
+  // Read a field written by Save. Returns false if the file does not exist or
+  // was written for a different map, resolution or padding.
+  bool Load(const std::string& file,
+            const VectorMap& map,
+            float resolution,
+            float padding);
+
+  // Load the field from cache_file if it matches the map, or else build it
+  // and write it to cache_file for next time. An empty cache_file disables
+  // the cache.
+  void LoadOrBuild(const VectorMap& map,
+                   float resolution,
+                   float padding,
+                   const std::string& cache_file);
+
+  bool Empty() const { return distance_.empty(); }
+
+  // Interpolated distance from loc to the closest map line.
+  float Distance(const Eigen::Vector2f& loc) const {
+    return DistanceAndGradient(loc, nullptr);
+  }
+
+  // Gradient of the interpolated distance at loc, which points away from the
+  // closest map line and has a norm of about 1.
+  Eigen::Vector2f Gradient(const Eigen::Vector2f& loc) const {
+    Eigen::Vector2f gradient;
+    DistanceAndGradient(loc, &gradient);
+    return gradient;
+  }
+
+  // Interpolated distance at loc, and its gradient if gradient is not null.
+  float DistanceAndGradient(const Eigen::Vector2f& loc,
+                            Eigen::Vector2f* gradient) const;
+
+  // Returns true iff every point of the segment from v0 to v1 is more than
+  // margin away from the map lines, by stepping along the segment by the
+  // clearance at every step. Conservative to within the grid resolution.
+  bool IsClear(const Eigen::Vector2f& v0,
+               const Eigen::Vector2f& v1,
+               float margin) const;
+
+  float Resolution() const { return resolution_; }
+  int Width() const { return width_; }
+  int Height() const { return height_; }
+
+ private:
+  // Distance at node (x, y), which must be on the grid.
+  float Node(int x, int y) const { return distance_[y * width_ + x]; }
+
+  // Spacing between nodes, in meters.
+  float resolution_;
+  // Margin around the bounding box of the map lines, in meters.
+  float padding_;
+  // Map-frame location of node (0, 0).
+  Eigen::Vector2f origin_;
+  // Grid dimensions, in nodes.
+  int width_;
+  int height_;
+  // Hash of the map lines, resolution and padding the field was computed for,
+  // to detect stale cache files.
+  uint64_t map_hash_;
+  // Distances, row by row.
+  std::vector<float> distance_;
+};
+
+}  // namespace vector_map
+
+#endif  // DISTANCE_FIELD_H